@@ -0,0 +1,53 @@
+#pragma once
+
+// Procedural geometry shared by the benchmark executables.
+
+#include "GeometricPrimitives.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Makes an axis-aligned cuboid, with vertices ordered as Cuboid expects.
+inline CuboidVertices MakeBox(const Vec3& Center, const Vec3& Extent)
+{
+    std::vector<Vec3> V = {
+        Center + Vec3( Extent.X,  Extent.Y,  Extent.Z),
+        Center + Vec3(-Extent.X,  Extent.Y,  Extent.Z),
+        Center + Vec3(-Extent.X, -Extent.Y,  Extent.Z),
+        Center + Vec3( Extent.X, -Extent.Y,  Extent.Z),
+        Center + Vec3( Extent.X,  Extent.Y, -Extent.Z),
+        Center + Vec3(-Extent.X,  Extent.Y, -Extent.Z),
+        Center + Vec3(-Extent.X, -Extent.Y, -Extent.Z),
+        Center + Vec3( Extent.X, -Extent.Y, -Extent.Z),
+    };
+    return CuboidVertices(V);
+}
+
+// Gets half the side length of a square map holding Walls random walls,
+// keeping occluder density roughly constant as the map grows.
+inline float RandomWallsHalfSize(int Walls)
+{
+    return 400.f * std::sqrt(float(std::max(Walls, 16)));
+}
+
+// Makes randomly placed, axis-aligned walls of standing height.
+inline std::vector<CuboidVertices> MakeRandomWalls(int Count, std::mt19937& Rng)
+{
+    const float MapHalfSize = RandomWallsHalfSize(Count);
+    std::uniform_real_distribution<float> Position(-MapHalfSize, MapHalfSize);
+    std::uniform_real_distribution<float> WallLength(100.f, 600.f);
+    std::uniform_real_distribution<float> WallWidth(20.f, 60.f);
+    std::vector<CuboidVertices> Walls;
+    Walls.reserve(Count);
+    for (int i = 0; i < Count; i++)
+    {
+        Vec3 Center(Position(Rng), Position(Rng), 150.f);
+        bool AlongX = (Rng() & 1) != 0;
+        float Length = WallLength(Rng);
+        float Width = WallWidth(Rng);
+        Vec3 Extent = AlongX ? Vec3(Length, Width, 150.f) : Vec3(Width, Length, 150.f);
+        Walls.emplace_back(MakeBox(Center, Extent));
+    }
+    return Walls;
+}
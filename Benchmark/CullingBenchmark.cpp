@@ -0,0 +1,475 @@
+// Headless benchmark of the culling pipeline.
+//
+// By default, builds a synthetic map, moves characters with a seeded
+// random walk, and reports the time spent culling each tick.
+// With --record, the synthetic run is also written to a trace.
+// With --replay, a recorded trace is fed through the pipeline at full speed,
+// and revealed pairs are checked against the recording tick by tick.
+// With --bake, the built occluders are also written to an asset.
+// With --asset, a replay loads the trace's occluders from a baked asset
+// instead of building them.
+// With --shared, a replay maps the trace's occluders from shared memory
+// published by another run under that name, or else builds and publishes them.
+//
+// --cull-threads culls bundles on that many threads, where zero uses
+// every hardware thread, which must not change what is revealed.
+// With --stagger, a synthetic run ticks in real time and staggers its culls
+// with other runs using the same stagger name, then reports its phase
+// and contention. Start several at once to see them spread out.
+// With --pipeline async, a synthetic run ticks in real time and culls on
+// a CullingPipeline, reporting the time each tick takes on the game thread.
+//
+// Usage:
+//   CullingBenchmark [--players N] [--cuboids N] [--spheres N]
+//                    [--ticks N] [--seed N] [--record PATH] [--bake PATH]
+//                    [--cull-threads N]
+//   CullingBenchmark [--players N] [--cuboids N] [--spheres N]
+//                    [--ticks N] [--seed N] [--cull-threads N]
+//                    (--stagger NAME | --pipeline async)
+//   CullingBenchmark --replay PATH [--bake PATH | --asset PATH | --shared NAME]
+//                    [--cull-threads N]
+
+#include "BenchmarkScene.h"
+#include "CullingCore.h"
+#include "CullingPipeline.h"
+#include "CullingStagger.h"
+#include "CullingTrace.h"
+#include "OccluderAsset.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        int Players = 10;
+        int Cuboids = 200;
+        int Spheres = 20;
+        int Ticks = 2400;
+        unsigned Seed = 1;
+        const char* RecordPath = nullptr;
+        const char* ReplayPath = nullptr;
+        const char* BakePath = nullptr;
+        const char* AssetPath = nullptr;
+        const char* SharedName = nullptr;
+        int CullThreads = 1;
+        const char* StaggerName = nullptr;
+        bool Async = false;
+    };
+
+    // Walking speed of simulated characters, in units per tick.
+    constexpr float WALK_SPEED = 250.f / SERVER_TICKRATE;
+    // Height of a character's camera above its center.
+    constexpr float CAMERA_HEIGHT = 60.f;
+
+    bool ParseOptions(int argc, char** argv, Options& O)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            const char* Flag = argv[i];
+            const char* Value = argv[++i];
+            long Number = std::strtol(Value, nullptr, 10);
+            if (std::strcmp(Flag, "--players") == 0) O.Players = int(Number);
+            else if (std::strcmp(Flag, "--cuboids") == 0) O.Cuboids = int(Number);
+            else if (std::strcmp(Flag, "--spheres") == 0) O.Spheres = int(Number);
+            else if (std::strcmp(Flag, "--ticks") == 0) O.Ticks = int(Number);
+            else if (std::strcmp(Flag, "--seed") == 0) O.Seed = unsigned(Number);
+            else if (std::strcmp(Flag, "--record") == 0) O.RecordPath = Value;
+            else if (std::strcmp(Flag, "--replay") == 0) O.ReplayPath = Value;
+            else if (std::strcmp(Flag, "--bake") == 0) O.BakePath = Value;
+            else if (std::strcmp(Flag, "--asset") == 0) O.AssetPath = Value;
+            else if (std::strcmp(Flag, "--shared") == 0) O.SharedName = Value;
+            else if (std::strcmp(Flag, "--cull-threads") == 0) O.CullThreads = int(Number);
+            else if (std::strcmp(Flag, "--stagger") == 0) O.StaggerName = Value;
+            else if (std::strcmp(Flag, "--pipeline") == 0 && std::strcmp(Value, "sync") == 0) O.Async = false;
+            else if (std::strcmp(Flag, "--pipeline") == 0 && std::strcmp(Value, "async") == 0) O.Async = true;
+            else return false;
+        }
+        // Replays cull on the recorded ticks, so staggered or asynchronous
+        // runs cannot be recorded.
+        return O.Players > 0
+            && O.Players <= MAX_CHARACTERS
+            && O.CullThreads >= 0
+            && (O.SharedName == nullptr || (O.ReplayPath != nullptr && O.AssetPath == nullptr))
+            && (O.StaggerName == nullptr || (O.RecordPath == nullptr && O.ReplayPath == nullptr))
+            && (!O.Async
+                || (O.StaggerName == nullptr && O.RecordPath == nullptr && O.ReplayPath == nullptr));
+    }
+
+    // Runs one server tick, returning its culling time in microseconds.
+    double RunTick(CullingCore& Core, VisibilityHash& Hash)
+    {
+        auto Start = std::chrono::steady_clock::now();
+        Core.Cull();
+        Core.UpdateVisibility([&Hash](int i, int j) { Hash.Add(i, j); });
+        auto Stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::micro>(Stop - Start).count();
+    }
+
+    // Prints the distribution of per-tick latencies.
+    void PrintLatencies(const char* Label, std::vector<double> Samples)
+    {
+        if (Samples.empty())
+        {
+            std::printf("%s: no samples\n", Label);
+            return;
+        }
+        std::sort(Samples.begin(), Samples.end());
+        double Total = 0;
+        for (double S : Samples)
+        {
+            Total += S;
+        }
+        auto Percentile = [&Samples](double P)
+        {
+            std::size_t Index = std::size_t(P * (Samples.size() - 1) + 0.5);
+            return Samples[Index];
+        };
+        std::printf(
+            "%s: n=%zu avg_us=%.2f p50_us=%.2f p90_us=%.2f p99_us=%.2f "
+            "p999_us=%.2f max_us=%.2f\n",
+            Label,
+            Samples.size(),
+            Total / Samples.size(),
+            Percentile(0.5),
+            Percentile(0.9),
+            Percentile(0.99),
+            Percentile(0.999),
+            Samples.back());
+    }
+
+    // Writes the occluders of a built core to an asset, if requested.
+    bool Bake(const char* Path, const CullingCore& Core)
+    {
+        if (Path == nullptr)
+        {
+            return true;
+        }
+        if (!BakeOccluderAsset(Path, Core))
+        {
+            std::fprintf(stderr, "Could not bake occluders to %s\n", Path);
+            return false;
+        }
+        std::printf("baked=%s\n", Path);
+        return true;
+    }
+
+    int RunSynthetic(const Options& O)
+    {
+        std::mt19937 Rng(O.Seed);
+        const float MapHalfSize = RandomWallsHalfSize(O.Cuboids);
+        std::uniform_real_distribution<float> Position(-MapHalfSize, MapHalfSize);
+        std::uniform_real_distribution<float> Angle(0.f, 6.2831853f);
+
+        std::unique_ptr<CullingCore> Core = std::make_unique<CullingCore>();
+        Core->SetCullingThreads(O.CullThreads);
+        for (const CuboidVertices& C : MakeRandomWalls(O.Cuboids, Rng))
+        {
+            Core->AddCuboid(C);
+        }
+        for (int i = 0; i < O.Spheres; i++)
+        {
+            Core->AddSphere(Sphere(Vec3(Position(Rng), Position(Rng), 100.f), 150.f));
+        }
+        std::vector<Vec3> Locations;
+        std::vector<float> Headings;
+        for (int i = 0; i < O.Players; i++)
+        {
+            Core->AddCharacter(char(i % 2));
+            Locations.emplace_back(Vec3(Position(Rng), Position(Rng), 100.f));
+            Headings.emplace_back(Angle(Rng));
+        }
+
+        TraceWriter Recorder;
+        if (O.RecordPath != nullptr && !Recorder.Open(O.RecordPath, *Core))
+        {
+            std::fprintf(stderr, "Could not create trace %s\n", O.RecordPath);
+            return 1;
+        }
+        auto BuildStart = std::chrono::steady_clock::now();
+        Core->BuildOccluders();
+        auto BuildStop = std::chrono::steady_clock::now();
+        if (!Bake(O.BakePath, *Core))
+        {
+            return 1;
+        }
+
+        CullingStagger Stagger;
+        if (O.StaggerName != nullptr && !Stagger.Open(O.StaggerName, Core->GetCullingPeriod()))
+        {
+            std::fprintf(stderr, "Could not join stagger segment %s\n", O.StaggerName);
+            return 1;
+        }
+        std::unique_ptr<CullingPipeline> Pipeline;
+        if (O.Async)
+        {
+            Pipeline.reset(new CullingPipeline(*Core));
+        }
+        const bool RealTime = Stagger.IsOpen() || Pipeline;
+        const auto TickDuration = std::chrono::nanoseconds(1000000000 / SERVER_TICKRATE);
+        const auto RunStart = std::chrono::steady_clock::now();
+
+        std::normal_distribution<float> Turn(0.f, 0.1f);
+        std::vector<double> CullTimes;
+        // Time each tick spends on the game thread, moving characters aside.
+        std::vector<double> TickTimes;
+        std::vector<Vec3> Cameras(O.Players);
+        std::vector<RigidTransform> Transforms(O.Players);
+        for (int Tick = 0; Tick < O.Ticks; Tick++)
+        {
+            if (RealTime)
+            {
+                std::this_thread::sleep_until(RunStart + TickDuration * Tick);
+            }
+            for (int i = 0; i < O.Players; i++)
+            {
+                Headings[i] += Turn(Rng);
+                Vec3 Next = Locations[i]
+                    + Vec3(std::cos(Headings[i]), std::sin(Headings[i]), 0) * WALK_SPEED;
+                // Turn around at the edge of the map.
+                if (std::abs(Next.X) > MapHalfSize || std::abs(Next.Y) > MapHalfSize)
+                {
+                    Headings[i] += 3.1415927f;
+                }
+                else
+                {
+                    Locations[i] = Next;
+                }
+                Cameras[i] = Locations[i] + Vec3(0, 0, CAMERA_HEIGHT);
+                Transforms[i] = RigidTransform(Quat::FromYaw(Headings[i]), Locations[i]);
+            }
+            auto Start = std::chrono::steady_clock::now();
+            if (Pipeline)
+            {
+                // Only copy inputs into the core while the worker is idle,
+                // and replicate the latest results either way.
+                if (Pipeline->StartTick())
+                {
+                    for (int i = 0; i < O.Players; i++)
+                    {
+                        Core->SetCharacterState(i, Cameras[i], Transforms[i]);
+                    }
+                    Pipeline->Submit();
+                }
+                VisibilityHash Hash;
+                Pipeline->ForEachRevealed([&Hash](int i, int j) { Hash.Add(i, j); });
+                TickTimes.emplace_back(std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - Start).count());
+                continue;
+            }
+            Core->StartTick();
+            if (Stagger.IsOpen())
+            {
+                Core->SetCullingPhase(Stagger.Update(Core->GetTotalTicks()));
+            }
+            for (int i = 0; i < O.Players; i++)
+            {
+                Core->SetCharacterState(i, Cameras[i], Transforms[i]);
+                Recorder.SetCharacter(i, Cameras[i], Transforms[i], Core->GetTeam(i), true);
+            }
+            bool Culled = Core->IsCullingTick();
+            VisibilityHash Hash;
+            if (Culled)
+            {
+                Stagger.BeginCull();
+            }
+            double Delta = RunTick(*Core, Hash);
+            if (Culled)
+            {
+                Stagger.EndCull();
+                CullTimes.emplace_back(Delta);
+            }
+            Recorder.EndTick(Hash);
+            TickTimes.emplace_back(std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - Start).count());
+        }
+        Recorder.Close();
+        std::string PipelineLine;
+        if (Pipeline)
+        {
+            PipelineLine = Pipeline->ToLogLine();
+            // Waits for the last job, so the core's metrics are safe to read.
+            Pipeline.reset();
+        }
+
+        std::printf("players=%d cuboids=%d spheres=%d ticks=%d seed=%u\n",
+            O.Players, O.Cuboids, O.Spheres, O.Ticks, O.Seed);
+        std::printf("bvh_build_us=%.1f\n",
+            std::chrono::duration<double, std::micro>(BuildStop - BuildStart).count());
+        PrintLatencies("all_ticks", TickTimes);
+        if (!PipelineLine.empty())
+        {
+            std::printf("pipeline=%s\n", PipelineLine.c_str());
+        }
+        else
+        {
+            PrintLatencies("cull_ticks", CullTimes);
+        }
+        std::printf("metrics=%s\n", Core->GetMetrics().ToLogLine().c_str());
+        if (Stagger.IsOpen())
+        {
+            std::printf("stagger=%s\n", Stagger.ToLogLine().c_str());
+        }
+        return 0;
+    }
+
+    int RunReplay(const Options& O)
+    {
+        const char* Path = O.ReplayPath;
+        TraceReader Trace;
+        if (!Trace.Open(Path))
+        {
+            std::fprintf(stderr, "Could not read trace %s\n", Path);
+            return 1;
+        }
+        // Outlives the core, which reads the asset's occluders in place.
+        OccluderAsset Asset;
+        std::unique_ptr<CullingCore> Core = std::make_unique<CullingCore>();
+        Core->SetCullingThreads(O.CullThreads);
+        auto BuildStart = std::chrono::steady_clock::now();
+        if (O.AssetPath != nullptr)
+        {
+            if (!Asset.Open(O.AssetPath))
+            {
+                std::fprintf(stderr, "Could not read asset %s\n", O.AssetPath);
+                return 1;
+            }
+            Trace.LoadCharacters(*Core);
+            Core->LoadOccluders(
+                Asset.GetCuboids(),
+                Asset.GetCuboidVertices(),
+                Asset.GetSpheres(),
+                Asset.GetWideNodes(),
+                Asset.GetSphereNodes());
+        }
+        else if (O.SharedName != nullptr)
+        {
+            bool Published = false;
+            Trace.LoadCharacters(*Core);
+            Trace.AddOccluders(*Core);
+            const uint64_t OccluderHash = Core->GetOccluderHash();
+            if (!Asset.OpenShared(O.SharedName, OccluderHash))
+            {
+                Core->BuildOccluders();
+                // Another run may have published first.
+                Published = Asset.PublishShared(O.SharedName, *Core);
+                if (!Published && !Asset.OpenShared(O.SharedName, OccluderHash))
+                {
+                    std::fprintf(stderr, "Could not share occluders as %s\n", O.SharedName);
+                    return 1;
+                }
+            }
+            Core->LoadOccluders(
+                Asset.GetCuboids(),
+                Asset.GetCuboidVertices(),
+                Asset.GetSpheres(),
+                Asset.GetWideNodes(),
+                Asset.GetSphereNodes());
+            std::printf("%s=%s\n", Published ? "published" : "shared", O.SharedName);
+        }
+        else
+        {
+            Trace.Load(*Core);
+        }
+        auto BuildStop = std::chrono::steady_clock::now();
+        if (int(Core->GetCuboids().size()) != Trace.GetNumCuboids()
+            || int(Core->GetSpheres().size()) != Trace.GetNumSpheres())
+        {
+            std::fprintf(
+                stderr,
+                "Asset %s does not hold the occluders of the trace\n",
+                O.AssetPath != nullptr ? O.AssetPath
+                    : O.SharedName != nullptr ? O.SharedName
+                    : "(built)");
+            return 1;
+        }
+        if (!Bake(O.BakePath, *Core))
+        {
+            return 1;
+        }
+
+        std::vector<double> CullTimes;
+        std::vector<double> TickTimes;
+        int Mismatches = 0;
+        int FirstMismatch = -1;
+        for (int Tick = 0; Tick < Trace.GetNumTicks(); Tick++)
+        {
+            Core->StartTick();
+            Trace.ApplyTick(Tick, *Core);
+            bool Culled = Core->IsCullingTick();
+            VisibilityHash Hash;
+            double Delta = RunTick(*Core, Hash);
+            TickTimes.emplace_back(Delta);
+            if (Culled)
+            {
+                CullTimes.emplace_back(Delta);
+            }
+            if (Hash.Value != Trace.GetVisibilityHash(Tick))
+            {
+                if (FirstMismatch < 0)
+                {
+                    FirstMismatch = Tick;
+                }
+                Mismatches++;
+            }
+        }
+
+        std::printf("trace=%s players=%d cuboids=%d spheres=%d ticks=%d\n",
+            Path,
+            Trace.GetNumCharacters(),
+            Trace.GetNumCuboids(),
+            Trace.GetNumSpheres(),
+            Trace.GetNumTicks());
+        std::printf("load_us=%.1f\n",
+            std::chrono::duration<double, std::micro>(BuildStop - BuildStart).count());
+        PrintLatencies("all_ticks", TickTimes);
+        PrintLatencies("cull_ticks", CullTimes);
+        std::printf("metrics=%s\n", Core->GetMetrics().ToLogLine().c_str());
+        if (Mismatches > 0)
+        {
+            std::printf("replay DIVERGED on %d ticks, first at tick %d\n",
+                Mismatches, FirstMismatch);
+            return 2;
+        }
+        std::printf("replay matched the recording on every tick\n");
+        return 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options O;
+    if (!ParseOptions(argc, argv, O))
+    {
+        std::fprintf(
+            stderr,
+            "Usage: %s [--players N<=%d] [--cuboids N] [--spheres N] "
+            "[--ticks N] [--seed N] [--record PATH] [--bake PATH] [--cull-threads N]\n"
+            "       %s [--players N] [--cuboids N] [--spheres N] [--ticks N] [--seed N] "
+            "[--cull-threads N] (--stagger NAME | --pipeline async)\n"
+            "       %s --replay PATH [--bake PATH | --asset PATH | --shared NAME] [--cull-threads N]\n",
+            argv[0],
+            MAX_CHARACTERS,
+            argv[0],
+            argv[0]);
+        return 1;
+    }
+    if (O.ReplayPath != nullptr)
+    {
+        return RunReplay(O);
+    }
+    return RunSynthetic(O);
+}
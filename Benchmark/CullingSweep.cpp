@@ -0,0 +1,424 @@
+// Scaling sweep of the culling pipeline.
+//
+// Runs every combination of occluder count, player count, and culling period
+// on a procedurally generated map, with characters walking its streets.
+// Writes one CSV row per tick with the tick's cost and the bundles
+// entering and culled by each stage, and prints a summary per configuration.
+//
+// Usage:
+//   CullingSweep [--map city|forest|buildings|mixed]
+//                [--occluders N,N,...] [--players N,N,...] [--periods N,N,...]
+//                [--bvh midpoint|sah|linear|both|all] [--traversal ray|shaft|both]
+//                [--schedule full|amortized|both]
+//                [--build-threads N] [--cull-threads N] [--moving N] [--dynamic N]
+//                [--ticks N] [--seed N] [--csv PATH]
+
+#include "CullingCore.h"
+#include "MapGenerator.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        MapKind Map = MapKind::Mixed;
+        std::vector<int> Occluders = { 1000, 10000 };
+        std::vector<int> Players = { 10, 50, 100 };
+        std::vector<int> Periods = { 1, 4 };
+        std::vector<BVHBuilder> Builders = { BVHBuilder::SAH };
+        std::vector<BVHTraversal> Traversals = { BVHTraversal::Ray };
+        std::vector<CullingSchedule> Schedules = { CullingSchedule::Full };
+        // Threads used to build the BVH, where zero uses every hardware thread.
+        int BuildThreads = 0;
+        // Threads that cull bundles, where zero uses every hardware thread.
+        int CullThreads = 1;
+        // Number of cuboids that move up and down like elevators.
+        int Moving = 0;
+        // Number of dynamic cuboids that drive along the streets like vehicles.
+        int Dynamic = 0;
+        int Ticks = 480;
+        unsigned Seed = 1;
+        const char* CsvPath = nullptr;
+    };
+
+    // Parses a comma-separated list of positive integers.
+    bool ParseList(const char* Value, std::vector<int>& List)
+    {
+        List.clear();
+        const char* P = Value;
+        while (*P != '\0')
+        {
+            char* End;
+            long Number = std::strtol(P, &End, 10);
+            if (End == P || Number <= 0)
+            {
+                return false;
+            }
+            List.emplace_back(int(Number));
+            P = (*End == ',') ? End + 1 : End;
+            if (*End != ',' && *End != '\0')
+            {
+                return false;
+            }
+        }
+        return !List.empty();
+    }
+
+    const char* GetBuilderName(BVHBuilder Builder)
+    {
+        switch (Builder)
+        {
+        case BVHBuilder::SAH: return "sah";
+        case BVHBuilder::Linear: return "linear";
+        default: return "midpoint";
+        }
+    }
+
+    bool ParseBuilders(const char* Value, std::vector<BVHBuilder>& Builders)
+    {
+        if (std::strcmp(Value, "midpoint") == 0) Builders = { BVHBuilder::Midpoint };
+        else if (std::strcmp(Value, "sah") == 0) Builders = { BVHBuilder::SAH };
+        else if (std::strcmp(Value, "linear") == 0) Builders = { BVHBuilder::Linear };
+        else if (std::strcmp(Value, "both") == 0) Builders = { BVHBuilder::Midpoint, BVHBuilder::SAH };
+        else if (std::strcmp(Value, "all") == 0)
+        {
+            Builders = { BVHBuilder::Midpoint, BVHBuilder::SAH, BVHBuilder::Linear };
+        }
+        else return false;
+        return true;
+    }
+
+    const char* GetTraversalName(BVHTraversal Traversal)
+    {
+        return Traversal == BVHTraversal::Shaft ? "shaft" : "ray";
+    }
+
+    bool ParseTraversals(const char* Value, std::vector<BVHTraversal>& Traversals)
+    {
+        if (std::strcmp(Value, "ray") == 0) Traversals = { BVHTraversal::Ray };
+        else if (std::strcmp(Value, "shaft") == 0) Traversals = { BVHTraversal::Shaft };
+        else if (std::strcmp(Value, "both") == 0) Traversals = { BVHTraversal::Ray, BVHTraversal::Shaft };
+        else return false;
+        return true;
+    }
+
+    const char* GetScheduleName(CullingSchedule Schedule)
+    {
+        return Schedule == CullingSchedule::Amortized ? "amortized" : "full";
+    }
+
+    bool ParseSchedules(const char* Value, std::vector<CullingSchedule>& Schedules)
+    {
+        if (std::strcmp(Value, "full") == 0) Schedules = { CullingSchedule::Full };
+        else if (std::strcmp(Value, "amortized") == 0) Schedules = { CullingSchedule::Amortized };
+        else if (std::strcmp(Value, "both") == 0) Schedules = { CullingSchedule::Full, CullingSchedule::Amortized };
+        else return false;
+        return true;
+    }
+
+    bool ParseOptions(int argc, char** argv, Options& O)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            const char* Flag = argv[i];
+            const char* Value = argv[++i];
+            bool Valid = true;
+            if (std::strcmp(Flag, "--map") == 0) Valid = ParseMapKind(Value, O.Map);
+            else if (std::strcmp(Flag, "--occluders") == 0) Valid = ParseList(Value, O.Occluders);
+            else if (std::strcmp(Flag, "--players") == 0) Valid = ParseList(Value, O.Players);
+            else if (std::strcmp(Flag, "--periods") == 0) Valid = ParseList(Value, O.Periods);
+            else if (std::strcmp(Flag, "--bvh") == 0) Valid = ParseBuilders(Value, O.Builders);
+            else if (std::strcmp(Flag, "--traversal") == 0) Valid = ParseTraversals(Value, O.Traversals);
+            else if (std::strcmp(Flag, "--schedule") == 0) Valid = ParseSchedules(Value, O.Schedules);
+            else if (std::strcmp(Flag, "--build-threads") == 0) O.BuildThreads = std::atoi(Value);
+            else if (std::strcmp(Flag, "--cull-threads") == 0) O.CullThreads = std::atoi(Value);
+            else if (std::strcmp(Flag, "--moving") == 0) O.Moving = std::atoi(Value);
+            else if (std::strcmp(Flag, "--dynamic") == 0) O.Dynamic = std::atoi(Value);
+            else if (std::strcmp(Flag, "--ticks") == 0) O.Ticks = std::atoi(Value);
+            else if (std::strcmp(Flag, "--seed") == 0) O.Seed = unsigned(std::strtoul(Value, nullptr, 10));
+            else if (std::strcmp(Flag, "--csv") == 0) O.CsvPath = Value;
+            else return false;
+            if (!Valid)
+            {
+                return false;
+            }
+        }
+        for (int Players : O.Players)
+        {
+            if (Players > MAX_CHARACTERS)
+            {
+                return false;
+            }
+        }
+        return O.Ticks > 0 && O.BuildThreads >= 0 && O.CullThreads >= 0 && O.Moving >= 0 && O.Dynamic >= 0;
+    }
+
+    // Height and period of moving cuboids.
+    constexpr float ELEVATOR_RISE = 600;
+    constexpr int ELEVATOR_TICKS = 4 * SERVER_TICKRATE;
+    // Half extent of dynamic cuboids.
+    const Vec3 VEHICLE_EXTENT = Vec3(200, 200, 100);
+
+    // Stage counters of the metrics at one point in time.
+    struct StageSnapshot
+    {
+        uint64_t Nanoseconds[NUM_STAGES];
+        uint64_t In[NUM_STAGES];
+        uint64_t Out[NUM_STAGES];
+
+        explicit StageSnapshot(const CullingMetrics& M)
+        {
+            for (int s = 0; s < NUM_STAGES; s++)
+            {
+                Nanoseconds[s] = M.GetStageNanoseconds(CullingStage(s));
+                In[s] = M.GetStageBundlesIn(CullingStage(s));
+                Out[s] = M.GetStageBundlesOut(CullingStage(s));
+            }
+        }
+    };
+
+    void WriteHeader(std::FILE* Csv)
+    {
+        std::fprintf(Csv, "map,bvh,traversal,schedule,occluders,cuboids,spheres,players,period,tick,culled,tick_us");
+        for (int s = 0; s < NUM_STAGES; s++)
+        {
+            std::fprintf(Csv, ",%s_us", CullingMetrics::GetStageName(CullingStage(s)));
+        }
+        // Bundles created, culled by each culling stage, and left visible.
+        std::fprintf(Csv, ",bundles,cache_culled,spheres_culled,cuboids_culled,visible\n");
+    }
+
+    // Runs one configuration, writing a row per tick.
+    void RunConfiguration(
+        const Options& O,
+        const GeneratedMap& Map,
+        int Occluders,
+        int Players,
+        int Period,
+        BVHBuilder Builder,
+        BVHTraversal Traversal,
+        CullingSchedule Schedule,
+        std::FILE* Csv)
+    {
+        std::unique_ptr<CullingCore> Core = std::make_unique<CullingCore>();
+        Core->SetCullingPeriod(Period);
+        Core->SetBVHBuilder(Builder);
+        Core->SetBVHTraversal(Traversal);
+        Core->SetCullingSchedule(Schedule);
+        Core->SetBuildThreads(O.BuildThreads);
+        Core->SetCullingThreads(O.CullThreads);
+        for (const CuboidVertices& C : Map.Cuboids)
+        {
+            Core->AddCuboid(C);
+        }
+        for (const Sphere& S : Map.Spheres)
+        {
+            Core->AddSphere(S);
+        }
+        for (int i = 0; i < Players; i++)
+        {
+            Core->AddCharacter(char(i % 2));
+        }
+        Core->BuildOccluders();
+        FastBVH::Quality Quality = Core->GetCuboidBVHQuality();
+
+        // Spread the moving cuboids evenly over the map's cuboids.
+        int Moving = std::min(O.Moving, int(Map.Cuboids.size()));
+        std::vector<int> MovingIds;
+        for (int m = 0; m < Moving; m++)
+        {
+            MovingIds.emplace_back(int(int64_t(m) * int64_t(Map.Cuboids.size()) / Moving));
+        }
+        std::vector<Vec3> Vertices(CUBOID_V);
+
+        StreetWalkers Walkers(Map, Players, O.Seed);
+        StreetWalkers Vehicles(Map, O.Dynamic, O.Seed + 1);
+        std::vector<double> CullTimes;
+        double TotalTime = 0;
+        for (int Tick = 0; Tick < O.Ticks; Tick++)
+        {
+            Walkers.Step();
+            Vehicles.Step();
+            Core->StartTick();
+            for (int i = 0; i < Players; i++)
+            {
+                Core->SetCharacterState(i, Walkers.GetCameraLocation(i), Walkers.GetTransform(i));
+            }
+            bool Culled = Core->IsCullingTick();
+            StageSnapshot Before(Core->GetMetrics());
+            auto Start = std::chrono::steady_clock::now();
+            for (int m = 0; m < Moving; m++)
+            {
+                // Rise up to ELEVATOR_RISE over ELEVATOR_TICKS and come back down,
+                // staggered so that elevators are at every height at once.
+                const CuboidVertices& Original = Map.Cuboids[MovingIds[m]];
+                float Phase = 2 * 3.1415927f * float(Tick + m * ELEVATOR_TICKS / Moving) / ELEVATOR_TICKS;
+                float Rise = 0.5f * ELEVATOR_RISE * (1 - std::cos(Phase));
+                for (int v = 0; v < CUBOID_V; v++)
+                {
+                    Vertices[v] = Original.Vertices[v] + Vec3(0, 0, Rise);
+                }
+                Core->UpdateCuboid(MovingIds[m], CuboidVertices(Vertices));
+            }
+            if (Culled && O.Dynamic > 0)
+            {
+                Core->ClearDynamicCuboids();
+                for (int v = 0; v < O.Dynamic; v++)
+                {
+                    Core->AddDynamicCuboid(MakeBox(Vehicles.GetLocation(v), VEHICLE_EXTENT));
+                }
+            }
+            Core->Cull();
+            Core->UpdateVisibility([](int, int) {});
+            auto Stop = std::chrono::steady_clock::now();
+            StageSnapshot After(Core->GetMetrics());
+
+            double Delta = std::chrono::duration<double, std::micro>(Stop - Start).count();
+            TotalTime += Delta;
+            if (Culled)
+            {
+                CullTimes.emplace_back(Delta);
+            }
+            std::fprintf(Csv, "%s,%s,%s,%s,%d,%zu,%zu,%d,%d,%d,%d,%.2f",
+                GetMapKindName(O.Map),
+                GetBuilderName(Builder),
+                GetTraversalName(Traversal),
+                GetScheduleName(Schedule),
+                Occluders,
+                Map.Cuboids.size(),
+                Map.Spheres.size(),
+                Players,
+                Period,
+                Tick,
+                Culled ? 1 : 0,
+                Delta);
+            for (int s = 0; s < NUM_STAGES; s++)
+            {
+                std::fprintf(Csv, ",%.2f", (After.Nanoseconds[s] - Before.Nanoseconds[s]) / 1000.0);
+            }
+            auto Culls = [&Before, &After](CullingStage S)
+            {
+                return (After.In[S] - Before.In[S]) - (After.Out[S] - Before.Out[S]);
+            };
+            std::fprintf(Csv, ",%llu,%llu,%llu,%llu,%llu\n",
+                (unsigned long long)(After.Out[STAGE_BUNDLES] - Before.Out[STAGE_BUNDLES]),
+                (unsigned long long)Culls(STAGE_CACHE),
+                (unsigned long long)Culls(STAGE_SPHERES),
+                (unsigned long long)Culls(STAGE_CUBOIDS),
+                (unsigned long long)(After.Out[STAGE_CUBOIDS] - Before.Out[STAGE_CUBOIDS]));
+        }
+
+        std::sort(CullTimes.begin(), CullTimes.end());
+        auto Percentile = [&CullTimes](double P)
+        {
+            return CullTimes.empty()
+                ? 0.0
+                : CullTimes[std::size_t(P * (CullTimes.size() - 1) + 0.5)];
+        };
+        // Work per cuboid traversal, to compare BVH builders and traversals.
+        const FastBVH::TraversalStats& Stats = *Core->GetMetrics().GetTraversalStats();
+        double Traversals = Stats.traversals > 0 ? double(Stats.traversals) : 1;
+        std::fprintf(
+            stderr,
+            "map=%s bvh=%s traversal=%s schedule=%s occluders=%d players=%d period=%d cull_threads=%d build_ms=%.1f "
+            "sah_cost=%.1f depth=%u wide_depth=%u leaves=%zu leaf_avg=%.2f leaf_max=%u "
+            "nodes_per=%.1f prims_per=%.2f "
+            "tick_avg_us=%.1f cull_p50_us=%.1f cull_p99_us=%.1f cull_max_us=%.1f\n",
+            GetMapKindName(O.Map),
+            GetBuilderName(Builder),
+            GetTraversalName(Traversal),
+            GetScheduleName(Schedule),
+            Occluders,
+            Players,
+            Period,
+            O.CullThreads,
+            Core->GetBuildMilliseconds(),
+            Quality.sah_cost,
+            Quality.depth,
+            Core->GetCuboidWideBVH() != nullptr ? Core->GetCuboidWideBVH()->getDepth() : 0u,
+            Quality.leaf_count,
+            Quality.mean_leaf_size,
+            Quality.max_leaf_size,
+            Stats.nodes_visited / Traversals,
+            Stats.primitives_tested / Traversals,
+            TotalTime / O.Ticks,
+            Percentile(0.5),
+            Percentile(0.99),
+            CullTimes.empty() ? 0.0 : CullTimes.back());
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options O;
+    if (!ParseOptions(argc, argv, O))
+    {
+        std::fprintf(
+            stderr,
+            "Usage: %s [--map city|forest|buildings|mixed] [--occluders N,N,...] "
+            "[--players N,N,...<=%d] [--periods N,N,...] [--bvh midpoint|sah|linear|both|all] "
+            "[--traversal ray|shaft|both] [--schedule full|amortized|both] [--build-threads N] [--cull-threads N] [--moving N] [--dynamic N] [--ticks N] [--seed N] "
+            "[--csv PATH]\n",
+            argv[0],
+            MAX_CHARACTERS);
+        return 1;
+    }
+    std::FILE* Csv = stdout;
+    if (O.CsvPath != nullptr)
+    {
+        Csv = std::fopen(O.CsvPath, "w");
+        if (Csv == nullptr)
+        {
+            std::fprintf(stderr, "Could not create %s\n", O.CsvPath);
+            return 1;
+        }
+    }
+    WriteHeader(Csv);
+    for (int Occluders : O.Occluders)
+    {
+        auto GenerateStart = std::chrono::steady_clock::now();
+        GeneratedMap Map = GenerateMap(O.Map, Occluders, O.Seed);
+        auto GenerateStop = std::chrono::steady_clock::now();
+        std::fprintf(
+            stderr,
+            "generated %s map: %zu cuboids, %zu spheres, %.0f units across in %.1f ms\n",
+            GetMapKindName(O.Map),
+            Map.Cuboids.size(),
+            Map.Spheres.size(),
+            2 * Map.GetHalfSize(),
+            std::chrono::duration<double, std::milli>(GenerateStop - GenerateStart).count());
+        for (int Players : O.Players)
+        {
+            for (int Period : O.Periods)
+            {
+                for (BVHBuilder Builder : O.Builders)
+                {
+                    for (BVHTraversal Traversal : O.Traversals)
+                    {
+                        for (CullingSchedule Schedule : O.Schedules)
+                        {
+                            RunConfiguration(
+                                O, Map, Occluders, Players, Period, Builder, Traversal, Schedule, Csv);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (Csv != stdout)
+    {
+        std::fclose(Csv);
+    }
+    return 0;
+}
@@ -0,0 +1,580 @@
+// Microbenchmarks of the culling kernels and BVH traversal.
+//
+// Each kernel runs over a few hundred jittered samples of a geometric case
+// (hit, miss, early-out on the top half, parallel face, ...) and reports
+// nanoseconds per call, calls per second, and TSC cycles per ray.
+// Results can be saved as a baseline and later compared against it,
+// failing when any kernel slows down by more than a threshold.
+// Before timing, the run checks that refits still reach cuboids
+// in subtrees that a rebuild collapsed into a single leaf.
+//
+// Usage:
+//   KernelBenchmark [--filter SUBSTRING] [--min-time-ms N] [--cuboids N]
+//                   [--save-baseline PATH] [--baseline PATH] [--threshold F]
+
+#include "BenchmarkScene.h"
+#include "CullingCore.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+namespace
+{
+    struct Options
+    {
+        const char* Filter = "";
+        double MinTimeMs = 50;
+        int Cuboids = 5000;
+        const char* SaveBaselinePath = nullptr;
+        const char* BaselinePath = nullptr;
+        double Threshold = 0.10;
+    };
+
+    // Number of jittered samples per case.
+    constexpr int NUM_SAMPLES = 256;
+    // Number of timed repetitions per case. The fastest one is reported.
+    constexpr int NUM_REPETITIONS = 5;
+    // Maximum displacement of peeks, as computed by the culling core
+    // for 100 ms of latency.
+    constexpr float PEEK_HORIZONTAL = 35.f;
+    constexpr float PEEK_VERTICAL = 20.f;
+
+    // Prevents the compiler from discarding kernel results.
+    volatile int Sink = 0;
+
+    bool ParseOptions(int argc, char** argv, Options& O)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            const char* Flag = argv[i];
+            const char* Value = argv[++i];
+            if (std::strcmp(Flag, "--filter") == 0) O.Filter = Value;
+            else if (std::strcmp(Flag, "--min-time-ms") == 0) O.MinTimeMs = std::atof(Value);
+            else if (std::strcmp(Flag, "--cuboids") == 0) O.Cuboids = std::atoi(Value);
+            else if (std::strcmp(Flag, "--save-baseline") == 0) O.SaveBaselinePath = Value;
+            else if (std::strcmp(Flag, "--baseline") == 0) O.BaselinePath = Value;
+            else if (std::strcmp(Flag, "--threshold") == 0) O.Threshold = std::atof(Value);
+            else return false;
+        }
+        return O.MinTimeMs > 0 && O.Cuboids > 0;
+    }
+
+    // Lines of sight from a player's peeks to an enemy's bounds.
+    struct BundleSample
+    {
+        Vec3 Camera;
+        Vec3 EnemyCenter;
+        Vec3 Peeks[NUM_PEEKS];
+        CharacterBounds Bounds;
+        // Inputs to IntersectsAll for the top half of the bundle,
+        // packed the same way IsBlocking packs them.
+        __m256 StartXs;
+        __m256 StartYs;
+        __m256 StartZs;
+        BundleSample(const Vec3& Camera, const Vec3& EnemyCenter, float Yaw)
+            : Camera(Camera),
+              EnemyCenter(EnemyCenter),
+              Bounds(RigidTransform(Quat::FromYaw(Yaw), EnemyCenter))
+        {
+            CullingCore::GetPossiblePeeks(
+                Camera, EnemyCenter, PEEK_HORIZONTAL, PEEK_VERTICAL, Peeks);
+            StartXs = _mm256_set_ps(
+                Peeks[0].X, Peeks[0].X, Peeks[0].X, Peeks[0].X,
+                Peeks[1].X, Peeks[1].X, Peeks[1].X, Peeks[1].X);
+            StartYs = _mm256_set_ps(
+                Peeks[0].Y, Peeks[0].Y, Peeks[0].Y, Peeks[0].Y,
+                Peeks[1].Y, Peeks[1].Y, Peeks[1].Y, Peeks[1].Y);
+            StartZs = _mm256_set_ps(
+                Peeks[0].Z, Peeks[0].Z, Peeks[0].Z, Peeks[0].Z,
+                Peeks[1].Z, Peeks[1].Z, Peeks[1].Z, Peeks[1].Z);
+        }
+    };
+
+    struct SegmentSample
+    {
+        Vec3 Start;
+        Vec3 End;
+        OptSegment Segment;
+        SegmentSample(const Vec3& Start, const Vec3& End)
+            : Start(Start), End(End), Segment(Start, End) {}
+    };
+
+    // Generates bundles from a player near PlayerCamera to an enemy near
+    // EnemyCenter, jittered along Y by up to Jitter in each direction.
+    std::vector<BundleSample> MakeBundles(
+        std::mt19937& Rng,
+        const Vec3& PlayerCamera,
+        const Vec3& EnemyCenter,
+        float Jitter)
+    {
+        std::uniform_real_distribution<float> Offset(-Jitter, Jitter);
+        std::uniform_real_distribution<float> Yaw(0.f, 6.2831853f);
+        std::vector<BundleSample> Samples;
+        for (int i = 0; i < NUM_SAMPLES; i++)
+        {
+            Samples.emplace_back(
+                PlayerCamera + Vec3(0, Offset(Rng), 0),
+                EnemyCenter + Vec3(0, Offset(Rng), 0),
+                Yaw(Rng));
+        }
+        return Samples;
+    }
+
+    std::vector<SegmentSample> MakeSegments(
+        std::mt19937& Rng,
+        const Vec3& Start,
+        const Vec3& End,
+        float Jitter)
+    {
+        std::uniform_real_distribution<float> Offset(-Jitter, Jitter);
+        std::vector<SegmentSample> Samples;
+        for (int i = 0; i < NUM_SAMPLES; i++)
+        {
+            float StartOffset = Offset(Rng);
+            float EndOffset = Offset(Rng);
+            Samples.emplace_back(
+                Start + Vec3(0, StartOffset, 0),
+                End + Vec3(0, EndOffset, 0));
+        }
+        return Samples;
+    }
+
+    struct Measurement
+    {
+        double NsPerCall;
+        double CallsPerSecond;
+        double CyclesPerRay;
+    };
+
+    // Times Kernel(i) over all samples, repeating until MinTimeMs passes.
+    // Reports the fastest of several repetitions.
+    template <typename Kernel>
+    Measurement Measure(Kernel&& K, int NumSamples, int RaysPerCall, double MinTimeMs)
+    {
+        // Warm caches and branch predictors.
+        for (int i = 0; i < NumSamples; i++)
+        {
+            Sink = Sink + int(K(i));
+        }
+        Measurement Best = { 1e30, 0, 0 };
+        for (int Repetition = 0; Repetition < NUM_REPETITIONS; Repetition++)
+        {
+            long long Calls = 0;
+            int Hits = 0;
+            double ElapsedNs = 0;
+            unsigned long long StartCycles = __rdtsc();
+            auto Start = std::chrono::steady_clock::now();
+            do
+            {
+                for (int i = 0; i < NumSamples; i++)
+                {
+                    Hits += int(K(i));
+                }
+                Calls += NumSamples;
+                ElapsedNs = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - Start).count();
+            } while (ElapsedNs < MinTimeMs * 1e6);
+            unsigned long long Cycles = __rdtsc() - StartCycles;
+            Sink = Sink + Hits;
+            double NsPerCall = ElapsedNs / Calls;
+            if (NsPerCall < Best.NsPerCall)
+            {
+                Best.NsPerCall = NsPerCall;
+                Best.CallsPerSecond = 1e9 / NsPerCall;
+                Best.CyclesPerRay = double(Cycles) / Calls / RaysPerCall;
+            }
+        }
+        return Best;
+    }
+
+    class Suite
+    {
+        const Options& O;
+        std::map<std::string, Measurement> Results;
+
+    public:
+        explicit Suite(const Options& O) : O(O)
+        {
+            std::printf("%-36s %12s %14s %12s\n",
+                "kernel/case", "ns/call", "calls/sec", "cycles/ray");
+        }
+
+        template <typename Kernel>
+        void Run(const std::string& Name, int NumSamples, int RaysPerCall, Kernel&& K)
+        {
+            if (Name.find(O.Filter) == std::string::npos)
+            {
+                return;
+            }
+            if (NumSamples == 0)
+            {
+                std::printf("%-36s %12s\n", Name.c_str(), "no samples");
+                return;
+            }
+            Measurement M = Measure(K, NumSamples, RaysPerCall, O.MinTimeMs);
+            Results[Name] = M;
+            std::printf("%-36s %12.2f %14.0f %12.2f\n",
+                Name.c_str(), M.NsPerCall, M.CallsPerSecond, M.CyclesPerRay);
+        }
+
+        bool SaveBaseline(const char* Path) const
+        {
+            std::FILE* File = std::fopen(Path, "w");
+            if (File == nullptr)
+            {
+                return false;
+            }
+            std::fprintf(File, "# KernelBenchmark baseline: kernel/case ns/call\n");
+            for (const auto& Result : Results)
+            {
+                std::fprintf(File, "%s %.4f\n", Result.first.c_str(), Result.second.NsPerCall);
+            }
+            std::fclose(File);
+            return true;
+        }
+
+        // Compares results against a saved baseline, returning the number
+        // of kernels that slowed down by more than the threshold.
+        int CompareBaseline(const char* Path) const
+        {
+            std::FILE* File = std::fopen(Path, "r");
+            if (File == nullptr)
+            {
+                std::fprintf(stderr, "Could not read baseline %s\n", Path);
+                return -1;
+            }
+            std::printf("\ncomparison with %s (threshold %+.0f%%)\n", Path, O.Threshold * 100);
+            int Regressions = 0;
+            char Line[256];
+            while (std::fgets(Line, sizeof(Line), File) != nullptr)
+            {
+                char Name[200];
+                double BaselineNs;
+                if (Line[0] == '#' || std::sscanf(Line, "%199s %lf", Name, &BaselineNs) != 2)
+                {
+                    continue;
+                }
+                auto Result = Results.find(Name);
+                if (Result == Results.end())
+                {
+                    continue;
+                }
+                double Change = Result->second.NsPerCall / BaselineNs - 1;
+                bool Regressed = Change > O.Threshold;
+                Regressions += Regressed ? 1 : 0;
+                std::printf("%-36s %10.2f -> %10.2f ns %+7.1f%%%s\n",
+                    Name,
+                    BaselineNs,
+                    Result->second.NsPerCall,
+                    Change * 100,
+                    Regressed ? "  REGRESSION" : "");
+            }
+            std::fclose(File);
+            return Regressions;
+        }
+    };
+
+    // Rebuilds each subtree of a small BVH into a single leaf, as SAH
+    // rebuilds may, then moves a cuboid of the leaf and refits the leaf,
+    // as CullingCore::RefitCuboids does. Returns false if a traversal
+    // through the moved cuboid misses it.
+    bool CheckRefitAfterReplace()
+    {
+        std::mt19937 Rng(1);
+        const std::vector<CuboidVertices> MapVertices = MakeRandomWalls(64, Rng);
+        const float Far = 3 * RandomWallsHalfSize(64);
+        const CuboidVertices Moved = MakeBox(Vec3(Far, 0, 150), Vec3(50, 400, 150));
+        const BundleSample Sample(Vec3(Far - 800, 0, 160), Vec3(Far + 800, 0, 100), 0);
+        CuboidIntersector Intersector;
+        for (uint32_t Index = 1; ; Index++)
+        {
+            std::vector<CuboidVertices> Vertices(MapVertices);
+            std::vector<Cuboid> Walls(Vertices.begin(), Vertices.end());
+            BuildStrategy<float, 1> Builder;
+            BVH<float, Cuboid> Tree(
+                BuildCuboidNodes(Builder, Walls, Vertices),
+                ConstIterable<Cuboid>(Walls.data(), Walls.size()));
+            if (Index >= Tree.getNodes().size())
+            {
+                return true;
+            }
+            Node<float> Leaf = Tree.getNodes()[Index];
+            if (Leaf.isLeaf())
+            {
+                continue;
+            }
+            WideBVH<Cuboid> Wide(Tree);
+            Refitter<float, Cuboid> Refit(Tree);
+            const uint32_t OldEnd = Tree.getSubtreeEnd(Index);
+            Leaf.right_offset = 0;
+            Refit.replaceSubtree(Index, ConstIterable<Node<float>>(&Leaf, 1));
+            Wide.replaceSubtree(Tree, Index, OldEnd);
+            Walls[Leaf.start] = Cuboid(Moved);
+            Vertices[Leaf.start] = Moved;
+            Refit.refit(
+                Leaf.start,
+                [&](const Cuboid& C)
+                {
+                    return CuboidBoxConverter()(Vertices[&C - Walls.data()]);
+                },
+                std::numeric_limits<float>::infinity(),
+                [&Wide](uint32_t Node, const BBox<float>& Box)
+                {
+                    Wide.refit(Node, Box);
+                });
+            WideTraverser<Cuboid, CuboidIntersector> Traverser(Wide, Intersector);
+            if (Traverser.traverse(
+                    OptSegment(Sample.Camera, Sample.EnemyCenter),
+                    Sample.Peeks,
+                    Sample.Bounds) == nullptr)
+            {
+                std::fprintf(
+                    stderr,
+                    "Refit after rebuilding node %u into a leaf missed the moved cuboid\n",
+                    Index);
+                return false;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options O;
+    if (!ParseOptions(argc, argv, O))
+    {
+        std::fprintf(
+            stderr,
+            "Usage: %s [--filter SUBSTRING] [--min-time-ms N] [--cuboids N]\n"
+            "          [--save-baseline PATH] [--baseline PATH] [--threshold F]\n",
+            argv[0]);
+        return 1;
+    }
+    if (!CheckRefitAfterReplace())
+    {
+        return 1;
+    }
+    std::mt19937 Rng(1);
+    Suite S(O);
+
+    // A standing wall between a player on the -X side and an enemy on the +X side.
+    const CuboidVertices WallVertices = MakeBox(Vec3(0, 0, 150), Vec3(50, 400, 150));
+    const Cuboid Wall(WallVertices);
+    // A wall that hides the enemy's head but not its feet.
+    const Cuboid Awning(MakeBox(Vec3(0, 0, 250), Vec3(50, 400, 100)));
+    // A low wall that horizontal lines of sight pass over.
+    const CuboidVertices CurbVertices = MakeBox(Vec3(0, 0, 25), Vec3(50, 400, 25));
+    const Cuboid Curb(CurbVertices);
+    const Vec3 Camera(-800, 0, 160);
+    const Vec3 Enemy(800, 0, 100);
+    // Puts the top peeks level with the enemy's top vertices.
+    const Vec3 LevelCamera(-800, 0, Enemy.Z + 100 - PEEK_VERTICAL);
+
+    std::vector<BundleSample> Hidden = MakeBundles(Rng, Camera, Enemy, 200);
+    std::vector<BundleSample> Beside = MakeBundles(Rng, Camera, Enemy + Vec3(0, 1500, 0), 200);
+    std::vector<BundleSample> Level = MakeBundles(Rng, LevelCamera, Enemy, 200);
+
+    S.Run("IntersectsAll/hit", NUM_SAMPLES, 8, [&](int i)
+    {
+        const BundleSample& B = Hidden[i];
+        return IntersectsAll(&Wall, B.StartXs, B.StartYs, B.StartZs,
+            B.Bounds.GetHalfXs(0), B.Bounds.GetHalfYs(0), B.Bounds.GetHalfZs(0));
+    });
+    S.Run("IntersectsAll/miss", NUM_SAMPLES, 8, [&](int i)
+    {
+        const BundleSample& B = Beside[i];
+        return IntersectsAll(&Wall, B.StartXs, B.StartYs, B.StartZs,
+            B.Bounds.GetHalfXs(0), B.Bounds.GetHalfYs(0), B.Bounds.GetHalfZs(0));
+    });
+    S.Run("IntersectsAll/parallel_face", NUM_SAMPLES, 8, [&](int i)
+    {
+        const BundleSample& B = Level[i];
+        return IntersectsAll(&Curb, B.StartXs, B.StartYs, B.StartZs,
+            B.Bounds.GetHalfXs(0), B.Bounds.GetHalfYs(0), B.Bounds.GetHalfZs(0));
+    });
+
+    S.Run("IsBlocking.Cuboid/hit", NUM_SAMPLES, 16, [&](int i)
+    {
+        return IsBlocking(Hidden[i].Peeks, Hidden[i].Bounds, &Wall);
+    });
+    S.Run("IsBlocking.Cuboid/top_early_out", NUM_SAMPLES, 16, [&](int i)
+    {
+        return IsBlocking(Beside[i].Peeks, Beside[i].Bounds, &Wall);
+    });
+    S.Run("IsBlocking.Cuboid/bottom_miss", NUM_SAMPLES, 16, [&](int i)
+    {
+        return IsBlocking(Hidden[i].Peeks, Hidden[i].Bounds, &Awning);
+    });
+    S.Run("IsBlocking.Cuboid/parallel_face", NUM_SAMPLES, 16, [&](int i)
+    {
+        return IsBlocking(Level[i].Peeks, Level[i].Bounds, &Curb);
+    });
+
+    // A pillar between the player and enemy, and one off to the side.
+    const Sphere Pillar(Vec3(0, 0, 100), 600);
+    const Sphere Post(Vec3(0, 0, 100), 120);
+    const Sphere Tree(Vec3(0, 3000, 100), 300);
+    S.Run("IsBlocking.Sphere/hit", NUM_SAMPLES, 16, [&](int i)
+    {
+        return IsBlocking(Hidden[i].Peeks, Hidden[i].Bounds, Pillar);
+    });
+    S.Run("IsBlocking.Sphere/miss", NUM_SAMPLES, 16, [&](int i)
+    {
+        return IsBlocking(Hidden[i].Peeks, Hidden[i].Bounds, Tree);
+    });
+    S.Run("IsBlocking.Sphere/partial", NUM_SAMPLES, 16, [&](int i)
+    {
+        return IsBlocking(Hidden[i].Peeks, Hidden[i].Bounds, Post);
+    });
+
+    std::vector<SegmentSample> Through = MakeSegments(Rng, Camera, Enemy, 300);
+    std::vector<SegmentSample> Past = MakeSegments(Rng, Camera, Enemy + Vec3(0, 1500, 0), 300);
+    std::vector<SegmentSample> Over = MakeSegments(Rng, Vec3(-800, 0, 100), Vec3(800, 0, 100), 300);
+    S.Run("IntersectionTime/hit", NUM_SAMPLES, 1, [&](int i)
+    {
+        return IntersectionTime(&Wall, Through[i].Start, Through[i].Segment.Delta) > 0;
+    });
+    S.Run("IntersectionTime/miss", NUM_SAMPLES, 1, [&](int i)
+    {
+        return IntersectionTime(&Wall, Past[i].Start, Past[i].Segment.Delta) > 0;
+    });
+    S.Run("IntersectionTime/parallel_face", NUM_SAMPLES, 1, [&](int i)
+    {
+        return IntersectionTime(&Curb, Over[i].Start, Over[i].Segment.Delta) > 0;
+    });
+
+    const BBox<float> WallBox = CuboidBoxConverter()(WallVertices);
+    const BBox<float> CurbBox = CuboidBoxConverter()(CurbVertices);
+    S.Run("BBox::intersect/hit", NUM_SAMPLES, 1, [&](int i)
+    {
+        float Near, Far;
+        return WallBox.intersect(Through[i].Segment, &Near, &Far);
+    });
+    S.Run("BBox::intersect/miss", NUM_SAMPLES, 1, [&](int i)
+    {
+        float Near, Far;
+        return WallBox.intersect(Past[i].Segment, &Near, &Far);
+    });
+    S.Run("BBox::intersect/parallel_face", NUM_SAMPLES, 1, [&](int i)
+    {
+        float Near, Far;
+        return CurbBox.intersect(Over[i].Segment, &Near, &Far);
+    });
+
+    // Traverse a random map, splitting lines of sight by whether they are blocked.
+    std::vector<CuboidVertices> WallsVertices = MakeRandomWalls(O.Cuboids, Rng);
+    std::vector<Cuboid> Walls(WallsVertices.begin(), WallsVertices.end());
+    BuildStrategy<float, 1> Builder;
+    BVH<float, Cuboid> WallBVH(
+        BuildCuboidNodes(Builder, Walls, WallsVertices),
+        ConstIterable<Cuboid>(Walls.data(), Walls.size()));
+    CuboidIntersector Intersector;
+    Traverser<float, Cuboid, CuboidIntersector> WallTraverser(WallBVH, Intersector);
+    WideBVH<Cuboid> WallWideBVH(WallBVH);
+    WideTraverser<Cuboid, CuboidIntersector> WallWideTraverser(WallWideBVH, Intersector);
+    const float MapHalfSize = RandomWallsHalfSize(O.Cuboids);
+    std::uniform_real_distribution<float> Position(-MapHalfSize, MapHalfSize);
+    std::uniform_real_distribution<float> Distance(-2000.f, 2000.f);
+    std::vector<BundleSample> Blocked;
+    std::vector<BundleSample> Visible;
+    for (int Attempt = 0; Attempt < 100 * NUM_SAMPLES; Attempt++)
+    {
+        if (Blocked.size() >= NUM_SAMPLES && Visible.size() >= NUM_SAMPLES)
+        {
+            break;
+        }
+        Vec3 Player(Position(Rng), Position(Rng), 160);
+        BundleSample B(Player, Player + Vec3(Distance(Rng), Distance(Rng), -60), 0);
+        OptSegment Segment(B.Camera, B.EnemyCenter);
+        std::vector<BundleSample>& Bin =
+            WallTraverser.traverse(Segment, B.Peeks, B.Bounds) != nullptr ? Blocked : Visible;
+        if (Bin.size() < NUM_SAMPLES)
+        {
+            Bin.emplace_back(B);
+        }
+    }
+    S.Run("Traverser::traverse/blocked", int(Blocked.size()), 1, [&](int i)
+    {
+        const BundleSample& B = Blocked[i];
+        return WallTraverser.traverse(
+            OptSegment(B.Camera, B.EnemyCenter),
+            B.Peeks,
+            B.Bounds) != nullptr;
+    });
+    S.Run("Traverser::traverse/visible", int(Visible.size()), 1, [&](int i)
+    {
+        const BundleSample& B = Visible[i];
+        return WallTraverser.traverse(
+            OptSegment(B.Camera, B.EnemyCenter),
+            B.Peeks,
+            B.Bounds) != nullptr;
+    });
+    S.Run("WideTraverser::traverse/blocked", int(Blocked.size()), 1, [&](int i)
+    {
+        const BundleSample& B = Blocked[i];
+        return WallWideTraverser.traverse(
+            OptSegment(B.Camera, B.EnemyCenter),
+            B.Peeks,
+            B.Bounds) != nullptr;
+    });
+    S.Run("WideTraverser::traverse/visible", int(Visible.size()), 1, [&](int i)
+    {
+        const BundleSample& B = Visible[i];
+        return WallWideTraverser.traverse(
+            OptSegment(B.Camera, B.EnemyCenter),
+            B.Peeks,
+            B.Bounds) != nullptr;
+    });
+    S.Run("WideTraverser::traverseShaft/blocked", int(Blocked.size()), 1, [&](int i)
+    {
+        const BundleSample& B = Blocked[i];
+        return WallWideTraverser.traverseShaft(
+            OptSegment(B.Camera, B.EnemyCenter),
+            B.Peeks,
+            B.Bounds) != nullptr;
+    });
+    S.Run("WideTraverser::traverseShaft/visible", int(Visible.size()), 1, [&](int i)
+    {
+        const BundleSample& B = Visible[i];
+        return WallWideTraverser.traverseShaft(
+            OptSegment(B.Camera, B.EnemyCenter),
+            B.Peeks,
+            B.Bounds) != nullptr;
+    });
+
+    if (O.SaveBaselinePath != nullptr && !S.SaveBaseline(O.SaveBaselinePath))
+    {
+        std::fprintf(stderr, "Could not write baseline %s\n", O.SaveBaselinePath);
+        return 1;
+    }
+    if (O.BaselinePath != nullptr)
+    {
+        int Regressions = S.CompareBaseline(O.BaselinePath);
+        if (Regressions < 0)
+        {
+            return 1;
+        }
+        if (Regressions > 0)
+        {
+            std::printf("%d kernel(s) regressed\n", Regressions);
+            return 3;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,393 @@
+#pragma once
+
+// Procedural large maps and character trajectories for scaling tests.
+//
+// Every map is a square grid of blocks separated by streets.
+// The kind of map decides what fills each block:
+//   City:      lots of buildings, some with a setback tower on top.
+//   Forest:    trees, each a sphere canopy on a thin cuboid trunk.
+//   Buildings: one multi-storey building per block, with a floor slab
+//              and four walls broken by an opening on every storey.
+//   Mixed:     a random blend of the above, block by block.
+// Characters walk along the streets, turning at random intersections.
+
+#include "BenchmarkScene.h"
+#include "CullingSettings.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <vector>
+
+enum class MapKind
+{
+    City,
+    Forest,
+    Buildings,
+    Mixed
+};
+
+inline const char* GetMapKindName(MapKind Kind)
+{
+    switch (Kind)
+    {
+        case MapKind::City: return "city";
+        case MapKind::Forest: return "forest";
+        case MapKind::Buildings: return "buildings";
+        default: return "mixed";
+    }
+}
+
+// Parses a map kind by name, returning false if the name is unknown.
+inline bool ParseMapKind(const char* Name, MapKind& Kind)
+{
+    const MapKind Kinds[] = { MapKind::City, MapKind::Forest, MapKind::Buildings, MapKind::Mixed };
+    for (MapKind K : Kinds)
+    {
+        if (std::strcmp(Name, GetMapKindName(K)) == 0)
+        {
+            Kind = K;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Side length of a block.
+constexpr float MAP_BLOCK_SIZE = 2400.f;
+// Width of the streets between blocks.
+constexpr float MAP_STREET_WIDTH = 600.f;
+constexpr float MAP_CELL_SIZE = MAP_BLOCK_SIZE + MAP_STREET_WIDTH;
+
+struct GeneratedMap
+{
+    std::vector<CuboidVertices> Cuboids;
+    std::vector<Sphere> Spheres;
+    // Number of blocks along each side of the map.
+    int BlocksPerSide = 1;
+
+    int GetNumOccluders() const { return int(Cuboids.size() + Spheres.size()); }
+    // Gets half the side length of the map.
+    float GetHalfSize() const
+    {
+        return 0.5f * (BlocksPerSide * MAP_CELL_SIZE + MAP_STREET_WIDTH);
+    }
+    // Gets the coordinate of the center line of street k, for k in [0, BlocksPerSide].
+    float GetStreetCoordinate(int k) const
+    {
+        return -GetHalfSize() + 0.5f * MAP_STREET_WIDTH + k * MAP_CELL_SIZE;
+    }
+    // Gets the minimum corner of the block in row r and column c.
+    Vec3 GetBlockCorner(int r, int c) const
+    {
+        float Origin = -GetHalfSize() + MAP_STREET_WIDTH;
+        return Vec3(Origin + c * MAP_CELL_SIZE, Origin + r * MAP_CELL_SIZE, 0);
+    }
+};
+
+namespace MapGenerator
+{
+    // Adds occluders to a map until it holds a target number of them.
+    class Filler
+    {
+        GeneratedMap& Map;
+        int Target;
+
+    public:
+        Filler(GeneratedMap& Map, int Target) : Map(Map), Target(Target) {}
+
+        bool IsFull() const { return Map.GetNumOccluders() >= Target; }
+        // Adds an axis-aligned box spanning Min to Max.
+        void AddBox(const Vec3& Min, const Vec3& Max)
+        {
+            if (!IsFull())
+            {
+                Map.Cuboids.emplace_back(MakeBox(0.5f * (Min + Max), 0.5f * (Max - Min)));
+            }
+        }
+        void AddSphere(const Vec3& Center, float Radius)
+        {
+            if (!IsFull())
+            {
+                Map.Spheres.emplace_back(Sphere(Center, Radius));
+            }
+        }
+    };
+
+    // Fills a block with a 3x3 grid of lots, each holding a building.
+    inline void FillCityBlock(Filler& Fill, const Vec3& Corner, std::mt19937& Rng)
+    {
+        const float Lot = MAP_BLOCK_SIZE / 3;
+        std::uniform_real_distribution<float> Footprint(0.6f * Lot, 0.95f * Lot);
+        std::uniform_real_distribution<float> Height(300.f, 3000.f);
+        std::uniform_real_distribution<float> Unit(0.f, 1.f);
+        for (int i = 0; i < 9; i++)
+        {
+            float SizeX = Footprint(Rng);
+            float SizeY = Footprint(Rng);
+            float H = Height(Rng);
+            Vec3 Min = Corner + Vec3(
+                (i % 3) * Lot + 0.5f * (Lot - SizeX),
+                (i / 3) * Lot + 0.5f * (Lot - SizeY),
+                0);
+            Fill.AddBox(Min, Min + Vec3(SizeX, SizeY, H));
+            // Setback tower.
+            if (Unit(Rng) < 0.3f)
+            {
+                Vec3 Inset(0.2f * SizeX, 0.2f * SizeY, H);
+                Fill.AddBox(Min + Inset, Min + Vec3(0.8f * SizeX, 0.8f * SizeY, 2 * H));
+            }
+        }
+    }
+
+    // Fills a block with randomly placed trees.
+    inline void FillForestBlock(Filler& Fill, const Vec3& Corner, std::mt19937& Rng)
+    {
+        const int Trees = 12;
+        std::uniform_real_distribution<float> Position(150.f, MAP_BLOCK_SIZE - 150.f);
+        std::uniform_real_distribution<float> Radius(120.f, 300.f);
+        std::uniform_real_distribution<float> TrunkHeight(150.f, 350.f);
+        for (int i = 0; i < Trees; i++)
+        {
+            Vec3 Base = Corner + Vec3(Position(Rng), Position(Rng), 0);
+            float R = Radius(Rng);
+            float H = TrunkHeight(Rng);
+            Fill.AddBox(Base - Vec3(15.f, 15.f, 0), Base + Vec3(15.f, 15.f, H));
+            Fill.AddSphere(Base + Vec3(0, 0, H + 0.8f * R), R);
+        }
+    }
+
+    // Fills a block with a multi-storey building.
+    // Each wall of each storey has one opening, splitting it into two cuboids.
+    inline void FillBuildingBlock(Filler& Fill, const Vec3& Corner, std::mt19937& Rng)
+    {
+        const float StoreyHeight = 350.f;
+        const float Slab = 30.f;
+        const float Wall = 30.f;
+        const float Opening = 200.f;
+        std::uniform_real_distribution<float> Footprint(0.6f * MAP_BLOCK_SIZE, 0.9f * MAP_BLOCK_SIZE);
+        std::uniform_int_distribution<int> Storeys(2, 6);
+        std::uniform_real_distribution<float> Unit(0.f, 1.f);
+        float SizeX = Footprint(Rng);
+        float SizeY = Footprint(Rng);
+        Vec3 Min = Corner + Vec3(
+            0.5f * (MAP_BLOCK_SIZE - SizeX),
+            0.5f * (MAP_BLOCK_SIZE - SizeY),
+            0);
+        int Count = Storeys(Rng);
+        for (int s = 0; s < Count; s++)
+        {
+            float Z = s * StoreyHeight;
+            Fill.AddBox(Min + Vec3(0, 0, Z), Min + Vec3(SizeX, SizeY, Z + Slab));
+            // Walls along X at both ends of Y, then along Y at both ends of X.
+            for (int w = 0; w < 4; w++)
+            {
+                bool AlongX = w < 2;
+                float Length = AlongX ? SizeX : SizeY;
+                float Gap = Wall + Unit(Rng) * (Length - Opening - 2 * Wall);
+                float Offset = (w % 2 == 0) ? 0 : (AlongX ? SizeY : SizeX) - Wall;
+                float Segments[2][2] = { { 0, Gap }, { Gap + Opening, Length } };
+                for (const auto& Segment : Segments)
+                {
+                    Vec3 A = AlongX
+                        ? Vec3(Segment[0], Offset, Z + Slab)
+                        : Vec3(Offset, Segment[0], Z + Slab);
+                    Vec3 B = AlongX
+                        ? Vec3(Segment[1], Offset + Wall, Z + StoreyHeight)
+                        : Vec3(Offset + Wall, Segment[1], Z + StoreyHeight);
+                    Fill.AddBox(Min + A, Min + B);
+                }
+            }
+        }
+        // Roof.
+        float Top = Count * StoreyHeight;
+        Fill.AddBox(Min + Vec3(0, 0, Top), Min + Vec3(SizeX, SizeY, Top + Slab));
+    }
+
+    // Gets the average number of occluders in a block of a given kind.
+    inline float GetOccludersPerBlock(MapKind Kind)
+    {
+        switch (Kind)
+        {
+            case MapKind::City: return 9 * 1.3f;
+            case MapKind::Forest: return 12 * 2.f;
+            case MapKind::Buildings: return 4 * 9 + 1;
+            default: return 0.5f * 9 * 1.3f + 0.2f * 12 * 2 + 0.3f * 37;
+        }
+    }
+}
+
+// Generates a map of a given kind holding exactly Occluders occluders.
+// Blocks are filled in random order, so a map that runs out of occluders
+// leaves empty plazas scattered across it rather than an empty edge.
+inline GeneratedMap GenerateMap(MapKind Kind, int Occluders, unsigned Seed)
+{
+    std::mt19937 Rng(Seed);
+    GeneratedMap Map;
+    // Leave slack for blocks that come out below the average.
+    float Blocks = 1.1f * Occluders / MapGenerator::GetOccludersPerBlock(Kind);
+    Map.BlocksPerSide = std::max(1, int(std::ceil(std::sqrt(Blocks))));
+    int NumBlocks = Map.BlocksPerSide * Map.BlocksPerSide;
+    std::vector<int> Order(NumBlocks);
+    std::iota(Order.begin(), Order.end(), 0);
+    std::shuffle(Order.begin(), Order.end(), Rng);
+
+    MapGenerator::Filler Fill(Map, Occluders);
+    std::uniform_real_distribution<float> Unit(0.f, 1.f);
+    // If the blocks still fall short of the target, they are revisited,
+    // stacking new occluders far above the streets.
+    for (int Pass = 0; !Fill.IsFull(); Pass++)
+    {
+        for (int Block : Order)
+        {
+            if (Fill.IsFull())
+            {
+                break;
+            }
+            Vec3 Corner = Map.GetBlockCorner(Block / Map.BlocksPerSide, Block % Map.BlocksPerSide);
+            // Stack later passes on top of earlier ones.
+            Corner.Z = Pass * 4000.f;
+            MapKind BlockKind = Kind;
+            if (Kind == MapKind::Mixed)
+            {
+                float Roll = Unit(Rng);
+                BlockKind = Roll < 0.5f
+                    ? MapKind::City
+                    : (Roll < 0.7f ? MapKind::Forest : MapKind::Buildings);
+            }
+            switch (BlockKind)
+            {
+                case MapKind::City: MapGenerator::FillCityBlock(Fill, Corner, Rng); break;
+                case MapKind::Forest: MapGenerator::FillForestBlock(Fill, Corner, Rng); break;
+                default: MapGenerator::FillBuildingBlock(Fill, Corner, Rng); break;
+            }
+        }
+    }
+    return Map;
+}
+
+// Characters walking the streets of a generated map.
+// At each intersection, a walker goes straight or turns at random,
+// and turns back at the edge of the map.
+class StreetWalkers
+{
+    struct Walker
+    {
+        // Axis of travel: 0 for X, 1 for Y.
+        int Axis;
+        // Direction of travel along the axis: 1 or -1.
+        int Direction;
+        // Index of the street being walked along.
+        int Street;
+        // Index of the next crossing street.
+        int Target;
+        // Position along the axis of travel.
+        float Along;
+        // Offset from the center line of the street.
+        float Offset;
+        float Speed;
+    };
+
+    const GeneratedMap& Map;
+    std::mt19937 Rng;
+    std::vector<Walker> Walkers;
+
+    // Points walker W at the next crossing from street index From.
+    void Aim(Walker& W, int From)
+    {
+        W.Target = From + W.Direction;
+        if (W.Target < 0 || W.Target > Map.BlocksPerSide)
+        {
+            W.Direction = -W.Direction;
+            W.Target = From + W.Direction;
+        }
+    }
+
+public:
+    // Height of a character's camera above its center.
+    static constexpr float CAMERA_HEIGHT = 60.f;
+    // Height of a character's center above the ground.
+    static constexpr float CENTER_HEIGHT = 100.f;
+    // Running speed of characters, in units per tick.
+    static constexpr float RUN_SPEED = 250.f / SERVER_TICKRATE;
+
+    StreetWalkers(const GeneratedMap& Map, int Count, unsigned Seed)
+        : Map(Map), Rng(Seed)
+    {
+        std::uniform_int_distribution<int> Street(0, Map.BlocksPerSide);
+        std::uniform_int_distribution<int> Crossing(0, Map.BlocksPerSide - 1);
+        std::uniform_real_distribution<float> Unit(0.f, 1.f);
+        for (int i = 0; i < Count; i++)
+        {
+            Walker W;
+            W.Axis = int(Rng() & 1);
+            W.Direction = (Rng() & 1) ? 1 : -1;
+            W.Street = Street(Rng);
+            // Start somewhere along the block between two crossings.
+            int From = Crossing(Rng);
+            W.Along = Map.GetStreetCoordinate(From) + Unit(Rng) * MAP_CELL_SIZE;
+            W.Target = W.Direction > 0 ? From + 1 : From;
+            W.Offset = (Unit(Rng) - 0.5f) * 0.6f * MAP_STREET_WIDTH;
+            W.Speed = (0.5f + 0.5f * Unit(Rng)) * RUN_SPEED;
+            Walkers.emplace_back(W);
+        }
+    }
+
+    // Moves every walker forward by one tick.
+    void Step()
+    {
+        std::uniform_int_distribution<int> Choice(0, 3);
+        for (Walker& W : Walkers)
+        {
+            float Goal = Map.GetStreetCoordinate(W.Target);
+            W.Along += W.Direction * W.Speed;
+            if ((Goal - W.Along) * W.Direction > 0)
+            {
+                continue;
+            }
+            // Reached the crossing.
+            int Crossing = W.Target;
+            int Roll = Choice(Rng);
+            if (Roll < 2)
+            {
+                // Go straight.
+                W.Along = Goal;
+                Aim(W, Crossing);
+            }
+            else
+            {
+                // Turn onto the crossing street.
+                W.Along = Map.GetStreetCoordinate(W.Street);
+                W.Axis = 1 - W.Axis;
+                W.Direction = Roll == 2 ? 1 : -1;
+                int From = W.Street;
+                W.Street = Crossing;
+                Aim(W, From);
+            }
+        }
+    }
+
+    int GetNumWalkers() const { return int(Walkers.size()); }
+    // Gets the location of the center of walker i.
+    Vec3 GetLocation(int i) const
+    {
+        const Walker& W = Walkers[i];
+        float Across = Map.GetStreetCoordinate(W.Street) + W.Offset;
+        return W.Axis == 0
+            ? Vec3(W.Along, Across, CENTER_HEIGHT)
+            : Vec3(Across, W.Along, CENTER_HEIGHT);
+    }
+    Vec3 GetCameraLocation(int i) const
+    {
+        return GetLocation(i) + Vec3(0, 0, CAMERA_HEIGHT);
+    }
+    RigidTransform GetTransform(int i) const
+    {
+        const Walker& W = Walkers[i];
+        float Yaw = W.Axis == 0
+            ? (W.Direction > 0 ? 0.f : 3.1415927f)
+            : (W.Direction > 0 ? 1.5707963f : -1.5707963f);
+        return RigidTransform(Quat::FromYaw(Yaw), GetLocation(i));
+    }
+};
@@ -2,7 +2,7 @@
 #include "OccludingCuboid.h"
 #include "OccludingSphere.h"
 #include "EngineUtils.h"
-#include <chrono> 
+#include "Misc/Paths.h"
 
 ACullingController::ACullingController()
     : Super()
@@ -14,311 +14,295 @@ ACullingController::ACullingController()
 void ACullingController::BeginPlay()
 {
     Super::BeginPlay();
+    Core.SetCullingThreads(CullingThreads);
+    Core.SetCullingSchedule(AmortizeCulling ? CullingSchedule::Amortized : CullingSchedule::Full);
     // Add characters.
     for (ACornerCullingCharacter* Player : TActorRange<ACornerCullingCharacter>(GetWorld()))
     {
+        if (Core.AddCharacter(Player->Team) < 0)
+        {
+            UE_LOG(LogTemp, Warning, TEXT("Not culling more than %d characters"), MAX_CHARACTERS);
+            break;
+        }
         Characters.emplace_back(Player);
-        IsAlive.emplace_back(true);
-        Teams.emplace_back(Player->Team);
     }
-    // Add occluding cuboids.
-    for (AOccludingCuboid* C : TActorRange<AOccludingCuboid>(GetWorld()))
+    // Load baked occluders if there are any, or else gather occluder actors.
+    FString AssetPath = FPaths::Combine(FPaths::ProjectContentDir(), OccluderAssetFileName);
+    bool Loaded = false;
+    if (!OccluderAssetFileName.IsEmpty() && !BakeOccluders)
     {
-        Cuboids.emplace_back(Cuboid(C->Vertices));
+        Loaded = Occluders.Open(TCHAR_TO_UTF8(*AssetPath));
+        if (!Loaded)
+        {
+            UE_LOG(LogTemp, Warning, TEXT("Could not read occluder asset %s"), *AssetPath);
+        }
     }
-    if (Cuboids.size() > 0)
+    if (Loaded)
     {
-        // Build the cuboid BVH.
-        FastBVH::BuildStrategy<float, 1> Builder;
-        CuboidBoxConverter Converter;
-        CuboidBVH = std::make_unique
-            <FastBVH::BVH<float, Cuboid>>
-            (Builder(Cuboids, Converter));
-        CuboidTraverser = std::make_unique
-            <Traverser<float, decltype(Intersector)>>
-            (*CuboidBVH.get(), Intersector);
+        LoadMappedOccluders();
     }
-    // Add occluding spheres.
-    for (AOccludingSphere* S : TActorRange<AOccludingSphere>(GetWorld()))
+    else
     {
-        Spheres.emplace_back(Sphere(S->GetActorLocation(), S->Radius));
+        AddOccluderActors();
+        // Map occluders that another server on the host published,
+        // if they were built from the same actors.
+        if (!SharedOccludersName.IsEmpty() && !BakeOccluders)
+        {
+            Loaded = Occluders.OpenShared(
+                TCHAR_TO_UTF8(*SharedOccludersName),
+                Core.GetOccluderHash());
+            if (Loaded)
+            {
+                LoadMappedOccluders();
+                MovingCuboids.clear();
+            }
+        }
     }
-}
-
-void ACullingController::Tick(float DeltaTime)
-{
-    TotalTicks++;
-    BenchmarkCull();
-}
-
-void ACullingController::BenchmarkCull()
-{
-    auto Start = std::chrono::high_resolution_clock::now();
-    Cull();
-    auto Stop = std::chrono::high_resolution_clock::now();
-    UpdateVisibility();
-    int Delta = std::chrono::duration_cast<std::chrono::microseconds>(Stop - Start).count();
-    TotalTime += Delta;
-    RollingTotalTime += Delta;
-    RollingMaxTime = std::max(RollingMaxTime, Delta);
-    if ((TotalTicks % RollingWindowLength) == 0)
+    if (RecordTrace && !AsyncCulling && !AmortizeCulling)
     {
-        RollingAverageTime = RollingTotalTime / RollingWindowLength;
-        if (GEngine)
+        // Record occluders before the BVH build reorders them.
+        FString Path = FPaths::Combine(FPaths::ProjectSavedDir(), TraceFileName);
+        if (!Recorder.Open(TCHAR_TO_UTF8(*Path), Core))
         {
-            FVector2D Scale = FVector2D(2.0f, 2.0f);
-            FColor Color = FColor::Yellow;
-            FString Msg = "Average time to cull (microseconds): "
-                + FString::FromInt(int(TotalTime / TotalTicks));
-            GEngine->AddOnScreenDebugMessage(1, 2.0f, Color, Msg, true, Scale);
-            Msg = "Rolling average time to cull (microseconds): "
-                + FString::FromInt(int(RollingAverageTime));
-            GEngine->AddOnScreenDebugMessage(2, 2.0f, Color, Msg, true, Scale);
-            Msg = "Rolling max time to cull (microseconds): "
-                + FString::FromInt(RollingMaxTime);
-            GEngine->AddOnScreenDebugMessage(3, 2.0f, Color, Msg, true, Scale);
+            UE_LOG(LogTemp, Warning, TEXT("Could not create culling trace %s"), *Path);
         }
-        RollingTotalTime = 0;
-        RollingMaxTime = 0;
     }
-}
-
-void ACullingController::Cull()
-{
-    // TODO:
-    //   When running multiple servers per CPU, consider staggering
-    //   culling periods to avoid lag spikes.
-    if ((TotalTicks % CullingPeriod) == 0)
+    if (!Loaded)
     {
-        UpdateCharacterBounds();
-        PopulateBundles();
-        CullWithCache();
-        CullWithSpheres();
-        CullWithCuboids();
+        Core.BuildOccluders();
     }
-}
-
-void ACullingController::UpdateCharacterBounds()
-{
-    Bounds.clear();
-    // This block simulates latency for testing. Remove in production.
-    // Note that this simulation differs subtly from the real setting,
-    // as a real server defines the exact location of all players
-    // that are not controlled by the client that it is culling for.
-    // In this simulation, the game displays the current positions of enemies,
-    // but the server calculates LOS with delayed positions.
-    if (CULLING_SIMULATED_LATENCY > 0)
+    // Publish the built occluders for other servers, and read them
+    // from the published copy, so that this server frees its own.
+    // Shared occluders do not move.
+    if (!Loaded && !SharedOccludersName.IsEmpty())
     {
-        // Equivalent to
-        if (PastBounds.size() >= 3)
+        // Another server may have published them since we checked.
+        std::string Name = TCHAR_TO_UTF8(*SharedOccludersName);
+        bool Published = Occluders.PublishShared(Name.c_str(), Core);
+        if (!Published)
         {
-            PastBounds.pop_front();
+            Loaded = Occluders.OpenShared(Name.c_str(), Core.GetOccluderHash());
         }
-        std::vector<CharacterBounds> CurrentBounds;
-        for (int i = 0; i < Characters.size(); i++)
+        if (Published || Loaded)
         {
-            if (IsAlive[i])
-            {
-                CurrentBounds.emplace(
-                    CurrentBounds.begin() + i,
-                    CharacterBounds(
-                        Characters[i]
-                        ->GetFirstPersonCameraComponent()
-                        ->GetComponentLocation(),
-                        Characters[i]->GetActorTransform()));
-            }
+            LoadMappedOccluders();
+            MovingCuboids.clear();
+        }
+        else
+        {
+            UE_LOG(LogTemp, Warning, TEXT("Could not share occluders as %s"), *SharedOccludersName);
         }
-        PastBounds.emplace_back(CurrentBounds);
-        Bounds = PastBounds[0];
     }
-    else
+    UE_LOG(
+        LogTemp,
+        Log,
+        TEXT("%s occluders: %d cuboids, %d spheres in %.1f ms"),
+        Loaded ? TEXT("Loaded") : TEXT("Built"),
+        int(Core.GetCuboids().size()),
+        int(Core.GetSpheres().size()),
+        Core.GetBuildMilliseconds());
+    if (BakeOccluders && !BakeOccluderAsset(TCHAR_TO_UTF8(*AssetPath), Core))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("Could not bake occluder asset %s"), *AssetPath);
+    }
+    if (!StaggerName.IsEmpty()
+        && !AsyncCulling
+        && !AmortizeCulling
+        && !Stagger.Open(TCHAR_TO_UTF8(*StaggerName), Core.GetCullingPeriod()))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("Could not join culling stagger %s"), *StaggerName);
+    }
+    if (AmortizeCulling && (RecordTrace || !StaggerName.IsEmpty()))
     {
-        for (int i = 0; i < Characters.size(); i++)
+        UE_LOG(LogTemp, Warning, TEXT("Amortized culling does not record traces or stagger"));
+    }
+    if (AsyncCulling)
+    {
+        if (RecordTrace || !StaggerName.IsEmpty())
         {
-            if (IsAlive[i])
-            {
-                Bounds.emplace(
-                    Bounds.begin() + i,
-                    CharacterBounds(
-                        Characters[i]->GetFirstPersonCameraComponent()->GetComponentLocation(),
-                        Characters[i]->GetActorTransform()));
-            }
+            UE_LOG(LogTemp, Warning, TEXT("Asynchronous culling does not record traces or stagger"));
         }
+        Pipeline.reset(new CullingPipeline(Core));
     }
 }
 
-void ACullingController::PopulateBundles()
+void ACullingController::LoadMappedOccluders()
 {
-    BundleQueue.clear();
-    for (int i = 0; i < Characters.size(); i++)
+    Core.LoadOccluders(
+        Occluders.GetCuboids(),
+        Occluders.GetCuboidVertices(),
+        Occluders.GetSpheres(),
+        Occluders.GetWideNodes(),
+        Occluders.GetSphereNodes());
+}
+
+void ACullingController::AddOccluderActors()
+{
+    // Add occluding cuboids.
+    for (AOccludingCuboid* C : TActorRange<AOccludingCuboid>(GetWorld()))
     {
-        if (IsAlive[i])
+        std::vector<Vec3> Vertices;
+        for (const FVector& V : C->Vertices)
         {
-            // TODO:
-            //   Make displacement a function of game physics and state.
-            float Latency = GetLatency(i);
-            float MaxHorizontalDisplacement = Latency * 350;
-            float MaxVerticalDisplacement = Latency * 200;
-            for (int j = 0; j < Characters.size(); j++)
-            {
-                if (VisibilityTimers[i][j] == 0
-                    && IsAlive[j]
-                    && (Teams[i] != Teams[j]))
-                {
-                    BundleQueue.emplace_back(
-                        Bundle(
-                            i,
-                            j,
-                            GetPossiblePeeks(
-                                Bounds[i].CameraLocation,
-                                Bounds[j].Center,
-                                MaxHorizontalDisplacement,
-                                MaxVerticalDisplacement)));
-                }
-            }
+            Vertices.emplace_back(ToVec3(V));
+        }
+        int Id = Core.AddCuboid(CuboidVertices(Vertices));
+        if (C->Moving)
+        {
+            MovingCuboids.push_back(MovingCuboid{C, Id, C->GetActorTransform()});
         }
     }
+    // Add occluding spheres.
+    for (AOccludingSphere* S : TActorRange<AOccludingSphere>(GetWorld()))
+    {
+        Core.AddSphere(Sphere(ToVec3(S->GetActorLocation()), S->Radius));
+    }
 }
 
-// Estimates the latency of the client controlling character i in seconds.
-// The estimate should be greater than the expected latency,
-// as underestimating latency results in underestimated peeks,
-// which could result in popping.
-// TODO:
-//   Integrate with server latency estimation tools.
-float ACullingController::GetLatency(int i)
+void ACullingController::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
-    return float(CULLING_SIMULATED_LATENCY) / SERVER_TICKRATE;
+    // Stop the worker before anything it culls with goes away.
+    Pipeline.reset();
+    Recorder.Close();
+    Stagger.Close();
+    Super::EndPlay(EndPlayReason);
 }
 
-std::vector<FVector> ACullingController::GetPossiblePeeks(
-    const FVector& PlayerCameraLocation,
-    const FVector& EnemyLocation,
-    float MaxDeltaHorizontal,
-    float MaxDeltaVertical)
+void ACullingController::Tick(float DeltaTime)
 {
-    std::vector<FVector> Corners;
-    FVector PlayerToEnemy =
-        (EnemyLocation - PlayerCameraLocation).GetSafeNormal(1e-6);
-    // Displacement parallel to the XY plane and perpendicular to PlayerToEnemy.
-    FVector Horizontal =
-        MaxDeltaHorizontal * FVector(-PlayerToEnemy.Y, PlayerToEnemy.X, 0);
-    FVector Vertical = FVector(0, 0, MaxDeltaVertical);
-    Corners.emplace_back(PlayerCameraLocation + Horizontal + Vertical);
-    Corners.emplace_back(PlayerCameraLocation - Horizontal + Vertical);
-    Corners.emplace_back(PlayerCameraLocation - Horizontal - Vertical);
-    Corners.emplace_back(PlayerCameraLocation + Horizontal - Vertical);
-    return Corners;
+    if (Pipeline)
+    {
+        AsyncCull();
+        return;
+    }
+    Core.StartTick();
+    if (Stagger.IsOpen())
+    {
+        Core.SetCullingPhase(Stagger.Update(Core.GetTotalTicks()));
+    }
+    if (Core.IsCullingTick() || Recorder.IsOpen())
+    {
+        UpdateCharacterStates();
+    }
+    if (Core.IsCullingTick())
+    {
+        UpdateMovingCuboids();
+    }
+    BenchmarkCull();
 }
 
-void ACullingController::CullWithCache()
+void ACullingController::UpdateCharacterStates()
 {
-    std::vector<Bundle> Remaining;
-    for (Bundle B : BundleQueue)
+    for (int i = 0; i < Characters.size(); i++)
     {
-        bool Blocked = false;
-        for (int k = 0; k < CUBOID_CACHE_SIZE; k++)
-        {
-            if (CuboidCaches[B.PlayerI][B.EnemyI][k] != NULL)
-            {
-                if (
-                    IsBlocking(
-                        B.PossiblePeeks,
-                        Bounds[B.EnemyI],
-                        CuboidCaches[B.PlayerI][B.EnemyI][k]))
-                {
-                    Blocked = true;
-                    CacheTimers[B.PlayerI][B.EnemyI][k] = TotalTicks;
-                    break;
-                }
-            }
-        }
-        if (!Blocked)
-        {
-            Remaining.emplace_back(B);
-        }
+        Vec3 CameraLocation = ToVec3(
+            Characters[i]
+            ->GetFirstPersonCameraComponent()
+            ->GetComponentLocation());
+        RigidTransform Transform = ToRigidTransform(Characters[i]->GetActorTransform());
+        Core.SetCharacterState(i, CameraLocation, Transform);
+        Recorder.SetCharacter(
+            i,
+            CameraLocation,
+            Transform,
+            Core.GetTeam(i),
+            Core.GetAlive(i));
     }
-    BundleQueue = Remaining;
 }
 
-void ACullingController::CullWithSpheres()
+void ACullingController::UpdateMovingCuboids()
 {
-    std::vector<Bundle> Remaining;
-    for (Bundle B : BundleQueue)
+    for (MovingCuboid& M : MovingCuboids)
     {
-        bool Blocked = false;
-        for (Sphere S : Spheres)
+        const FTransform& Transform = M.Actor->GetActorTransform();
+        if (Transform.Equals(M.Transform, 0.f))
         {
-            if (
-                IsBlocking(
-                    B.PossiblePeeks,
-                    Bounds[B.EnemyI],
-                    S))
-            {
-                Blocked = true;
-                break;
-            }
-        }
-        if (!Blocked)
-        {
-            Remaining.emplace_back(B);
+            continue;
         }
+        M.Transform = Transform;
+        M.Actor->Update();
+        Core.UpdateCuboid(M.Id, M.Actor->OccludingCuboid);
     }
-    BundleQueue = Remaining;
 }
 
-void ACullingController::CullWithCuboids()
+void ACullingController::BenchmarkCull()
 {
-    std::vector<Bundle> Remaining;
-    for (Bundle B : BundleQueue)
+    bool Culled = Core.IsCullingTick();
+    if (Culled)
     {
-        const Cuboid* CuboidP = CuboidTraverser.get()->traverse(
-            OptSegment(
-                Bounds[B.PlayerI].CameraLocation,
-                Bounds[B.EnemyI].Center),
-            B.PossiblePeeks,
-            Bounds[B.EnemyI]);
-        if (CuboidP != NULL)
-        {
-            int MinI = ArgMin(
-                CacheTimers[B.PlayerI][B.EnemyI],
-                CUBOID_CACHE_SIZE);
-            CuboidCaches[B.PlayerI][B.EnemyI][MinI] = CuboidP;
-            CacheTimers[B.PlayerI][B.EnemyI][MinI] = TotalTicks;
-        }
-        else
+        Stagger.BeginCull();
+    }
+    Core.Cull();
+    VisibilityHash Hash;
+    Core.UpdateVisibility([this, &Hash](int i, int j)
+    {
+        SendLocation(i, j);
+        Hash.Add(i, j);
+    });
+    if (Culled)
+    {
+        Stagger.EndCull();
+    }
+    Recorder.EndTick(Hash);
+    if ((Core.GetTotalTicks() % MetricsPeriod) == 0)
+    {
+        LogMetrics();
+    }
+}
+
+void ACullingController::AsyncCull()
+{
+    // The core is only ours while the worker is idle.
+    if (Pipeline->StartTick())
+    {
+        UpdateCharacterStates();
+        UpdateMovingCuboids();
+        if (Core.GetTotalTicks() - LastMetricsTick >= MetricsPeriod)
         {
-            Remaining.emplace_back(B);
+            LastMetricsTick = Core.GetTotalTicks();
+            LogMetrics();
         }
+        Pipeline->Submit();
     }
-    BundleQueue = Remaining;
+    Pipeline->ForEachRevealed([this](int i, int j) { SendLocation(i, j); });
 }
 
-// Increments visibility timers of bundles that were not culled,
-// and reveals enemies with positive visibility timers.
-void ACullingController::UpdateVisibility()
+void ACullingController::LogMetrics()
 {
-    // There are bundles remaining from the culling pipeline.
-    for (Bundle B : BundleQueue)
+    const CullingMetrics& Metrics = Core.GetMetrics();
+    UE_LOG(
+        LogTemp,
+        Log,
+        TEXT("CullingMetrics %s"),
+        UTF8_TO_TCHAR(Metrics.ToLogLine().c_str()));
+    if (Stagger.IsOpen())
     {
-        VisibilityTimers[B.PlayerI][B.EnemyI] = VisibilityTimerMax;
+        UE_LOG(
+            LogTemp,
+            Log,
+            TEXT("CullingStagger %s"),
+            UTF8_TO_TCHAR(Stagger.ToLogLine().c_str()));
     }
-    BundleQueue.clear();
-    // Reveal
-    for (int i = 0; i < Characters.size(); i++)
+    if (Pipeline)
     {
-        if (IsAlive[i])
-        {
-            for (int j = 0; j < Characters.size(); j++)
-            {
-                if (IsAlive[j] && (VisibilityTimers[i][j] > 0))
-                {
-                    SendLocation(i, j);
-                    VisibilityTimers[i][j]--;
-                }
-            }
-        }
+        UE_LOG(
+            LogTemp,
+            Log,
+            TEXT("CullingPipeline %s"),
+            UTF8_TO_TCHAR(Pipeline->ToLogLine().c_str()));
+    }
+    if (GEngine && GetNetMode() != NM_DedicatedServer)
+    {
+        const LatencyHistogram& Latency = Metrics.GetCullLatency();
+        FString Msg = FString::Printf(
+            TEXT("Cull time (microseconds): p50 %.1f, p99 %.1f, max %.1f"),
+            Latency.GetPercentile(0.5) / 1000.0,
+            Latency.GetPercentile(0.99) / 1000.0,
+            Latency.GetMax() / 1000.0);
+        GEngine->AddOnScreenDebugMessage(
+            1, 10.0f, FColor::Yellow, Msg, true, FVector2D(2.0f, 2.0f));
     }
+    Core.ResetMetrics();
 }
 
 // Draws a line from character i to j, simulating the sending of a location.
@@ -327,7 +311,7 @@ void ACullingController::UpdateVisibility()
 //   so integrate server location-sending API when deploying to a game.
 void ACullingController::SendLocation(int i, int j)
 {
-    if (Teams[i] == 0)
+    if (Core.GetTeam(i) == 0)
     {
         ConnectVectors(
             GetWorld(),
@@ -338,7 +322,7 @@ void ACullingController::SendLocation(int i, int j)
             7.0f,
             FColor::Green);
     }
-    else if (Teams[i] == 1)
+    else if (Core.GetTeam(i) == 1)
     {
         return;  //  Showing LOS of both teams is a bit cluttered and confusing.
         ConnectVectors(
@@ -7,22 +7,15 @@
 #include "CornerCullingCharacter.h"
 #include "GameFramework/Info.h"
 #include "DrawDebugHelpers.h"
-#include "GeometricPrimitives.h"
-#include "FastBVH.h"
-#include <vector>
+#include "CullingCore.h"
+#include "CullingPipeline.h"
+#include "CullingStagger.h"
+#include "CullingTrace.h"
+#include "OccluderAsset.h"
 #include "CullingController.generated.h"
 
+class AOccludingCuboid;
 
-constexpr int SERVER_TICKRATE = 120;
-// Simulated latency in ticks.
-constexpr int CULLING_SIMULATED_LATENCY = 12;
-
-// Number of peeks in each Bundle.
-constexpr int NUM_PEEKS = 4;
-// Maximum number of characters in a game.
-constexpr int MAX_CHARACTERS = 100;
-// Number of cuboids in each entry of the cuboid cache array.
-constexpr int CUBOID_CACHE_SIZE = 3;
 
 /**
  *  Controls all occlusion culling logic.
@@ -34,96 +27,120 @@ class ACullingController : public AInfo
 
     // Keeps track of playable characters.
     std::vector<ACornerCullingCharacter*> Characters;
-    // Tracks if each character is alive.
-    // TODO:
-    //  Integrate with Character class to update status.
-    std::vector<bool> IsAlive;
-    // Tracks team of each character.
-    std::vector<char> Teams;
-    // Bounding volumes of all characters.
-    std::vector<CharacterBounds> Bounds;
-    // Bounding volumes of all characters at past times.
-    // Used to simulate latency in testing.
-    std::deque<std::vector<CharacterBounds>> PastBounds;
-    // Cache of pointers to cuboids that recently blocked LOS from
-    // player i to enemy j. Accessed by CuboidCaches[i][j].
-    const Cuboid* CuboidCaches[MAX_CHARACTERS][MAX_CHARACTERS][CUBOID_CACHE_SIZE] = { 0 };
-    // Timers that track the last time a cuboid in the cache blocked LOS.
-    int CacheTimers[MAX_CHARACTERS][MAX_CHARACTERS][CUBOID_CACHE_SIZE] = { 0 };
-    // All occluding cuboids in the map.
-    std::vector<Cuboid> Cuboids;
-    // Bounding volume hierarchy containing cuboids.
-    std::unique_ptr<FastBVH::BVH<float, Cuboid>> CuboidBVH{};
-    CuboidIntersector Intersector;
-    // Note: Could be nice to use std::optional with C++17.
-    std::unique_ptr
-        <Traverser<float, decltype(Intersector)>>
-        CuboidTraverser{};
-    // All occluding spheres in the map.
-    std::vector<Sphere> Spheres;
-    // Queues of line-of-sight bundles needing to be culled.
-    std::vector<Bundle> BundleQueue;
-
-    // How many frames pass between each cull.
-    int CullingPeriod = 4;
-    // Stores how many ticks character j remains visible to character i for.
-    int VisibilityTimers[MAX_CHARACTERS][MAX_CHARACTERS] = { 0 };
-    // How many ticks an enemy stays visible for after being revealed.
-    int VisibilityTimerMax = CullingPeriod * 3;
-    // Used to calculate short rolling average of frame times.
-    float RollingTotalTime = 0;
-    float RollingAverageTime = 0;
-    // Stores maximum culling time in rolling window.
-    int RollingMaxTime = 0;
-    // Number of ticks in the rolling window.
-    int RollingWindowLength = SERVER_TICKRATE;
-    // Total ticks since game start.
-    int TotalTicks = 0;
-    // Stores total culling time to calculate an overall average.
-    int TotalTime = 0;
+    // Cuboid that moves during play, with its id in the culling core
+    // and its transform when last sent to the core.
+    struct MovingCuboid
+    {
+        AOccludingCuboid* Actor;
+        int Id;
+        FTransform Transform;
+    };
+    std::vector<MovingCuboid> MovingCuboids;
+    // Baked occluders, which the culling core reads in place.
+    OccluderAsset Occluders;
+    // Engine-independent culling pipeline and per-pair state.
+    CullingCore Core;
+    // Records culling inputs for offline replay, if enabled.
+    TraceWriter Recorder;
+    // Staggers culls with other servers on the host, if enabled.
+    CullingStagger Stagger;
+    // Culls on a background thread, if enabled. Declared after the core,
+    // so that it stops before the core is destroyed.
+    std::unique_ptr<CullingPipeline> Pipeline;
+    // Number of ticks between each export of culling metrics.
+    int MetricsPeriod = SERVER_TICKRATE * 10;
+    // Core tick of the last export of metrics while culling asynchronously.
+    int LastMetricsTick = 0;
 
-    // Cull visibility for all player, enemy pairs.
-    void Cull();
-    // Updates the bounding volumes of characters.
-    void UpdateCharacterBounds();
-    // Calculates all bundles of lines of sight between characters,
-    // adding them to the BundleQueue for culling.
-    void PopulateBundles();
-    // Culls all bundles with each player's cache of occluders.
-    void CullWithCache();
-    // Culls queued bundles with occluding spheres.
-    void CullWithSpheres();
-    // Culls queued bundles with occluding cuboids.
-    void CullWithCuboids();
-    // Gets corners of the rectangle encompassing a player's possible peeks
-    // on an enemy--in the plane normal to the line of sight.
-    // When facing along the vector from player to enemy, Corners are indexed
-    // starting from the top right, proceeding counter-clockwise.
-    // NOTE:
-    //   Inaccurate on very wide enemies, as the most aggressive angle to peek
-    //   the left of an enemy is actually perpendicular to the leftmost point
-    //   of the enemy, not its center.
-    static std::vector<FVector> GetPossiblePeeks(
-        const FVector& PlayerCameraLocation,
-        const FVector& EnemyLocation,
-        float MaxDeltaHorizontal,
-        float MaxDeltaVertical);
-    // Gets the estimated latency of player i in seconds.
-    float GetLatency(int i);
-    // Converts culling results into changes in in-game visibility.
-    void UpdateVisibility();
+    // Copies character locations and transforms into the culling core,
+    // and into the trace when recording.
+    void UpdateCharacterStates();
+    // Sends cuboids that moved since the last culling tick to the culling core.
+    void UpdateMovingCuboids();
+    // Hands the tick's inputs to the pipeline if its worker is idle,
+    // and replicates its latest results.
+    void AsyncCull();
+    // Logs culling metrics and resets them.
+    void LogMetrics();
     // Sends character j's location to character i.
     void SendLocation(int i, int j);
+    // Adds the occluder actors of the level to the culling core.
+    void AddOccluderActors();
+    // Loads the occluders mapped by Occluders into the culling core.
+    void LoadMappedOccluders();
 
 protected:
     void BeginPlay() override;
+    void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 public:
+    // Record culling inputs of every tick to a trace in the Saved directory.
+    UPROPERTY(EditAnywhere)
+    bool RecordTrace = false;
+    UPROPERTY(EditAnywhere)
+    FString TraceFileName = "CullingTrace.cctrace";
+    // Baked occluder asset in the Content directory. If it exists,
+    // occluders are loaded from it instead of from the level's actors.
+    // Moving cuboids are baked where they start, and do not move.
+    UPROPERTY(EditAnywhere)
+    FString OccluderAssetFileName = "";
+    // Bake the level's occluders to OccluderAssetFileName on BeginPlay.
+    UPROPERTY(EditAnywhere)
+    bool BakeOccluders = false;
+    // Name of the level's occluders in shared memory. If another server
+    // on the host published them, they are mapped from there. Otherwise,
+    // this server builds and publishes them. Either way, every server
+    // reads one copy, and shared cuboids do not move.
+    UPROPERTY(EditAnywhere)
+    FString SharedOccludersName = "";
+    // Threads that cull bundles each culling tick, where zero uses every
+    // hardware thread. Results are the same for any number of threads.
+    UPROPERTY(EditAnywhere)
+    int CullingThreads = 1;
+    // Cull a share of the pairs every tick instead of every pair once
+    // per culling period, so that no tick spikes. Does not record traces,
+    // since pairs move between ticks by measured time, which replays
+    // cannot reproduce. Does not stagger either, since it culls every tick.
+    UPROPERTY(EditAnywhere)
+    bool AmortizeCulling = false;
+    // Cull on a background thread, so that culling does not add to the
+    // game thread's frame time. Results arrive a tick or more after their
+    // inputs, and peeks widen to cover the delay. Does not record traces
+    // or stagger.
+    UPROPERTY(EditAnywhere)
+    bool AsyncCulling = false;
+    // Stagger culls with other servers on the host that use the same name,
+    // so that their culling spikes land on different ticks.
+    // Traces recorded while staggering do not replay exactly.
+    // Ignored with AmortizeCulling or AsyncCulling.
+    UPROPERTY(EditAnywhere)
+    FString StaggerName = "";
+
     ACullingController();
     virtual void Tick(float DeltaTime) override;
-    // Cull while gathering and reporting runtime statistics.
+    // Cull while gathering and periodically reporting runtime metrics.
     void BenchmarkCull();
 
+    // Converts an engine vector into a culling core vector.
+    static inline Vec3 ToVec3(const FVector& V)
+    {
+        return Vec3(V.X, V.Y, V.Z);
+    }
+
+    // Converts a culling core vector into an engine vector.
+    static inline FVector ToFVector(const Vec3& V)
+    {
+        return FVector(V.X, V.Y, V.Z);
+    }
+
+    // Converts an engine transform into a culling core transform,
+    // dropping scale.
+    static inline RigidTransform ToRigidTransform(const FTransform& T)
+    {
+        const FQuat R = T.GetRotation();
+        return RigidTransform(Quat(R.X, R.Y, R.Z, R.W), ToVec3(T.GetTranslation()));
+    }
+
     // Mark a vector. For debugging.
     static inline void MarkFVector(UWorld* World, const FVector& V)
     {
@@ -142,20 +159,4 @@ public:
     {
         DrawDebugLine(World, V1, V2, Color, Persist, Lifespan, 0, Thickness);
     }
-
-    // Get the index of the minimum element in an array.
-    static inline int ArgMin(int A[], int Length)
-    {
-        int Min = INT_MAX;
-        int MinI = 0;
-        for (int i = 0; i < Length; i++)
-        {
-            if (A[i] < Min)
-            {
-                Min = A[i];
-                MinI = i;
-            }
-        }
-        return MinI;
-    }
 };
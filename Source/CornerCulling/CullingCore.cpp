@@ -0,0 +1,881 @@
+#include "CullingCore.h"
+#include <algorithm>
+#include <cstring>
+
+int CullingCore::AddCharacter(char Team)
+{
+    // Per-character arrays and snapshots hold at most MAX_CHARACTERS,
+    // and pairs store character indices in a byte.
+    if (GetNumCharacters() >= MAX_CHARACTERS)
+    {
+        return -1;
+    }
+    IsAlive.emplace_back(true);
+    Teams.emplace_back(Team);
+    CameraLocations.emplace_back(Vec3(0, 0, 0));
+    Transforms.emplace_back(RigidTransform());
+    PairsOutdated = true;
+    return GetNumCharacters() - 1;
+}
+
+void CullingCore::SetCharacterState(
+    int i,
+    const Vec3& CameraLocation,
+    const RigidTransform& Transform)
+{
+    CameraLocations[i] = CameraLocation;
+    Transforms[i] = Transform;
+}
+
+void CullingCore::SetAlive(int i, bool Alive)
+{
+    IsAlive[i] = Alive;
+}
+
+void CullingCore::SetTeam(int i, char Team)
+{
+    if (Teams[i] != Team)
+    {
+        Teams[i] = Team;
+        PairsOutdated = true;
+    }
+}
+
+void CullingCore::UpdatePairs()
+{
+    std::vector<int> NewStarts;
+    std::vector<unsigned char> NewEnemies;
+    std::vector<uint16_t> NewTimers;
+    std::vector<CuboidCache> NewCaches;
+    std::vector<uint16_t> NewPhases;
+    // Number of players with existing pairs.
+    int OldPlayers = int(PairStarts.size()) - 1;
+    for (int i = 0; i < GetNumCharacters(); i++)
+    {
+        NewStarts.emplace_back(int(NewEnemies.size()));
+        // Old pairs of player i, which are also sorted by enemy.
+        int Old = i < OldPlayers ? PairStarts[i] : 0;
+        int OldEnd = i < OldPlayers ? PairStarts[i + 1] : 0;
+        for (int j = 0; j < GetNumCharacters(); j++)
+        {
+            if (Teams[i] == Teams[j])
+            {
+                continue;
+            }
+            while (Old < OldEnd && PairEnemies[Old] < j)
+            {
+                Old++;
+            }
+            NewEnemies.emplace_back((unsigned char)j);
+            if (Old < OldEnd && PairEnemies[Old] == j)
+            {
+                NewTimers.emplace_back(VisibilityTimers[Old]);
+                NewCaches.emplace_back(CuboidCaches[Old]);
+                NewPhases.emplace_back(PairPhases[Old]);
+            }
+            else
+            {
+                NewTimers.emplace_back(0);
+                NewCaches.emplace_back(CuboidCache());
+                // Deal new pairs out over the phases of the period.
+                NewPhases.emplace_back(
+                    Schedule == CullingSchedule::Amortized
+                        ? uint16_t(NewEnemies.size() % CullingPeriod)
+                        : uint16_t(CullingPhase));
+            }
+        }
+    }
+    NewStarts.emplace_back(int(NewEnemies.size()));
+    PairStarts.swap(NewStarts);
+    PairEnemies.swap(NewEnemies);
+    VisibilityTimers.swap(NewTimers);
+    CuboidCaches.swap(NewCaches);
+    PairPhases.swap(NewPhases);
+    // Phases are laid out again for a new period before they are counted.
+    if (!ScheduleOutdated)
+    {
+        CountPhasePairs();
+    }
+    PairsOutdated = false;
+}
+
+void CullingCore::CountPhasePairs()
+{
+    PhasePairs.assign(CullingPeriod, 0);
+    for (uint16_t Phase : PairPhases)
+    {
+        PhasePairs[Phase]++;
+    }
+}
+
+void CullingCore::UpdateSchedule()
+{
+    for (std::size_t p = 0; p < PairPhases.size(); p++)
+    {
+        PairPhases[p] = Schedule == CullingSchedule::Amortized
+            ? uint16_t(p % CullingPeriod)
+            : uint16_t(CullingPhase);
+        // Extend the timers of revealed pairs to run out on their new phase,
+        // so that no pair goes hidden while waiting for its next cull.
+        int Timer = VisibilityTimers[p];
+        if (Timer > 0)
+        {
+            VisibilityTimers[p] = uint16_t(
+                Timer + (GetPhaseDelay(int(p)) - Timer % CullingPeriod + CullingPeriod) % CullingPeriod);
+        }
+    }
+    CountPhasePairs();
+    PhaseNanoseconds.assign(CullingPeriod, -1);
+    ScheduleOutdated = false;
+}
+
+void CullingCore::RebalancePhases(int Phase, double Nanoseconds)
+{
+    double& Cost = PhaseNanoseconds[Phase];
+    Cost = Cost < 0 ? Nanoseconds : Cost + (Nanoseconds - Cost) * PHASE_COST_SMOOTHING;
+    // Wait until every phase has been measured.
+    double Total = 0;
+    int Cheapest = Phase;
+    for (int Other = 0; Other < CullingPeriod; Other++)
+    {
+        if (PhaseNanoseconds[Other] < 0)
+        {
+            return;
+        }
+        Total += PhaseNanoseconds[Other];
+        if (PhaseNanoseconds[Other] < PhaseNanoseconds[Cheapest])
+        {
+            Cheapest = Other;
+        }
+    }
+    double Mean = Total / CullingPeriod;
+    if (Cost <= Mean * (1 + SCHEDULE_TOLERANCE) || PhasePairs[Phase] == 0)
+    {
+        return;
+    }
+    // Move half of the excess, without pushing the cheapest phase over
+    // the mean, so that noisy measurements do not make phases oscillate.
+    double PairCost = Cost / PhasePairs[Phase];
+    double Excess = std::min(Cost - Mean, Mean - PhaseNanoseconds[Cheapest]) / 2;
+    int Moves = int(Excess / PairCost);
+    // The cheapest phase comes around within the period, so moved pairs
+    // are culled sooner than they would have been, keeping staleness bounded.
+    int Delay = (Cheapest - Phase + CullingPeriod) % CullingPeriod;
+    for (std::size_t p = PairPhases.size(); p-- > 0 && Moves > 0;)
+    {
+        if (PairPhases[p] == Phase)
+        {
+            PairPhases[p] = uint16_t(Cheapest);
+            // Revealed pairs stay revealed until their new phase comes around.
+            if (VisibilityTimers[p] > 0)
+            {
+                VisibilityTimers[p] = uint16_t(VisibilityTimers[p] + Delay);
+            }
+            PhasePairs[Phase]--;
+            PhasePairs[Cheapest]++;
+            Cost -= PairCost;
+            PhaseNanoseconds[Cheapest] += PairCost;
+            Moves--;
+        }
+    }
+}
+
+int CullingCore::AddCuboid(const CuboidVertices& V)
+{
+    // The BVH views the cuboid array, which may now be reallocated,
+    // so drop it until BuildOccluders rebuilds it.
+    CuboidTraverser.reset();
+    CuboidWideBVH.reset();
+    CuboidRefitter.reset();
+    CuboidBVH.reset();
+    MovedCuboids.clear();
+    uint32_t Id = uint32_t(Cuboids.size());
+    Cuboids.emplace_back(V);
+    Vertices.emplace_back(V);
+    CuboidView = FastBVH::ConstIterable<Cuboid>(Cuboids.data(), Cuboids.size());
+    VertexView = FastBVH::ConstIterable<CuboidVertices>(Vertices.data(), Vertices.size());
+    CuboidIds.emplace_back(Id);
+    CuboidSlots.emplace_back(Id);
+    return int(Id);
+}
+
+void CullingCore::UpdateCuboid(int Id, const CuboidVertices& V)
+{
+    // Loaded occluders keep no IDs, so this also ignores them.
+    if (Id < 0 || Id >= int(CuboidSlots.size()))
+    {
+        return;
+    }
+    uint32_t Slot = CuboidSlots[Id];
+    Cuboids[Slot] = Cuboid(V);
+    Vertices[Slot] = V;
+    if (CuboidBVH)
+    {
+        MovedCuboids.emplace_back(Slot);
+    }
+}
+
+void CullingCore::AddSphere(const Sphere& S)
+{
+    // As with cuboids, the BVH views the sphere array.
+    SphereTraverser.reset();
+    SphereWideBVH.reset();
+    Spheres.emplace_back(S);
+    SphereView = FastBVH::ConstIterable<Sphere>(Spheres.data(), Spheres.size());
+}
+
+void CullingCore::ClearDynamicCuboids()
+{
+    DynamicTraverser.reset();
+    DynamicBVH.reset();
+    DynamicCuboids.clear();
+    DynamicVertices.clear();
+    DynamicCuboidsChanged = true;
+}
+
+void CullingCore::AddDynamicCuboid(const CuboidVertices& V)
+{
+    DynamicTraverser.reset();
+    DynamicBVH.reset();
+    DynamicCuboids.emplace_back(V);
+    DynamicVertices.emplace_back(V);
+    DynamicCuboidsChanged = true;
+}
+
+void CullingCore::BuildDynamicCuboids()
+{
+    DynamicCuboidsChanged = false;
+    if (DynamicCuboids.empty())
+    {
+        return;
+    }
+    FastBVH::BuildStrategy<float, 3> Builder;
+    Builder.thread_count = uint32_t(BuildThreads);
+    FastBVH::NodeArray<float> Nodes = BuildCuboidNodes(Builder, DynamicCuboids, DynamicVertices);
+    DynamicBVH = std::make_unique
+        <FastBVH::BVH<float, Cuboid>>
+        (std::move(Nodes), FastBVH::ConstIterable<Cuboid>(DynamicCuboids.data(), DynamicCuboids.size()));
+    DynamicTraverser = std::make_unique
+        <Traverser<float, Cuboid, decltype(Intersector)>>
+        (*DynamicBVH.get(), Intersector);
+}
+
+FastBVH::NodeArray<float> CullingCore::BuildCuboidSubtree(uint32_t Start, uint32_t End)
+{
+    // Build over cuboid IDs, which the builder moves into leaf order,
+    // then move the cuboids and their vertices after them.
+    FastBVH::Iterable<uint32_t> Ids(CuboidIds.data() + Start, End - Start);
+    auto Converter = [this](uint32_t Id)
+    {
+        return CuboidBoxConverter()(Vertices[CuboidSlots[Id]]);
+    };
+    FastBVH::NodeArray<float> Nodes;
+    if (CuboidBuilder == BVHBuilder::SAH)
+    {
+        FastBVH::BuildStrategy<float, 2> Builder;
+        Builder.thread_count = uint32_t(BuildThreads);
+        // Keep the tree alive while copying out its nodes.
+        const auto Tree = Builder(Ids, Converter);
+        const auto TreeNodes = Tree.getNodes();
+        Nodes.assign(TreeNodes.begin(), TreeNodes.end());
+    }
+    else if (CuboidBuilder == BVHBuilder::Linear)
+    {
+        FastBVH::BuildStrategy<float, 3> Builder;
+        Builder.thread_count = uint32_t(BuildThreads);
+        const auto Tree = Builder(Ids, Converter);
+        const auto TreeNodes = Tree.getNodes();
+        Nodes.assign(TreeNodes.begin(), TreeNodes.end());
+    }
+    else
+    {
+        FastBVH::BuildStrategy<float, 1> Builder;
+        const auto Tree = Builder(Ids, Converter);
+        const auto TreeNodes = Tree.getNodes();
+        Nodes.assign(TreeNodes.begin(), TreeNodes.end());
+    }
+    std::vector<Cuboid> Sorted;
+    std::vector<CuboidVertices> SortedVertices;
+    Sorted.reserve(End - Start);
+    SortedVertices.reserve(End - Start);
+    for (uint32_t i = Start; i < End; i++)
+    {
+        Sorted.emplace_back(Cuboids[CuboidSlots[CuboidIds[i]]]);
+        SortedVertices.emplace_back(Vertices[CuboidSlots[CuboidIds[i]]]);
+    }
+    for (uint32_t i = Start; i < End; i++)
+    {
+        Cuboids[i] = Sorted[i - Start];
+        Vertices[i] = SortedVertices[i - Start];
+        CuboidSlots[CuboidIds[i]] = i;
+    }
+    for (FastBVH::Node<float>& Node : Nodes)
+    {
+        Node.start += Start;
+    }
+    return Nodes;
+}
+
+void CullingCore::RemapCuboidCaches(uint32_t Start, const std::vector<uint32_t>& OldIds)
+{
+    uint32_t End = Start + uint32_t(OldIds.size());
+    for (CuboidCache& Cache : CuboidCaches)
+    {
+        for (int k = 0; k < CUBOID_CACHE_SIZE; k++)
+        {
+            uint32_t Slot = Cache.Cuboids[k];
+            if (Slot != CuboidCache::EMPTY && Slot >= Start && Slot < End)
+            {
+                Cache.Cuboids[k] = CuboidSlots[OldIds[Slot - Start]];
+            }
+        }
+    }
+}
+
+void CullingCore::CollapseCuboidBVH()
+{
+    CuboidWideBVH = std::make_unique
+        <FastBVH::WideBVH<Cuboid>>
+        (*CuboidBVH.get());
+    CuboidTraverser = std::make_unique
+        <WideTraverser<Cuboid, decltype(Intersector)>>
+        (*CuboidWideBVH.get(), Intersector);
+}
+
+void CullingCore::BuildOccluders()
+{
+    CullingMetrics::Clock::time_point Start = CullingMetrics::Clock::now();
+    MovedCuboids.clear();
+    if (Cuboids.size() > 0)
+    {
+        // Build the cuboid BVH.
+        std::vector<uint32_t> OldIds = CuboidIds;
+        FastBVH::NodeArray<float> Nodes = BuildCuboidSubtree(0, uint32_t(Cuboids.size()));
+        RemapCuboidCaches(0, OldIds);
+        CuboidBVH = std::make_unique
+            <FastBVH::BVH<float, Cuboid>>
+            (std::move(Nodes), CuboidView);
+        CuboidRefitter = std::make_unique
+            <FastBVH::Refitter<float, Cuboid>>
+            (*CuboidBVH.get());
+        CollapseCuboidBVH();
+    }
+    if (Spheres.size() > 0)
+    {
+        // Build the sphere BVH, which moves spheres into leaf order,
+        // and keep only its wide form.
+        FastBVH::BuildStrategy<float, 2> Builder;
+        Builder.thread_count = uint32_t(BuildThreads);
+        FastBVH::Iterable<Sphere> SphereIterable(Spheres.data(), Spheres.size());
+        const FastBVH::BVH<float, Sphere> SphereBVH =
+            Builder(SphereIterable, SphereBoxConverter());
+        SphereWideBVH = std::make_unique
+            <FastBVH::WideBVH<Sphere>>
+            (SphereBVH);
+        SphereTraverser = std::make_unique
+            <WideTraverser<Sphere, SphereIntersector>>
+            (*SphereWideBVH.get(), SphereIntersector());
+    }
+    BuildMilliseconds = std::chrono::duration<double, std::milli>(
+        CullingMetrics::Clock::now() - Start).count();
+}
+
+void CullingCore::LoadOccluders(
+    const FastBVH::ConstIterable<Cuboid>& BakedCuboids,
+    const FastBVH::ConstIterable<CuboidVertices>& BakedVertices,
+    const FastBVH::ConstIterable<Sphere>& BakedSpheres,
+    const FastBVH::ConstIterable<FastBVH::WideNode>& BakedNodes,
+    const FastBVH::ConstIterable<FastBVH::WideNode>& BakedSphereNodes)
+{
+    CullingMetrics::Clock::time_point Start = CullingMetrics::Clock::now();
+    CuboidTraverser.reset();
+    CuboidWideBVH.reset();
+    SphereTraverser.reset();
+    SphereWideBVH.reset();
+    CuboidRefitter.reset();
+    CuboidBVH.reset();
+    // Free the built occluders, which may have just been published
+    // for this process and others to share.
+    std::vector<Cuboid>().swap(Cuboids);
+    std::vector<CuboidVertices>().swap(Vertices);
+    std::vector<uint32_t>().swap(CuboidIds);
+    std::vector<uint32_t>().swap(CuboidSlots);
+    MovedCuboids.clear();
+    std::vector<Sphere>().swap(Spheres);
+    // Cached indices refer to the old cuboids.
+    std::fill(CuboidCaches.begin(), CuboidCaches.end(), CuboidCache());
+    CuboidView = BakedCuboids;
+    VertexView = BakedVertices;
+    SphereView = BakedSpheres;
+    if (CuboidView.size() > 0)
+    {
+        CuboidWideBVH = std::make_unique
+            <FastBVH::WideBVH<Cuboid>>
+            (BakedNodes, CuboidView);
+        CuboidTraverser = std::make_unique
+            <WideTraverser<Cuboid, decltype(Intersector)>>
+            (*CuboidWideBVH.get(), Intersector);
+    }
+    if (SphereView.size() > 0)
+    {
+        SphereWideBVH = std::make_unique
+            <FastBVH::WideBVH<Sphere>>
+            (BakedSphereNodes, SphereView);
+        SphereTraverser = std::make_unique
+            <WideTraverser<Sphere, SphereIntersector>>
+            (*SphereWideBVH.get(), SphereIntersector());
+    }
+    BuildMilliseconds = std::chrono::duration<double, std::milli>(
+        CullingMetrics::Clock::now() - Start).count();
+}
+
+namespace
+{
+    // FNV-1a hash of the bits of a sequence of floats.
+    class FloatHash
+    {
+        uint64_t Value = 14695981039346656037ull;
+
+    public:
+        void Add(float F)
+        {
+            uint32_t Bits;
+            std::memcpy(&Bits, &F, sizeof(Bits));
+            for (int b = 0; b < 4; b++)
+            {
+                Value ^= (Bits >> (8 * b)) & 0xFF;
+                Value *= 1099511628211ull;
+            }
+        }
+        void Add(const Vec3& V)
+        {
+            Add(V.X);
+            Add(V.Y);
+            Add(V.Z);
+        }
+        uint64_t Get() const { return Value; }
+    };
+}
+
+uint64_t CullingCore::GetOccluderHash() const
+{
+    // Sum the hashes of each occluder, since builds reorder them.
+    uint64_t Hash = uint64_t(VertexView.size()) << 32 | uint64_t(SphereView.size());
+    for (const CuboidVertices& V : VertexView)
+    {
+        FloatHash H;
+        for (int i = 0; i < CUBOID_V; i++)
+        {
+            H.Add(V.Vertices[i]);
+        }
+        Hash += H.Get();
+    }
+    for (const Sphere& S : SphereView)
+    {
+        FloatHash H;
+        H.Add(S.Center);
+        H.Add(S.Radius);
+        Hash += H.Get();
+    }
+    return Hash;
+}
+
+void CullingCore::RefitCuboids()
+{
+    // Nodes whose subtrees should be rebuilt.
+    std::vector<uint32_t> Degraded;
+    // The refitter passes cuboids from the BVH's view of Cuboids,
+    // so their vertices are at the same index.
+    auto Converter = [this](const Cuboid& C)
+    {
+        return CuboidBoxConverter()(Vertices[&C - Cuboids.data()]);
+    };
+    for (uint32_t Slot : MovedCuboids)
+    {
+        uint32_t Node = CuboidRefitter->refit(
+            Slot,
+            Converter,
+            REFIT_MAX_INFLATION,
+            [this](uint32_t Index, const FastBVH::BBox<float>& Box)
+            {
+                CuboidWideBVH->refit(Index, Box);
+            });
+        if (Node != FastBVH::Refitter<float, Cuboid>::none)
+        {
+            Degraded.emplace_back(Node);
+        }
+    }
+    MovedCuboids.clear();
+    if (Degraded.empty())
+    {
+        return;
+    }
+    // Rebuild the outermost degraded subtrees, from the back of the tree
+    // to the front, so that replacing a subtree does not move the next one.
+    std::sort(Degraded.begin(), Degraded.end());
+    std::vector<uint32_t> Roots;
+    uint32_t CoveredEnd = 0;
+    for (uint32_t Node : Degraded)
+    {
+        if (Roots.empty() || Node >= CoveredEnd)
+        {
+            Roots.emplace_back(Node);
+            CoveredEnd = CuboidBVH->getSubtreeEnd(Node);
+        }
+    }
+    for (auto Root = Roots.rbegin(); Root != Roots.rend(); ++Root)
+    {
+        const FastBVH::Node<float>& Node = CuboidBVH->getNodes()[*Root];
+        uint32_t Start = Node.start;
+        uint32_t End = Node.start + Node.primitive_count;
+        std::vector<uint32_t> OldIds(CuboidIds.begin() + Start, CuboidIds.begin() + End);
+        uint32_t OldEnd = CuboidBVH->getSubtreeEnd(*Root);
+        FastBVH::NodeArray<float> Subtree = BuildCuboidSubtree(Start, End);
+        RemapCuboidCaches(Start, OldIds);
+        CuboidRefitter->replaceSubtree(
+            *Root,
+            FastBVH::ConstIterable<FastBVH::Node<float>>(Subtree.data(), Subtree.size()));
+        CuboidWideBVH->replaceSubtree(*CuboidBVH.get(), *Root, OldEnd);
+    }
+}
+
+FastBVH::Quality CullingCore::GetCuboidBVHQuality() const
+{
+    if (!CuboidBVH)
+    {
+        return FastBVH::Quality();
+    }
+    FastBVH::BuildStrategy<float, 2> Costs;
+    return FastBVH::measureQuality(
+        *CuboidBVH.get(),
+        Costs.traversal_cost,
+        Costs.intersection_cost);
+}
+
+void CullingCore::Cull()
+{
+    TickStart = CullingMetrics::Clock::now();
+    if (PairsOutdated)
+    {
+        UpdatePairs();
+    }
+    if (ScheduleOutdated)
+    {
+        UpdateSchedule();
+    }
+    if (IsCullingTick())
+    {
+        CullingMetrics::Clock::time_point Start = TickStart;
+        if (!MovedCuboids.empty())
+        {
+            RefitCuboids();
+        }
+        if (DynamicCuboidsChanged)
+        {
+            BuildDynamicCuboids();
+        }
+        Start = Metrics.EndStage(STAGE_OCCLUDERS, Start, 0, 0);
+        UpdateCharacterBounds();
+        Start = Metrics.EndStage(STAGE_BOUNDS, Start, 0, 0);
+        CullingMetrics::Clock::time_point PairsStart = Start;
+        PopulateBundles();
+        Start = Metrics.EndStage(STAGE_BUNDLES, Start, 0, BundleQueue.size());
+        if (CullingPool)
+        {
+            CullBundlesInParallel();
+        }
+        else
+        {
+            CullingWork Work;
+            BundleQueue.resize(CullBundles(0, BundleQueue.size(), Work));
+            Metrics.RecordWork(Work);
+        }
+        if (Schedule == CullingSchedule::Amortized)
+        {
+            RebalancePhases(
+                TotalTicks % CullingPeriod,
+                double(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    CullingMetrics::Clock::now() - PairsStart).count()));
+        }
+    }
+}
+
+std::size_t CullingCore::CullBundles(std::size_t Begin, std::size_t End, CullingWork& Work)
+{
+    CullingMetrics::Clock::time_point Start = CullingMetrics::Clock::now();
+    std::size_t In = End - Begin;
+    End = CullWithCache(Begin, End, Work);
+    Start = Work.EndStage(STAGE_CACHE, Start, In, End - Begin);
+    In = End - Begin;
+    End = CullWithSpheres(Begin, End, Work);
+    Start = Work.EndStage(STAGE_SPHERES, Start, In, End - Begin);
+    In = End - Begin;
+    End = CullWithCuboids(Begin, End, Work);
+    Work.EndStage(STAGE_CUBOIDS, Start, In, End - Begin);
+    return End;
+}
+
+void CullingCore::CullBundlesInParallel()
+{
+    CullingMetrics::Clock::time_point Start = CullingMetrics::Clock::now();
+    const std::size_t NumBundles = BundleQueue.size();
+    const int NumChunks = int((NumBundles + CULLING_CHUNK_SIZE - 1) / CULLING_CHUNK_SIZE);
+    ChunkWork.assign(NumChunks, CullingWork());
+    ChunkEnds.resize(NumChunks);
+    CullingPool->Run(
+        NumChunks,
+        [this, NumBundles](int c, int)
+        {
+            std::size_t Begin = std::size_t(c) * CULLING_CHUNK_SIZE;
+            std::size_t End = std::min(Begin + CULLING_CHUNK_SIZE, NumBundles);
+            ChunkEnds[c] = CullBundles(Begin, End, ChunkWork[c]);
+        });
+    // Gather survivors in chunk order, leaving the queue as the serial cull would.
+    CullingWork Work;
+    std::size_t Survivors = 0;
+    for (int c = 0; c < NumChunks; c++)
+    {
+        for (std::size_t b = std::size_t(c) * CULLING_CHUNK_SIZE; b < ChunkEnds[c]; b++)
+        {
+            KeepBundle(b, Survivors);
+        }
+        Work.Add(ChunkWork[c]);
+    }
+    BundleQueue.resize(Survivors);
+    // Stages overlap across workers, so share the wall time
+    // between them in proportion to their summed time.
+    uint64_t WorkNanoseconds =
+        Work.StageNanoseconds[STAGE_CACHE]
+        + Work.StageNanoseconds[STAGE_SPHERES]
+        + Work.StageNanoseconds[STAGE_CUBOIDS];
+    double WallNanoseconds = double(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        CullingMetrics::Clock::now() - Start).count());
+    Metrics.RecordWork(Work, WorkNanoseconds > 0 ? WallNanoseconds / WorkNanoseconds : 1);
+}
+
+void CullingCore::SetCullingThreads(int Threads)
+{
+    CullingThreads = Threads;
+    if (Threads == 1)
+    {
+        CullingPool.reset();
+    }
+    else
+    {
+        CullingPool.reset(new WorkStealingPool(Threads));
+        // A single hardware thread gains nothing from a pool.
+        if (CullingPool->GetNumWorkers() == 1)
+        {
+            CullingPool.reset();
+        }
+    }
+}
+
+void CullingCore::UpdateCharacterBounds()
+{
+    // This block simulates latency for testing. Remove in production.
+    // Note that this simulation differs subtly from the real setting,
+    // as a real server defines the exact location of all players
+    // that are not controlled by the client that it is culling for.
+    // In this simulation, the game displays the current positions of enemies,
+    // but the server calculates LOS with delayed positions.
+    // An amortized schedule culls every tick, but only takes a snapshot
+    // once per period, so that the simulated latency is the same.
+    if (CULLING_SIMULATED_LATENCY > 0)
+    {
+        if (Bounds != nullptr && TotalTicks % CullingPeriod != CullingPhase)
+        {
+            return;
+        }
+        PastBounds[PastBoundsHead].Fill(
+            GetNumCharacters(),
+            CameraLocations.data(),
+            Transforms.data());
+        PastBoundsHead = (PastBoundsHead + 1) % BOUNDS_HISTORY;
+        PastBoundsCount = std::min(PastBoundsCount + 1, BOUNDS_HISTORY);
+        // Cull with the oldest snapshot.
+        Bounds = &PastBounds[
+            (PastBoundsHead + BOUNDS_HISTORY - PastBoundsCount) % BOUNDS_HISTORY];
+    }
+    else
+    {
+        PastBounds[0].Fill(
+            GetNumCharacters(),
+            CameraLocations.data(),
+            Transforms.data());
+        Bounds = &PastBounds[0];
+    }
+}
+
+void CullingCore::PopulateBundles()
+{
+    BundleQueue.clear();
+    const int Phase = TotalTicks % CullingPeriod;
+    for (int i = 0; i < GetNumCharacters(); i++)
+    {
+        if (IsAlive[i])
+        {
+            // TODO:
+            //   Make displacement a function of game physics and state.
+            float Latency = GetLatency(i);
+            float MaxHorizontalDisplacement = Latency * 350;
+            float MaxVerticalDisplacement = Latency * 200;
+            for (int p = PairStarts[i]; p < PairStarts[i + 1]; p++)
+            {
+                int j = PairEnemies[p];
+                if (VisibilityTimers[p] == 0 && PairPhases[p] == Phase && IsAlive[j])
+                {
+                    BundleQueue.emplace_back(Bundle(i, j, p));
+                    GetPossiblePeeks(
+                        Bounds->GetCameraLocation(i),
+                        Bounds->GetCenter(j),
+                        MaxHorizontalDisplacement,
+                        MaxVerticalDisplacement,
+                        BundleQueue.back().PossiblePeeks);
+                }
+            }
+        }
+    }
+}
+
+// Estimates the latency of the client controlling character i in seconds,
+// plus the delay before the server uses the results of the cull.
+// The estimate should be greater than the expected latency,
+// as underestimating latency results in underestimated peeks,
+// which could result in popping.
+// TODO:
+//   Integrate with server latency estimation tools.
+float CullingCore::GetLatency(int i)
+{
+    return float(CULLING_SIMULATED_LATENCY + ResultDelay) / SERVER_TICKRATE;
+}
+
+void CullingCore::GetPossiblePeeks(
+    const Vec3& PlayerCameraLocation,
+    const Vec3& EnemyLocation,
+    float MaxDeltaHorizontal,
+    float MaxDeltaVertical,
+    Vec3 Corners[NUM_PEEKS])
+{
+    Vec3 PlayerToEnemy =
+        (EnemyLocation - PlayerCameraLocation).GetSafeNormal(1e-6);
+    // Displacement parallel to the XY plane and perpendicular to PlayerToEnemy.
+    Vec3 Horizontal =
+        MaxDeltaHorizontal * Vec3(-PlayerToEnemy.Y, PlayerToEnemy.X, 0);
+    Vec3 Vertical = Vec3(0, 0, MaxDeltaVertical);
+    Corners[0] = PlayerCameraLocation + Horizontal + Vertical;
+    Corners[1] = PlayerCameraLocation - Horizontal + Vertical;
+    Corners[2] = PlayerCameraLocation - Horizontal - Vertical;
+    Corners[3] = PlayerCameraLocation + Horizontal - Vertical;
+}
+
+std::size_t CullingCore::CullWithCache(std::size_t Begin, std::size_t End, CullingWork& Work)
+{
+    std::size_t Survivors = Begin;
+    for (std::size_t b = Begin; b < End; b++)
+    {
+        const Bundle& B = BundleQueue[b];
+        CuboidCache& Cache = CuboidCaches[B.PairI];
+        bool Blocked = false;
+        for (int k = 0; k < CUBOID_CACHE_SIZE; k++)
+        {
+            if (Cache.Cuboids[k] != CuboidCache::EMPTY)
+            {
+                if (
+                    IsBlocking(
+                        B.PossiblePeeks,
+                        Bounds->Boxes[B.EnemyI],
+                        &CuboidView[Cache.Cuboids[k]]))
+                {
+                    Blocked = true;
+                    Cache.Timers[k] = TotalTicks;
+                    Work.CacheHits[k]++;
+                    break;
+                }
+            }
+        }
+        if (!Blocked)
+        {
+            KeepBundle(b, Survivors);
+        }
+    }
+    return Survivors;
+}
+
+std::size_t CullingCore::CullWithSpheres(std::size_t Begin, std::size_t End, CullingWork& Work)
+{
+    // No spheres were added, so there is no BVH to traverse.
+    if (!SphereTraverser)
+    {
+        return End;
+    }
+    std::size_t Survivors = Begin;
+    for (std::size_t b = Begin; b < End; b++)
+    {
+        const Bundle& B = BundleQueue[b];
+        const OptSegment Segment(
+            Bounds->GetCameraLocation(B.PlayerI),
+            Bounds->GetCenter(B.EnemyI));
+        const Sphere* SphereP = SphereTraverser.get()->traverse(
+            Segment,
+            B.PossiblePeeks,
+            Bounds->Boxes[B.EnemyI],
+            &Work.SphereTraversals);
+        if (SphereP == NULL)
+        {
+            KeepBundle(b, Survivors);
+        }
+    }
+    return Survivors;
+}
+
+std::size_t CullingCore::CullWithCuboids(std::size_t Begin, std::size_t End, CullingWork& Work)
+{
+    // No cuboids were added, so there is no BVH to traverse.
+    if (!CuboidTraverser && !DynamicTraverser)
+    {
+        return End;
+    }
+    std::size_t Survivors = Begin;
+    for (std::size_t b = Begin; b < End; b++)
+    {
+        const Bundle& B = BundleQueue[b];
+        const OptSegment Segment(
+            Bounds->GetCameraLocation(B.PlayerI),
+            Bounds->GetCenter(B.EnemyI));
+        const Cuboid* CuboidP = NULL;
+        if (CuboidTraverser)
+        {
+            CuboidP = (CuboidTraversal == BVHTraversal::Shaft)
+                ? CuboidTraverser.get()->traverseShaft(
+                    Segment,
+                    B.PossiblePeeks,
+                    Bounds->Boxes[B.EnemyI],
+                    &Work.Traversals)
+                : CuboidTraverser.get()->traverse(
+                    Segment,
+                    B.PossiblePeeks,
+                    Bounds->Boxes[B.EnemyI],
+                    &Work.Traversals);
+        }
+        if (CuboidP != NULL)
+        {
+            CuboidCache& Cache = CuboidCaches[B.PairI];
+            int MinI = ArgMin(Cache.Timers, CUBOID_CACHE_SIZE);
+            Cache.Cuboids[MinI] = uint32_t(CuboidP - CuboidView.begin());
+            Cache.Timers[MinI] = TotalTicks;
+        }
+        // Dynamic cuboids are rebuilt too often to be worth caching.
+        else if (
+            !DynamicTraverser
+            || DynamicTraverser.get()->traverse(
+                Segment,
+                B.PossiblePeeks,
+                Bounds->Boxes[B.EnemyI],
+                &Work.Traversals) == NULL)
+        {
+            KeepBundle(b, Survivors);
+        }
+    }
+    return Survivors;
+}
@@ -0,0 +1,470 @@
+#pragma once
+#include "CullingMetrics.h"
+#include "CullingSettings.h"
+#include "GeometricPrimitives.h"
+#include "FastBVH.h"
+#include "WorkStealingPool.h"
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Cuboids that recently blocked LOS from a player to an enemy,
+// as indices into the cuboid array, and the ticks they last blocked on.
+struct CuboidCache
+{
+    static constexpr uint32_t EMPTY = 0xFFFFFFFF;
+    uint32_t Cuboids[CUBOID_CACHE_SIZE];
+    int Timers[CUBOID_CACHE_SIZE];
+    CuboidCache()
+    {
+        for (int k = 0; k < CUBOID_CACHE_SIZE; k++)
+        {
+            Cuboids[k] = EMPTY;
+            Timers[k] = 0;
+        }
+    }
+};
+
+// Strategies for building the cuboid BVH.
+enum class BVHBuilder
+{
+    // Splits nodes at the middle of their longest axis (FastBVH variant 1).
+    Midpoint,
+    // Splits nodes with the binned Surface Area Heuristic (FastBVH variant 2).
+    SAH,
+    // Splits nodes along the Morton curve of their centers (FastBVH variant 3).
+    // Builds fastest, but traversals visit more nodes.
+    Linear
+};
+
+// When pairs are culled within each culling period.
+enum class CullingSchedule
+{
+    // Culls every pair on the first tick of each period.
+    Full,
+    // Culls a share of the pairs on every tick of the period, moving pairs
+    // between ticks by measured cost, so that every tick costs about the same.
+    Amortized
+};
+
+// Ways of tracing bundles through the cuboid BVH.
+enum class BVHTraversal
+{
+    // Traces the segment from the player's camera to the enemy's center.
+    Ray,
+    // Also skips leaves missed by the segment from any peek
+    // to the enemy's bounds, see WideTraverser::traverseShaft.
+    Shaft
+};
+
+/**
+ *  Engine-independent occlusion culling pipeline.
+ *  Owns the occluders, character bounds, and per-pair culling state.
+ *  The game feeds it character inputs each culling tick and receives
+ *  the pairs of characters that should be revealed.
+ */
+class CullingCore
+{
+    // Tracks if each character is alive.
+    std::vector<bool> IsAlive;
+    // Tracks team of each character.
+    std::vector<char> Teams;
+    // Latest camera location of each character.
+    std::vector<Vec3> CameraLocations;
+    // Latest transform of each character.
+    std::vector<RigidTransform> Transforms;
+    // Bounding volumes of all characters used by the current cull.
+    // Points into PastBounds.
+    const BoundsSnapshot* Bounds = nullptr;
+    // Ring buffer of the bounding volumes of all characters at recent culls.
+    // Used to simulate latency in testing.
+    BoundsSnapshot PastBounds[BOUNDS_HISTORY];
+    // Index of the next snapshot to fill in PastBounds.
+    int PastBoundsHead = 0;
+    // Number of filled snapshots in PastBounds.
+    int PastBoundsCount = 0;
+    // All occluding cuboids in the map, in leaf order once the BVH is built.
+    std::vector<Cuboid> Cuboids;
+    // ID of each cuboid in Cuboids, which is the order it was added in.
+    std::vector<uint32_t> CuboidIds;
+    // Index in Cuboids of the cuboid with each ID.
+    std::vector<uint32_t> CuboidSlots;
+    // Indices in Cuboids of cuboids that moved since the last cull.
+    std::vector<uint32_t> MovedCuboids;
+    // The cuboids that culling reads: Cuboids, or baked cuboids
+    // viewed in place by LoadOccluders.
+    FastBVH::ConstIterable<Cuboid> CuboidView{nullptr, 0};
+    // Vertices of each cuboid in Cuboids, kept apart from the face planes
+    // that culling reads, and only read to bound and record cuboids.
+    std::vector<CuboidVertices> Vertices;
+    // Vertices of the cuboids in CuboidView.
+    FastBVH::ConstIterable<CuboidVertices> VertexView{nullptr, 0};
+    // Bounding volume hierarchy containing cuboids.
+    std::unique_ptr<FastBVH::BVH<float, Cuboid>> CuboidBVH{};
+    // CuboidBVH collapsed to eight children per node, which culling traverses.
+    std::unique_ptr<FastBVH::WideBVH<Cuboid>> CuboidWideBVH{};
+    // Refits CuboidBVH to moved cuboids.
+    std::unique_ptr<FastBVH::Refitter<float, Cuboid>> CuboidRefitter{};
+    CuboidIntersector Intersector;
+    // Strategy used by BuildOccluders to build CuboidBVH.
+    BVHBuilder CuboidBuilder = BVHBuilder::SAH;
+    // How CullWithCuboids traces bundles through the BVH.
+    BVHTraversal CuboidTraversal = BVHTraversal::Ray;
+    // Threads used by the SAH builder, where zero uses every hardware thread.
+    int BuildThreads = 0;
+    // Wall time of the last call to BuildOccluders or LoadOccluders.
+    double BuildMilliseconds = 0;
+    // Note: Could be nice to use std::optional with C++17.
+    std::unique_ptr
+        <WideTraverser<Cuboid, decltype(Intersector)>>
+        CuboidTraverser{};
+    // All occluding spheres in the map, in leaf order once the BVH is built.
+    std::vector<Sphere> Spheres;
+    // The spheres that culling reads: Spheres, or baked spheres.
+    FastBVH::ConstIterable<Sphere> SphereView{nullptr, 0};
+    // Wide bounding volume hierarchy containing spheres.
+    // Spheres do not move, so the binary BVH is not kept.
+    std::unique_ptr<FastBVH::WideBVH<Sphere>> SphereWideBVH{};
+    std::unique_ptr
+        <WideTraverser<Sphere, SphereIntersector>>
+        SphereTraverser{};
+    // Transient cuboids, such as smoke or vehicles, replaced every culling period.
+    std::vector<Cuboid> DynamicCuboids;
+    std::vector<CuboidVertices> DynamicVertices;
+    // Whether DynamicCuboids changed since DynamicBVH was built.
+    bool DynamicCuboidsChanged = false;
+    // Linear bounding volume hierarchy containing dynamic cuboids,
+    // rebuilt from scratch by the first cull after they change.
+    std::unique_ptr<FastBVH::BVH<float, Cuboid>> DynamicBVH{};
+    std::unique_ptr
+        <Traverser<float, Cuboid, decltype(Intersector)>>
+        DynamicTraverser{};
+    // Queues of line-of-sight bundles needing to be culled.
+    std::vector<Bundle> BundleQueue;
+    // Threads that cull bundles, as passed to SetCullingThreads.
+    int CullingThreads = 1;
+    // Workers of a parallel cull, or null when culling serially.
+    std::unique_ptr<WorkStealingPool> CullingPool{};
+    // Work and end of survivors of each chunk of a parallel cull.
+    std::vector<CullingWork> ChunkWork;
+    std::vector<std::size_t> ChunkEnds;
+
+    // How many frames pass between each cull.
+    int CullingPeriod = 4;
+    // When pairs are culled within each period.
+    CullingSchedule Schedule = CullingSchedule::Full;
+    // Tick of each period on which the full schedule culls.
+    int CullingPhase = 0;
+    // Set when the period or schedule changes.
+    bool ScheduleOutdated = true;
+    // Per-pair culling state is only kept for pairs of enemies,
+    // grouped by player and sorted by enemy. The pairs of player i
+    // are indexed from PairStarts[i] up to PairStarts[i + 1].
+    std::vector<int> PairStarts;
+    // Enemy of each pair.
+    std::vector<unsigned char> PairEnemies;
+    // Stores how many ticks each pair's enemy remains visible to its player for.
+    std::vector<uint16_t> VisibilityTimers;
+    // Cache of cuboids that recently blocked LOS between each pair.
+    std::vector<CuboidCache> CuboidCaches;
+    // Tick of the culling period on which each pair is culled.
+    // Always CullingPhase under the full schedule.
+    std::vector<uint16_t> PairPhases;
+    // Number of pairs in each phase.
+    std::vector<int> PhasePairs;
+    // Moving average of the time spent culling the pairs of each phase,
+    // or negative until the phase is first measured.
+    std::vector<double> PhaseNanoseconds;
+    // Set when characters are added or change teams.
+    bool PairsOutdated = true;
+    // How many ticks an enemy stays visible for after being revealed.
+    // A multiple of the period, so that timers run out on the tick
+    // that their pair is next culled.
+    int VisibilityTimerMax = CullingPeriod * 3;
+    // Total ticks since game start.
+    int TotalTicks = 0;
+    // Ticks after a cull's inputs until the last tick its results are used,
+    // such as when culling runs behind the game on a CullingPipeline.
+    int ResultDelay = 0;
+    // Counters and timers of each stage of the pipeline.
+    CullingMetrics Metrics;
+    // Time at which the current tick started culling.
+    CullingMetrics::Clock::time_point TickStart;
+
+    // Lays out per-pair state for the current roster and teams,
+    // keeping the state of pairs that were already enemies.
+    void UpdatePairs();
+    // Recounts the pairs in each phase.
+    void CountPhasePairs();
+    // Lays out the phases of pairs for the current period and schedule.
+    void UpdateSchedule();
+    // Records the time spent culling the pairs of a phase, and if it costs
+    // more than the mean phase, moves some of its pairs to the cheapest phase.
+    // Only moves pairs on their own phase's tick, so they wait no longer
+    // than a period for their next cull.
+    void RebalancePhases(int Phase, double Nanoseconds);
+    // Gets the ticks from the current tick until pair p's phase
+    // comes around, where zero means the current tick.
+    int GetPhaseDelay(int p) const
+    {
+        return (PairPhases[p] - TotalTicks % CullingPeriod + CullingPeriod) % CullingPeriod;
+    }
+    // Builds a BVH subtree over the cuboids from Start up to End,
+    // moving them into leaf order and returning its nodes.
+    FastBVH::NodeArray<float> BuildCuboidSubtree(uint32_t Start, uint32_t End);
+    // Points cuboid caches at the new indices of cuboids that a build
+    // reordered, given the IDs of cuboids from Start before the build.
+    void RemapCuboidCaches(uint32_t Start, const std::vector<uint32_t>& OldIds);
+    // Collapses CuboidBVH into the wide BVH that culling traverses.
+    void CollapseCuboidBVH();
+    // Refits the cuboid BVH to moved cuboids, rebuilding the subtrees
+    // whose boxes grew too much.
+    void RefitCuboids();
+    // Rebuilds the linear BVH over the dynamic cuboids.
+    void BuildDynamicCuboids();
+    // Updates the bounding volumes of characters.
+    void UpdateCharacterBounds();
+    // Calculates all bundles of lines of sight between characters,
+    // adding them to the BundleQueue for culling.
+    void PopulateBundles();
+    // Moves bundle b, which survived a culling stage, down to the end of the
+    // survivors at the front of the queue. Each stage compacts the queue in
+    // place this way, so it only writes survivors and never reallocates.
+    void KeepBundle(std::size_t b, std::size_t& Survivors)
+    {
+        if (b != Survivors)
+        {
+            BundleQueue[Survivors] = BundleQueue[b];
+        }
+        Survivors++;
+    }
+    // Each culling stage culls the queued bundles from Begin up to End,
+    // compacting survivors to the front of that range with KeepBundle,
+    // and returns the end of the survivors. Stages only write state of
+    // their own bundles' pairs, so disjoint ranges can be culled at once.
+    // Culls bundles with each player's cache of occluders.
+    std::size_t CullWithCache(std::size_t Begin, std::size_t End, CullingWork& Work);
+    // Culls bundles with occluding spheres.
+    std::size_t CullWithSpheres(std::size_t Begin, std::size_t End, CullingWork& Work);
+    // Culls bundles with occluding cuboids.
+    std::size_t CullWithCuboids(std::size_t Begin, std::size_t End, CullingWork& Work);
+    // Runs every culling stage on the bundles from Begin up to End.
+    std::size_t CullBundles(std::size_t Begin, std::size_t End, CullingWork& Work);
+    // Culls chunks of the queue on CullingPool, then gathers their
+    // survivors in order, so the result matches a serial cull.
+    void CullBundlesInParallel();
+    // Gets the estimated latency of player i in seconds,
+    // plus the result delay.
+    float GetLatency(int i);
+
+public:
+    // Adds a character on the given team, returning its index,
+    // or -1 if MAX_CHARACTERS characters were already added.
+    int AddCharacter(char Team);
+    // Sets the inputs used to bound character i on the next cull.
+    void SetCharacterState(
+        int i,
+        const Vec3& CameraLocation,
+        const RigidTransform& Transform);
+    // Marks character i as alive or dead.
+    void SetAlive(int i, bool Alive);
+    // Moves character i onto a team.
+    void SetTeam(int i, char Team);
+    // Adds an occluding cuboid, returning its ID.
+    // Call BuildOccluders after adding all cuboids.
+    int AddCuboid(const CuboidVertices& V);
+    // Moves the cuboid with the given ID, such as a door or elevator.
+    // The BVH is refit to it on the next cull.
+    // Cuboids loaded by LoadOccluders cannot move, and are left in place,
+    // as are unknown IDs.
+    void UpdateCuboid(int Id, const CuboidVertices& V);
+    // Adds an occluding sphere.
+    void AddSphere(const Sphere& S);
+    // Removes every dynamic cuboid.
+    void ClearDynamicCuboids();
+    // Adds a dynamic cuboid, such as smoke or a vehicle.
+    // Dynamic cuboids are tested alongside the map's cuboids,
+    // through a separate BVH that the next cull rebuilds whenever they change,
+    // so clear and add them all again when they move.
+    void AddDynamicCuboid(const CuboidVertices& V);
+    // Builds acceleration structures over the added occluders.
+    // Reorders cuboids and spheres into BVH leaf order.
+    void BuildOccluders();
+    // Replaces the occluders with baked ones, such as from an OccluderAsset,
+    // which are read in place and must outlive their use by the core.
+    // Cuboids and spheres must be in the leaf order of their wide BVH nodes.
+    // Do not add occluders afterwards.
+    void LoadOccluders(
+        const FastBVH::ConstIterable<Cuboid>& BakedCuboids,
+        const FastBVH::ConstIterable<CuboidVertices>& BakedVertices,
+        const FastBVH::ConstIterable<Sphere>& BakedSpheres,
+        const FastBVH::ConstIterable<FastBVH::WideNode>& BakedNodes,
+        const FastBVH::ConstIterable<FastBVH::WideNode>& BakedSphereNodes);
+    // Hashes the cuboids and spheres, whether added, built, or loaded.
+    // The hash does not depend on their order, so it tells whether
+    // occluders published by another process come from the same map.
+    uint64_t GetOccluderHash() const;
+    // Sets the strategy used by the next call to BuildOccluders.
+    void SetBVHBuilder(BVHBuilder Builder) { CuboidBuilder = Builder; }
+    BVHBuilder GetBVHBuilder() const { return CuboidBuilder; }
+    // Sets how bundles are traced through the cuboid BVH.
+    // Both ways cull the same bundles.
+    void SetBVHTraversal(BVHTraversal Traversal) { CuboidTraversal = Traversal; }
+    BVHTraversal GetBVHTraversal() const { return CuboidTraversal; }
+    // Sets the threads used by the next call to BuildOccluders,
+    // where zero uses every hardware thread.
+    // The built BVH is the same for any number of threads.
+    void SetBuildThreads(int Threads) { BuildThreads = Threads; }
+    // Sets the threads that cull bundles, where one culls on the calling
+    // thread and zero uses every hardware thread.
+    // Culls reveal the same enemies for any number of threads.
+    void SetCullingThreads(int Threads);
+    int GetCullingThreads() const { return CullingThreads; }
+    // Gets the wall time of the last call to BuildOccluders or LoadOccluders.
+    double GetBuildMilliseconds() const { return BuildMilliseconds; }
+    // Measures the cuboid BVH, for comparing build strategies.
+    // Returns an empty report if the BVH is not built.
+    FastBVH::Quality GetCuboidBVHQuality() const;
+
+    // Advances to the next server tick.
+    void StartTick() { TotalTicks++; }
+    // Checks if the current tick culls visibility.
+    bool IsCullingTick() const
+    {
+        return Schedule == CullingSchedule::Amortized || (TotalTicks % CullingPeriod) == CullingPhase;
+    }
+    // Cull visibility for all player, enemy pairs.
+    void Cull();
+    // Converts culling results into changes in in-game visibility,
+    // calling Send(i, j) for each enemy j that is revealed to player i.
+    template <typename SendFunction>
+    void UpdateVisibility(SendFunction&& Send);
+
+    int GetNumCharacters() const { return int(Teams.size()); }
+    char GetTeam(int i) const { return Teams[i]; }
+    bool GetAlive(int i) const { return IsAlive[i]; }
+    int GetTotalTicks() const { return TotalTicks; }
+    int GetCullingPeriod() const { return CullingPeriod; }
+    // Sets how many ticks pass between each cull of a pair.
+    // Revealed enemies stay visible for three culling periods.
+    void SetCullingPeriod(int Period)
+    {
+        CullingPeriod = Period;
+        CullingPhase %= Period;
+        VisibilityTimerMax = GetMaxStaleness() * 3;
+        ScheduleOutdated = true;
+    }
+    // Sets when pairs are culled within each period.
+    // Either way, each pair is culled once per period.
+    void SetCullingSchedule(CullingSchedule NewSchedule)
+    {
+        Schedule = NewSchedule;
+        ScheduleOutdated = true;
+    }
+    CullingSchedule GetCullingSchedule() const { return Schedule; }
+    // Sets the tick of each period on which the full schedule culls,
+    // such as to stagger the culls of servers sharing a host.
+    // Moving to a later phase delays the next cull of hidden pairs
+    // by up to a period, once.
+    void SetCullingPhase(int Phase)
+    {
+        if (Phase != CullingPhase)
+        {
+            CullingPhase = Phase;
+            ScheduleOutdated = ScheduleOutdated || Schedule == CullingSchedule::Full;
+        }
+    }
+    int GetCullingPhase() const { return CullingPhase; }
+    // Gets the most ticks between two culls of a hidden pair,
+    // and so the most ticks an enemy can stay hidden after
+    // it could be seen, beyond the latency that peeks cover.
+    // Rebalancing an amortized schedule keeps to this bound.
+    int GetMaxStaleness() const { return CullingPeriod; }
+    // Sets the ticks after a cull's inputs until the last tick its results
+    // are used. Peeks grow by the distance characters can move in that time,
+    // so that late results still reveal every enemy that could be seen.
+    void SetResultDelay(int Ticks) { ResultDelay = Ticks; }
+    int GetResultDelay() const { return ResultDelay; }
+    const FastBVH::ConstIterable<Cuboid>& GetCuboids() const { return CuboidView; }
+    // Gets the vertices of each cuboid in GetCuboids.
+    const FastBVH::ConstIterable<CuboidVertices>& GetCuboidVertices() const { return VertexView; }
+    const FastBVH::ConstIterable<Sphere>& GetSpheres() const { return SphereView; }
+    // Gets the wide BVH that culling traverses, or null if it is not built.
+    const FastBVH::WideBVH<Cuboid>* GetCuboidWideBVH() const { return CuboidWideBVH.get(); }
+    const FastBVH::WideBVH<Sphere>* GetSphereWideBVH() const { return SphereWideBVH.get(); }
+    // Gets metrics accumulated since the last call to ResetMetrics.
+    const CullingMetrics& GetMetrics() const { return Metrics; }
+    void ResetMetrics() { Metrics.Reset(); }
+
+    // Gets corners of the rectangle encompassing a player's possible peeks
+    // on an enemy--in the plane normal to the line of sight.
+    // When facing along the vector from player to enemy, Corners are indexed
+    // starting from the top right, proceeding counter-clockwise.
+    // NOTE:
+    //   Inaccurate on very wide enemies, as the most aggressive angle to peek
+    //   the left of an enemy is actually perpendicular to the leftmost point
+    //   of the enemy, not its center.
+    static void GetPossiblePeeks(
+        const Vec3& PlayerCameraLocation,
+        const Vec3& EnemyLocation,
+        float MaxDeltaHorizontal,
+        float MaxDeltaVertical,
+        Vec3 Corners[NUM_PEEKS]);
+
+    // Get the index of the minimum element in an array.
+    static inline int ArgMin(int A[], int Length)
+    {
+        int Min = INT_MAX;
+        int MinI = 0;
+        for (int i = 0; i < Length; i++)
+        {
+            if (A[i] < Min)
+            {
+                Min = A[i];
+                MinI = i;
+            }
+        }
+        return MinI;
+    }
+};
+
+// Increments visibility timers of bundles that were not culled,
+// and reveals enemies with positive visibility timers.
+template <typename SendFunction>
+void CullingCore::UpdateVisibility(SendFunction&& Send)
+{
+    CullingMetrics::Clock::time_point Start = CullingMetrics::Clock::now();
+    std::size_t Remaining = BundleQueue.size();
+    std::size_t Revealed = 0;
+    // There are bundles remaining from the culling pipeline.
+    for (const Bundle& B : BundleQueue)
+    {
+        // Rebalancing may have moved the pair to a later phase.
+        VisibilityTimers[B.PairI] = uint16_t(VisibilityTimerMax + GetPhaseDelay(B.PairI));
+    }
+    BundleQueue.clear();
+    if (PairsOutdated)
+    {
+        UpdatePairs();
+    }
+    // Reveal
+    for (int i = 0; i < GetNumCharacters(); i++)
+    {
+        if (IsAlive[i])
+        {
+            for (int p = PairStarts[i]; p < PairStarts[i + 1]; p++)
+            {
+                if (IsAlive[PairEnemies[p]] && (VisibilityTimers[p] > 0))
+                {
+                    Send(i, int(PairEnemies[p]));
+                    VisibilityTimers[p]--;
+                    Revealed++;
+                }
+            }
+        }
+    }
+    CullingMetrics::Clock::time_point Stop =
+        Metrics.EndStage(STAGE_VISIBILITY, Start, Remaining, Revealed);
+    Metrics.RecordTick(TickStart, Stop, IsCullingTick());
+}
@@ -0,0 +1,238 @@
+#include "CullingMetrics.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+    void AddTraversals(FastBVH::TraversalStats& Total, const FastBVH::TraversalStats& Stats)
+    {
+        Total.traversals += Stats.traversals;
+        Total.nodes_visited += Stats.nodes_visited;
+        Total.primitives_tested += Stats.primitives_tested;
+    }
+}
+
+int LatencyHistogram::GetBucket(uint64_t Nanoseconds)
+{
+    if (Nanoseconds < LATENCY_SUB_BUCKETS)
+    {
+        return int(Nanoseconds);
+    }
+    if (Nanoseconds >= (uint64_t(1) << LATENCY_MAX_BITS))
+    {
+        return LATENCY_BUCKETS - 1;
+    }
+    // Index of the most significant bit.
+    int Msb = 0;
+    for (uint64_t V = Nanoseconds; V > 1; V >>= 1)
+    {
+        Msb++;
+    }
+    // Keep the top LATENCY_SUB_BUCKET_BITS + 1 bits of the value.
+    int Shift = Msb - LATENCY_SUB_BUCKET_BITS;
+    int Top = int(Nanoseconds >> Shift);
+    return (Shift + 1) * LATENCY_SUB_BUCKETS + (Top - LATENCY_SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::GetBucketValue(int Bucket)
+{
+    if (Bucket < LATENCY_SUB_BUCKETS)
+    {
+        return uint64_t(Bucket);
+    }
+    int Shift = Bucket / LATENCY_SUB_BUCKETS - 1;
+    uint64_t Top = uint64_t(Bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS);
+    return (Top << Shift) + ((uint64_t(1) << Shift) >> 1);
+}
+
+void LatencyHistogram::Record(uint64_t Nanoseconds)
+{
+    Counts[GetBucket(Nanoseconds)]++;
+    Count++;
+    Total += Nanoseconds;
+    Max = Nanoseconds > Max ? Nanoseconds : Max;
+}
+
+void LatencyHistogram::Reset()
+{
+    *this = LatencyHistogram();
+}
+
+uint64_t LatencyHistogram::GetPercentile(double P) const
+{
+    if (Count == 0)
+    {
+        return 0;
+    }
+    // Rank of the requested value, counting from one.
+    uint64_t Rank = uint64_t(P * Count + 0.5);
+    Rank = Rank < 1 ? 1 : (Rank > Count ? Count : Rank);
+    uint64_t Seen = 0;
+    for (int Bucket = 0; Bucket < LATENCY_BUCKETS; Bucket++)
+    {
+        Seen += Counts[Bucket];
+        if (Seen >= Rank)
+        {
+            uint64_t Value = GetBucketValue(Bucket);
+            // Bucket midpoints can overshoot the largest recorded value.
+            return Value < Max ? Value : Max;
+        }
+    }
+    return Max;
+}
+
+void CullingMetrics::RecordTick(Clock::time_point Start, Clock::time_point Stop, bool Culled)
+{
+    uint64_t Nanoseconds = uint64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Stop - Start).count());
+    TickLatency.Record(Nanoseconds);
+    if (Culled)
+    {
+        CullLatency.Record(Nanoseconds);
+        Culls++;
+    }
+}
+
+void CullingMetrics::RecordWork(const CullingWork& Work, double TimeScale)
+{
+    for (int Stage = 0; Stage < NUM_STAGES; Stage++)
+    {
+        StageNanoseconds[Stage] += uint64_t(Work.StageNanoseconds[Stage] * TimeScale);
+        StageBundlesIn[Stage] += Work.StageBundlesIn[Stage];
+        StageBundlesOut[Stage] += Work.StageBundlesOut[Stage];
+    }
+    for (int k = 0; k < CUBOID_CACHE_SIZE; k++)
+    {
+        CacheHits[k] += Work.CacheHits[k];
+    }
+    AddTraversals(Traversals, Work.Traversals);
+    AddTraversals(SphereTraversals, Work.SphereTraversals);
+}
+
+void CullingWork::Add(const CullingWork& Other)
+{
+    for (int Stage = 0; Stage < NUM_STAGES; Stage++)
+    {
+        StageNanoseconds[Stage] += Other.StageNanoseconds[Stage];
+        StageBundlesIn[Stage] += Other.StageBundlesIn[Stage];
+        StageBundlesOut[Stage] += Other.StageBundlesOut[Stage];
+    }
+    for (int k = 0; k < CUBOID_CACHE_SIZE; k++)
+    {
+        CacheHits[k] += Other.CacheHits[k];
+    }
+    AddTraversals(Traversals, Other.Traversals);
+    AddTraversals(SphereTraversals, Other.SphereTraversals);
+}
+
+void CullingMetrics::Reset()
+{
+    Culls = 0;
+    for (int Stage = 0; Stage < NUM_STAGES; Stage++)
+    {
+        StageNanoseconds[Stage] = 0;
+        StageBundlesIn[Stage] = 0;
+        StageBundlesOut[Stage] = 0;
+    }
+    for (int k = 0; k < CUBOID_CACHE_SIZE; k++)
+    {
+        CacheHits[k] = 0;
+    }
+    Traversals = FastBVH::TraversalStats();
+    SphereTraversals = FastBVH::TraversalStats();
+    TickLatency.Reset();
+    CullLatency.Reset();
+}
+
+double CullingMetrics::GetStageMicroseconds(CullingStage Stage) const
+{
+    return Culls > 0 ? StageNanoseconds[Stage] / 1000.0 / Culls : 0;
+}
+
+double CullingMetrics::GetCacheHitRate(int k) const
+{
+    uint64_t Lookups = StageBundlesIn[STAGE_CACHE];
+    return Lookups > 0 ? double(CacheHits[k]) / Lookups : 0;
+}
+
+const char* CullingMetrics::GetStageName(CullingStage Stage)
+{
+    switch (Stage)
+    {
+        case STAGE_OCCLUDERS: return "occluders";
+        case STAGE_BOUNDS: return "bounds";
+        case STAGE_BUNDLES: return "bundles";
+        case STAGE_CACHE: return "cache";
+        case STAGE_SPHERES: return "spheres";
+        case STAGE_CUBOIDS: return "cuboids";
+        case STAGE_VISIBILITY: return "visibility";
+        default: return "unknown";
+    }
+}
+
+std::string CullingMetrics::ToLogLine() const
+{
+    std::string Line;
+    char Buffer[256];
+    auto Append = [&Line, &Buffer](int Length)
+    {
+        if (Length > 0)
+        {
+            Line.append(Buffer, std::min(std::size_t(Length), sizeof(Buffer) - 1));
+        }
+    };
+    const LatencyHistogram* Histograms[2] = { &TickLatency, &CullLatency };
+    const char* HistogramNames[2] = { "tick_us", "cull_us" };
+    Append(std::snprintf(
+        Buffer, sizeof(Buffer),
+        "{\"ticks\":%llu,\"culls\":%llu",
+        (unsigned long long)TickLatency.GetCount(),
+        (unsigned long long)Culls));
+    for (int h = 0; h < 2; h++)
+    {
+        const LatencyHistogram& H = *Histograms[h];
+        Append(std::snprintf(
+            Buffer, sizeof(Buffer),
+            ",\"%s\":{\"mean\":%.2f,\"p50\":%.2f,\"p99\":%.2f,\"p999\":%.2f,\"max\":%.2f}",
+            HistogramNames[h],
+            H.GetMean() / 1000.0,
+            H.GetPercentile(0.5) / 1000.0,
+            H.GetPercentile(0.99) / 1000.0,
+            H.GetPercentile(0.999) / 1000.0,
+            H.GetMax() / 1000.0));
+    }
+    Append(std::snprintf(Buffer, sizeof(Buffer), ",\"stages\":{"));
+    for (int Stage = 0; Stage < NUM_STAGES; Stage++)
+    {
+        Append(std::snprintf(
+            Buffer, sizeof(Buffer),
+            "%s\"%s\":{\"us\":%.2f,\"in\":%llu,\"out\":%llu}",
+            Stage > 0 ? "," : "",
+            GetStageName(CullingStage(Stage)),
+            GetStageMicroseconds(CullingStage(Stage)),
+            (unsigned long long)StageBundlesIn[Stage],
+            (unsigned long long)StageBundlesOut[Stage]));
+    }
+    Append(std::snprintf(Buffer, sizeof(Buffer), "},\"cache_hit_rate\":["));
+    for (int k = 0; k < CUBOID_CACHE_SIZE; k++)
+    {
+        Append(std::snprintf(
+            Buffer, sizeof(Buffer), "%s%.4f", k > 0 ? "," : "", GetCacheHitRate(k)));
+    }
+    Append(std::snprintf(Buffer, sizeof(Buffer), "]"));
+    const FastBVH::TraversalStats* Stats[2] = { &Traversals, &SphereTraversals };
+    const char* StatsNames[2] = { "traverse", "sphere_traverse" };
+    for (int t = 0; t < 2; t++)
+    {
+        double Count = double(Stats[t]->traversals);
+        Append(std::snprintf(
+            Buffer, sizeof(Buffer),
+            ",\"%s\":{\"count\":%llu,\"nodes_per\":%.2f,\"prims_per\":%.2f}",
+            StatsNames[t],
+            (unsigned long long)Stats[t]->traversals,
+            Count > 0 ? Stats[t]->nodes_visited / Count : 0,
+            Count > 0 ? Stats[t]->primitives_tested / Count : 0));
+    }
+    Append(std::snprintf(Buffer, sizeof(Buffer), "}"));
+    return Line;
+}
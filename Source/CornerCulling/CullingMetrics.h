@@ -0,0 +1,154 @@
+#pragma once
+
+#include "CullingSettings.h"
+#include "FastBVH/Traverser.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Stages of a culling tick, in pipeline order.
+enum CullingStage
+{
+    STAGE_OCCLUDERS,
+    STAGE_BOUNDS,
+    STAGE_BUNDLES,
+    STAGE_CACHE,
+    STAGE_SPHERES,
+    STAGE_CUBOIDS,
+    STAGE_VISIBILITY,
+    NUM_STAGES
+};
+
+struct CullingWork;
+
+// Log-linear histogram of latencies in nanoseconds, in the style of
+// HdrHistogram. Values below 2^LATENCY_SUB_BUCKET_BITS are recorded exactly.
+// Larger values are bucketed by power of two, and each power of two is
+// split into 2^LATENCY_SUB_BUCKET_BITS linear sub-buckets,
+// bounding the relative error of percentiles to under 2%.
+constexpr int LATENCY_SUB_BUCKET_BITS = 6;
+constexpr int LATENCY_SUB_BUCKETS = 1 << LATENCY_SUB_BUCKET_BITS;
+// Values of 2^LATENCY_MAX_BITS ns (about 18 minutes) or more are clamped.
+constexpr int LATENCY_MAX_BITS = 40;
+constexpr int LATENCY_BUCKETS =
+    (LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS;
+
+class LatencyHistogram
+{
+    uint64_t Counts[LATENCY_BUCKETS] = { 0 };
+    uint64_t Count = 0;
+    uint64_t Total = 0;
+    uint64_t Max = 0;
+
+    static int GetBucket(uint64_t Nanoseconds);
+    // Gets the midpoint of the values in a bucket.
+    static uint64_t GetBucketValue(int Bucket);
+
+public:
+    void Record(uint64_t Nanoseconds);
+    void Reset();
+
+    uint64_t GetCount() const { return Count; }
+    uint64_t GetMax() const { return Max; }
+    double GetMean() const { return Count > 0 ? double(Total) / Count : 0; }
+    // Gets the value below which a fraction P of recorded values lie.
+    uint64_t GetPercentile(double P) const;
+};
+
+// Low-overhead counters and timers of the culling pipeline.
+// Accumulates until reset, so that each export covers one window of ticks.
+class CullingMetrics
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    // Number of culling ticks in the window.
+    uint64_t Culls = 0;
+    // Wall time and bundle throughput of each stage.
+    uint64_t StageNanoseconds[NUM_STAGES] = { 0 };
+    uint64_t StageBundlesIn[NUM_STAGES] = { 0 };
+    uint64_t StageBundlesOut[NUM_STAGES] = { 0 };
+    // Number of bundles culled by each slot of the cuboid cache.
+    uint64_t CacheHits[CUBOID_CACHE_SIZE] = { 0 };
+    // Work done by cuboid and sphere BVH traversals.
+    FastBVH::TraversalStats Traversals;
+    FastBVH::TraversalStats SphereTraversals;
+    // Latency of every tick, and of ticks that cull.
+    LatencyHistogram TickLatency;
+    LatencyHistogram CullLatency;
+
+public:
+    // Records a stage that started at Start, returning the current time
+    // so that consecutive stages can be chained without extra clock reads.
+    Clock::time_point EndStage(
+        CullingStage Stage,
+        Clock::time_point Start,
+        std::size_t BundlesIn,
+        std::size_t BundlesOut)
+    {
+        Clock::time_point Now = Clock::now();
+        StageNanoseconds[Stage] += uint64_t(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Now - Start).count());
+        StageBundlesIn[Stage] += BundlesIn;
+        StageBundlesOut[Stage] += BundlesOut;
+        return Now;
+    }
+    // Adds the work of the bundle culling stages, scaling stage times
+    // by TimeScale, which converts time summed over parallel workers
+    // into wall time.
+    void RecordWork(const CullingWork& Work, double TimeScale = 1);
+    // Gets the work done by cuboid and sphere BVH traversals.
+    const FastBVH::TraversalStats* GetTraversalStats() const { return &Traversals; }
+    const FastBVH::TraversalStats* GetSphereTraversalStats() const { return &SphereTraversals; }
+    // Records the total latency of a tick.
+    void RecordTick(Clock::time_point Start, Clock::time_point Stop, bool Culled);
+    void Reset();
+
+    uint64_t GetCulls() const { return Culls; }
+    uint64_t GetStageNanoseconds(CullingStage Stage) const { return StageNanoseconds[Stage]; }
+    uint64_t GetStageBundlesIn(CullingStage Stage) const { return StageBundlesIn[Stage]; }
+    uint64_t GetStageBundlesOut(CullingStage Stage) const { return StageBundlesOut[Stage]; }
+    const LatencyHistogram& GetTickLatency() const { return TickLatency; }
+    const LatencyHistogram& GetCullLatency() const { return CullLatency; }
+    // Gets the mean wall time of a stage per culling tick, in microseconds.
+    // Visibility updates every tick, so its time covers a whole culling period.
+    double GetStageMicroseconds(CullingStage Stage) const;
+    // Gets the fraction of bundles entering the cache stage
+    // that were culled by slot k.
+    double GetCacheHitRate(int k) const;
+
+    // Formats the window as a single-line JSON object for log scraping.
+    std::string ToLogLine() const;
+
+    static const char* GetStageName(CullingStage Stage);
+};
+
+// Counters of the bundle culling stages over one run of bundles.
+// Each run of a parallel cull keeps its own, on its own cache lines,
+// and the runs are added up in order once they finish.
+struct alignas(64) CullingWork
+{
+    uint64_t StageNanoseconds[NUM_STAGES] = { 0 };
+    uint64_t StageBundlesIn[NUM_STAGES] = { 0 };
+    uint64_t StageBundlesOut[NUM_STAGES] = { 0 };
+    uint64_t CacheHits[CUBOID_CACHE_SIZE] = { 0 };
+    FastBVH::TraversalStats Traversals;
+    FastBVH::TraversalStats SphereTraversals;
+
+    // Records a stage that started at Start, returning the current time.
+    CullingMetrics::Clock::time_point EndStage(
+        CullingStage Stage,
+        CullingMetrics::Clock::time_point Start,
+        std::size_t BundlesIn,
+        std::size_t BundlesOut)
+    {
+        CullingMetrics::Clock::time_point Now = CullingMetrics::Clock::now();
+        StageNanoseconds[Stage] += uint64_t(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Now - Start).count());
+        StageBundlesIn[Stage] += BundlesIn;
+        StageBundlesOut[Stage] += BundlesOut;
+        return Now;
+    }
+    void Add(const CullingWork& Other);
+};
@@ -0,0 +1,117 @@
+#include "CullingPipeline.h"
+#include <algorithm>
+#include <cstdio>
+
+CullingPipeline::CullingPipeline(CullingCore& Core)
+    : Core(Core), Results(new VisibilityMatrix[2])
+{
+    Results[0].Clear(0);
+    Results[1].Clear(0);
+    Worker = std::thread(&CullingPipeline::WorkerLoop, this);
+}
+
+CullingPipeline::~CullingPipeline()
+{
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        Stopping = true;
+    }
+    Wake.notify_one();
+    Worker.join();
+}
+
+bool CullingPipeline::StartTick()
+{
+    GameTicks++;
+    PendingTicks++;
+    if (Busy.load(std::memory_order_acquire))
+    {
+        BusyTicks++;
+        return false;
+    }
+    return true;
+}
+
+void CullingPipeline::Submit()
+{
+    // This job's results will be used until the next job finishes.
+    // Expect the jobs to take as long as the last one, and their results
+    // to be used for no less time than the results of the job before last.
+    int Delay = 1;
+    if (Jobs > 0)
+    {
+        Delay = 2 * (GameTicks - SubmitTick) - 1;
+    }
+    if (Jobs > 1)
+    {
+        int Observed = GameTicks - 1 - PreviousSubmitTick;
+        MaxResultDelay = std::max(MaxResultDelay, Observed);
+        Delay = std::max(Delay, Observed);
+    }
+    Core.SetResultDelay(Delay);
+    PreviousSubmitTick = SubmitTick;
+    SubmitTick = GameTicks;
+    Jobs++;
+    Busy.store(true, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        // A slow worker catches up on at most a period of ticks,
+        // so that it cannot fall ever further behind.
+        JobTicks = std::min(PendingTicks, Core.GetCullingPeriod());
+    }
+    PendingTicks = 0;
+    Wake.notify_one();
+}
+
+void CullingPipeline::WorkerLoop()
+{
+    while (true)
+    {
+        int Ticks = 0;
+        {
+            std::unique_lock<std::mutex> Guard(Lock);
+            Wake.wait(Guard, [this] { return Stopping || JobTicks > 0; });
+            if (Stopping)
+            {
+                return;
+            }
+            Ticks = JobTicks;
+            JobTicks = 0;
+        }
+        RunJob(Ticks);
+        Busy.store(false, std::memory_order_release);
+    }
+}
+
+void CullingPipeline::RunJob(int Ticks)
+{
+    // Every tick of the job has the same inputs, so only the last
+    // one's reveals are published. Earlier ticks still cull, so that
+    // an amortized schedule culls each of its phases.
+    for (int t = 0; t < Ticks - 1; t++)
+    {
+        Core.StartTick();
+        Core.Cull();
+        Core.UpdateVisibility([](int, int) {});
+    }
+    const int Back = 1 - Front.load(std::memory_order_relaxed);
+    VisibilityMatrix& Matrix = Results[Back];
+    Matrix.Clear(Core.GetNumCharacters());
+    Core.StartTick();
+    Core.Cull();
+    Core.UpdateVisibility([&Matrix](int i, int j) { Matrix.Reveal(i, j); });
+    Front.store(Back, std::memory_order_release);
+}
+
+std::string CullingPipeline::ToLogLine() const
+{
+    char Line[256];
+    std::snprintf(
+        Line,
+        sizeof(Line),
+        "{\"jobs\":%llu,\"busy_ticks\":%llu,\"max_result_delay\":%d}",
+        (unsigned long long)Jobs,
+        (unsigned long long)BusyTicks,
+        MaxResultDelay);
+    return Line;
+}
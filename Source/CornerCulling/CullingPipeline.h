@@ -0,0 +1,133 @@
+#pragma once
+
+#include "CullingCore.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Enemies revealed to each player by one culling tick, one bit per pair.
+class VisibilityMatrix
+{
+    static constexpr int ROW_WORDS = (MAX_CHARACTERS + 63) / 64;
+    uint64_t Rows[MAX_CHARACTERS][ROW_WORDS];
+    int NumCharacters = 0;
+
+public:
+    // Hides every enemy from the first NumCharacters players.
+    void Clear(int Characters)
+    {
+        NumCharacters = Characters;
+        for (int i = 0; i < NumCharacters; i++)
+        {
+            for (int w = 0; w < ROW_WORDS; w++)
+            {
+                Rows[i][w] = 0;
+            }
+        }
+    }
+    void Reveal(int i, int j) { Rows[i][j / 64] |= uint64_t(1) << (j % 64); }
+    bool IsRevealed(int i, int j) const { return (Rows[i][j / 64] >> (j % 64)) & 1; }
+    // Calls Send(i, j) for each enemy j revealed to player i,
+    // in the order that CullingCore::UpdateVisibility reveals them.
+    template <typename SendFunction>
+    void ForEachRevealed(SendFunction&& Send) const
+    {
+        for (int i = 0; i < NumCharacters; i++)
+        {
+            for (int w = 0; w < ROW_WORDS; w++)
+            {
+                for (uint64_t Bits = Rows[i][w]; Bits != 0; Bits &= Bits - 1)
+                {
+                    int Bit = 0;
+                    while (((Bits >> Bit) & 1) == 0)
+                    {
+                        Bit++;
+                    }
+                    Send(i, w * 64 + Bit);
+                }
+            }
+        }
+    }
+};
+
+// Runs the culling ticks of a CullingCore on a background thread,
+// so that culling no longer adds to the game thread's frame time.
+// Each tick, the game thread calls StartTick. If the worker is idle,
+// the core belongs to the game thread until Submit, so it copies the
+// tick's inputs into the core and submits them. The worker then runs
+// a core tick for every game tick since the last submit, up to a culling
+// period, and publishes the revealed enemies of the last one in a
+// double-buffered VisibilityMatrix. Meanwhile, the game thread keeps
+// replicating the latest published matrix, and never waits for the worker.
+// Results are used a few ticks after their inputs, so the pipeline
+// measures that delay and the core widens peeks to cover it.
+class CullingPipeline
+{
+    CullingCore& Core;
+    // Results of the last two jobs. The worker fills the back matrix
+    // while the game thread reads the front one, and the game thread
+    // only submits the next job once the worker has flipped them.
+    std::unique_ptr<VisibilityMatrix[]> Results;
+    // Index in Results of the front matrix. Only the worker writes it.
+    std::atomic<int> Front{0};
+    // Set from Submit until the worker publishes its results.
+    std::atomic<bool> Busy{false};
+    std::thread Worker;
+
+    // Guards the fields below, which hand jobs to the worker.
+    std::mutex Lock;
+    std::condition_variable Wake;
+    // Core ticks that the worker is to run, or zero when it has no job.
+    int JobTicks = 0;
+    bool Stopping = false;
+
+    // Only used by the game thread.
+    int GameTicks = 0;
+    // Game ticks not yet submitted to the worker.
+    int PendingTicks = 0;
+    // Game ticks of the last two submits.
+    int SubmitTick = 0;
+    int PreviousSubmitTick = 0;
+    uint64_t Jobs = 0;
+    // Game ticks on which the worker was still busy.
+    uint64_t BusyTicks = 0;
+    int MaxResultDelay = 0;
+
+    void WorkerLoop();
+    // Runs Ticks core ticks, and publishes the revealed enemies of the last.
+    void RunJob(int Ticks);
+
+public:
+    // Starts the worker. The core must outlive the pipeline, and is only
+    // touched by the game thread from StartTick returning true until Submit.
+    explicit CullingPipeline(CullingCore& Core);
+    // Waits for the current job, if any, and stops the worker.
+    ~CullingPipeline();
+    CullingPipeline(const CullingPipeline&) = delete;
+    CullingPipeline& operator=(const CullingPipeline&) = delete;
+
+    // Call at the start of every game tick. Returns true if the worker
+    // is idle, in which case set the core's inputs and call Submit.
+    bool StartTick();
+    // Hands the ticks since the last submit to the worker.
+    void Submit();
+    // Calls Send(i, j) for each enemy j revealed to player i
+    // by the latest published results.
+    template <typename SendFunction>
+    void ForEachRevealed(SendFunction&& Send) const
+    {
+        Results[Front.load(std::memory_order_acquire)].ForEachRevealed(Send);
+    }
+
+    uint64_t GetJobs() const { return Jobs; }
+    uint64_t GetBusyTicks() const { return BusyTicks; }
+    // Gets the most ticks between a job's inputs and the last use of its results.
+    int GetMaxResultDelay() const { return MaxResultDelay; }
+    // Formats jobs, busy ticks, and result delay as a single-line
+    // JSON object for log scraping.
+    std::string ToLogLine() const;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+// Compile-time settings of the culling pipeline.
+
+constexpr int SERVER_TICKRATE = 120;
+// Simulated latency in ticks.
+constexpr int CULLING_SIMULATED_LATENCY = 12;
+// Number of culls of character bounds kept to simulate latency.
+// Culls use the oldest bounds.
+constexpr int BOUNDS_HISTORY = 3;
+
+// Number of peeks in each Bundle.
+constexpr int NUM_PEEKS = 4;
+// Maximum number of characters in a game.
+constexpr int MAX_CHARACTERS = 200;
+// Number of cuboids in each entry of the cuboid cache array.
+constexpr int CUBOID_CACHE_SIZE = 3;
+// Factor by which refitting a moving cuboid may grow the surface area
+// of a cuboid BVH node before the node's subtree is rebuilt.
+constexpr float REFIT_MAX_INFLATION = 1.5f;
+// Number of bundles in each task of a parallel cull.
+constexpr int CULLING_CHUNK_SIZE = 64;
+// Fraction by which a tick of an amortized culling schedule may cost
+// more than the mean tick before some of its pairs are moved.
+constexpr float SCHEDULE_TOLERANCE = 0.1f;
+// Weight of each measurement in the moving average of a tick's cost.
+constexpr float PHASE_COST_SMOOTHING = 0.25f;
+// Most server instances that can stagger their culls on one host.
+constexpr int STAGGER_MAX_INSTANCES = 64;
+// Milliseconds after its last update that a staggered instance counts as gone.
+constexpr int STAGGER_TIMEOUT_MS = 1000;
+// Culls between each attempt of a staggered instance to move to a less loaded phase.
+constexpr int STAGGER_REBALANCE_CULLS = 30;
+// Fraction of its own cull time by which another phase must be less loaded
+// for a staggered instance to move to it.
+constexpr float STAGGER_HYSTERESIS = 0.5f;
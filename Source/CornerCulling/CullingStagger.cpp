@@ -0,0 +1,311 @@
+#include "CullingStagger.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Changes whenever the layout of StaggerSegment does.
+    constexpr uint32_t STAGGER_VERSION = 1;
+    constexpr uint64_t STAGGER_TIMEOUT_NANOSECONDS = uint64_t(STAGGER_TIMEOUT_MS) * 1000000;
+
+    // Reads the steady clock, which is shared by every process on the host.
+    uint64_t GetNowNanoseconds()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    uint32_t GetProcessId()
+    {
+#if defined(_WIN32)
+        return uint32_t(GetCurrentProcessId());
+#else
+        return uint32_t(getpid());
+#endif
+    }
+
+    int Wrap(int Phase, int Period)
+    {
+        return ((Phase % Period) + Period) % Period;
+    }
+}
+
+bool CullingStagger::Open(const char* Name, int Period)
+{
+    Close();
+    CullingPeriod = std::max(Period, 1);
+    TickNanoseconds = 1000000000ull / SERVER_TICKRATE;
+    PeriodNanoseconds = TickNanoseconds * CullingPeriod;
+    char Suffix[32];
+    std::snprintf(Suffix, sizeof(Suffix), "-%llu", (unsigned long long)PeriodNanoseconds);
+    if (!Mapping.OpenOrCreateShared((std::string(Name) + Suffix).c_str(), sizeof(StaggerSegment)))
+    {
+        return false;
+    }
+    Segment = reinterpret_cast<StaggerSegment*>(Mapping.GetWritableData());
+    // Processes can only share atomics that need no lock.
+    uint32_t Version = 0;
+    if (!Segment->Lock.is_lock_free()
+        || (!Segment->Version.compare_exchange_strong(Version, STAGGER_VERSION)
+            && Version != STAGGER_VERSION))
+    {
+        Close();
+        return false;
+    }
+    uint64_t Now = GetNowNanoseconds();
+    // Slots are only claimed under the lock, so two instances
+    // never claim the same slot.
+    while (!TryLock(Now))
+    {
+        std::this_thread::yield();
+        Now = GetNowNanoseconds();
+    }
+    for (int s = 0; s < STAGGER_MAX_INSTANCES && Slot < 0; s++)
+    {
+        StaggerSlot& Candidate = Segment->Slots[s];
+        if (!IsLive(Candidate, Now))
+        {
+            Slot = s;
+        }
+    }
+    if (Slot >= 0)
+    {
+        std::vector<double> Loads = GetPhaseLoads(Now);
+        Phase = GetLeastLoadedPhase(Loads, 0);
+        StaggerSlot& Own = Segment->Slots[Slot];
+        Own.Phase.store(uint32_t(Phase));
+        Own.Culling.store(0);
+        Own.CullNanoseconds.store(0);
+        Own.Heartbeat.store(Now);
+        Own.Owner.store(GetProcessId());
+    }
+    Unlock();
+    if (Slot < 0)
+    {
+        Close();
+        return false;
+    }
+    LocalPhase = -1;
+    CullNanoseconds = 0;
+    Culls = 0;
+    ContendedCulls = 0;
+    Moves = 0;
+    return true;
+}
+
+void CullingStagger::Close()
+{
+    if (Segment != nullptr && Slot >= 0)
+    {
+        Segment->Slots[Slot].Culling.store(0);
+        Segment->Slots[Slot].Owner.store(0);
+    }
+    Slot = -1;
+    Segment = nullptr;
+    // The segment is left for later instances.
+    Mapping.Close();
+}
+
+bool CullingStagger::TryLock(uint64_t Now)
+{
+    uint64_t Held = Segment->Lock.load();
+    if (Held != 0 && Now - Held < STAGGER_TIMEOUT_NANOSECONDS)
+    {
+        return false;
+    }
+    return Segment->Lock.compare_exchange_strong(Held, Now);
+}
+
+void CullingStagger::Unlock()
+{
+    Segment->Lock.store(0);
+}
+
+bool CullingStagger::IsLive(const StaggerSlot& Other, uint64_t Now) const
+{
+    uint64_t Heartbeat = Other.Heartbeat.load(std::memory_order_relaxed);
+    return Other.Owner.load(std::memory_order_relaxed) != 0
+        && (Heartbeat >= Now || Now - Heartbeat < STAGGER_TIMEOUT_NANOSECONDS);
+}
+
+bool CullingStagger::IsOtherCulling(uint64_t Now) const
+{
+    for (int s = 0; s < STAGGER_MAX_INSTANCES; s++)
+    {
+        const StaggerSlot& Other = Segment->Slots[s];
+        if (s != Slot && Other.Culling.load() != 0 && IsLive(Other, Now))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<double> CullingStagger::GetPhaseLoads(uint64_t Now) const
+{
+    std::vector<double> Loads(CullingPeriod, 0.0);
+    for (int s = 0; s < STAGGER_MAX_INSTANCES; s++)
+    {
+        const StaggerSlot& Other = Segment->Slots[s];
+        if (s != Slot && IsLive(Other, Now))
+        {
+            uint32_t OtherPhase = Other.Phase.load(std::memory_order_relaxed);
+            if (OtherPhase < uint32_t(CullingPeriod))
+            {
+                Loads[OtherPhase] += double(Other.CullNanoseconds.load(std::memory_order_relaxed) + 1);
+            }
+        }
+    }
+    return Loads;
+}
+
+int CullingStagger::GetLeastLoadedPhase(const std::vector<double>& Loads, int Preferred) const
+{
+    int Best = Preferred;
+    for (int p = 0; p < CullingPeriod; p++)
+    {
+        if (Loads[p] < Loads[Best])
+        {
+            Best = p;
+        }
+    }
+    return Best;
+}
+
+int CullingStagger::Update(int TotalTicks)
+{
+    if (Segment == nullptr)
+    {
+        return std::max(LocalPhase, 0);
+    }
+    uint64_t Now = GetNowNanoseconds();
+    Segment->Slots[Slot].Heartbeat.store(Now, std::memory_order_relaxed);
+    // Offset of now from the middle of the claimed phase,
+    // between minus and plus half a period.
+    int64_t Offset = int64_t(
+        (Now % PeriodNanoseconds + PeriodNanoseconds
+            - Phase * TickNanoseconds - TickNanoseconds / 2)
+        % PeriodNanoseconds);
+    if (Offset > int64_t(PeriodNanoseconds / 2))
+    {
+        Offset -= int64_t(PeriodNanoseconds);
+    }
+    int TickPhase = TotalTicks % CullingPeriod;
+    int TicksLate = int(std::lround(double(Offset) / double(TickNanoseconds)));
+    if (LocalPhase < 0)
+    {
+        LocalPhase = Wrap(TickPhase - TicksLate, CullingPeriod);
+    }
+    // Ticks drift against the host's clock, so move the local phase once
+    // culls land more than a tick from the middle of the claimed phase.
+    // Within a tick, jitter would only make it flap.
+    else if (TickPhase == LocalPhase && std::abs(Offset) > int64_t(TickNanoseconds))
+    {
+        LocalPhase = Wrap(LocalPhase - TicksLate, CullingPeriod);
+    }
+    return LocalPhase;
+}
+
+void CullingStagger::BeginCull()
+{
+    if (Segment == nullptr)
+    {
+        return;
+    }
+    CullStart = GetNowNanoseconds();
+    Segment->Slots[Slot].Culling.store(1);
+    CullContended = IsOtherCulling(CullStart);
+}
+
+void CullingStagger::EndCull()
+{
+    if (Segment == nullptr)
+    {
+        return;
+    }
+    uint64_t Now = GetNowNanoseconds();
+    // Also catches instances that started culling during this cull.
+    if (CullContended || IsOtherCulling(Now))
+    {
+        ContendedCulls++;
+    }
+    StaggerSlot& Own = Segment->Slots[Slot];
+    Own.Culling.store(0);
+    double Nanoseconds = double(Now - CullStart);
+    CullNanoseconds = Culls == 0
+        ? Nanoseconds
+        : CullNanoseconds + (Nanoseconds - CullNanoseconds) * PHASE_COST_SMOOTHING;
+    Own.CullNanoseconds.store(uint64_t(CullNanoseconds), std::memory_order_relaxed);
+    Own.Heartbeat.store(Now, std::memory_order_relaxed);
+    Culls++;
+    // Offset by slot, so that instances do not all try to move at once.
+    if ((Culls + uint64_t(Slot)) % STAGGER_REBALANCE_CULLS != 0 || !TryLock(Now))
+    {
+        return;
+    }
+    std::vector<double> Loads = GetPhaseLoads(Now);
+    int Best = GetLeastLoadedPhase(Loads, Phase);
+    if (Loads[Best] + CullNanoseconds * STAGGER_HYSTERESIS < Loads[Phase])
+    {
+        LocalPhase = Wrap(LocalPhase + Best - Phase, CullingPeriod);
+        Phase = Best;
+        Own.Phase.store(uint32_t(Phase));
+        Moves++;
+    }
+    Unlock();
+}
+
+int CullingStagger::GetNumInstances() const
+{
+    if (Segment == nullptr)
+    {
+        return 0;
+    }
+    uint64_t Now = GetNowNanoseconds();
+    int Count = 1;
+    for (int s = 0; s < STAGGER_MAX_INSTANCES; s++)
+    {
+        if (s != Slot && IsLive(Segment->Slots[s], Now))
+        {
+            Count++;
+        }
+    }
+    return Count;
+}
+
+std::string CullingStagger::ToLogLine() const
+{
+    if (Segment == nullptr)
+    {
+        return "{}";
+    }
+    std::vector<double> Loads = GetPhaseLoads(GetNowNanoseconds());
+    char Buffer[320];
+    int Length = std::snprintf(
+        Buffer, sizeof(Buffer),
+        "{\"slot\":%d,\"phase\":%d,\"local_phase\":%d,\"instances\":%d,"
+        "\"culls\":%llu,\"contended\":%llu,\"contention\":%.4f,"
+        "\"cull_us\":%.2f,\"phase_load_us\":%.2f,\"moves\":%llu}",
+        Slot,
+        Phase,
+        LocalPhase,
+        GetNumInstances(),
+        (unsigned long long)Culls,
+        (unsigned long long)ContendedCulls,
+        Culls > 0 ? double(ContendedCulls) / Culls : 0.0,
+        CullNanoseconds / 1000.0,
+        Loads[Phase] / 1000.0,
+        (unsigned long long)Moves);
+    return std::string(Buffer, std::min(std::size_t(std::max(Length, 0)), sizeof(Buffer) - 1));
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "CullingSettings.h"
+#include "MappedFile.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Slot of one server instance in a stagger segment, on its own cache line.
+// Times are in nanoseconds of the host's steady clock.
+struct alignas(64) StaggerSlot
+{
+    // Process that claimed the slot, or zero if it is free.
+    std::atomic<uint32_t> Owner;
+    // Phase of the host's culling period that the instance culls in.
+    std::atomic<uint32_t> Phase;
+    // Whether the instance is culling right now.
+    std::atomic<uint32_t> Culling;
+    // Moving average of the instance's cull time.
+    std::atomic<uint64_t> CullNanoseconds;
+    // Time of the instance's last update. Slots not updated
+    // for STAGGER_TIMEOUT_MS belong to instances that are gone.
+    std::atomic<uint64_t> Heartbeat;
+};
+
+// Layout of a stagger segment. Fresh shared memory is zeroed,
+// which is an empty segment.
+struct StaggerSegment
+{
+    // Set to STAGGER_VERSION by the first instance to open the segment.
+    std::atomic<uint32_t> Version;
+    // Time at which an instance took the lock, or zero if it is free.
+    // Guards claims of slots and phases.
+    std::atomic<uint64_t> Lock;
+    StaggerSlot Slots[STAGGER_MAX_INSTANCES];
+};
+
+// Staggers the culls of server instances that share a host,
+// so that their culling spikes do not land on the same tick.
+// Instances open a segment of shared memory by name, claim a slot in it,
+// and cull in the phase of the culling period that other instances'
+// culls cost the least in. Every so often, an instance moves to a phase
+// that has become less loaded. Phases are measured on the host's steady
+// clock, which every process shares, so instances whose ticks start at
+// different times still agree on them. Nothing but the operating system
+// is needed to coordinate.
+// Instances sharing a segment must use the same tick rate and period,
+// so the period is part of the segment's name.
+// Only staggers the full culling schedule, as an amortized one culls every tick.
+class CullingStagger
+{
+    MappedFile Mapping;
+    StaggerSegment* Segment = nullptr;
+    // Index of this instance's slot.
+    int Slot = -1;
+    int CullingPeriod = 1;
+    uint64_t TickNanoseconds = 0;
+    uint64_t PeriodNanoseconds = 0;
+    // Claimed phase of the host's culling period.
+    int Phase = 0;
+    // Tick of this instance's culling period on which its culls land in Phase,
+    // or negative until the first update.
+    int LocalPhase = -1;
+    // Time at which the current cull started.
+    uint64_t CullStart = 0;
+    // Whether another instance was culling when the current cull started.
+    bool CullContended = false;
+    // Moving average of this instance's cull time.
+    double CullNanoseconds = 0;
+    uint64_t Culls = 0;
+    uint64_t ContendedCulls = 0;
+    uint64_t Moves = 0;
+
+    // Takes the segment's lock, or breaks it if its holder
+    // has held it for longer than STAGGER_TIMEOUT_MS.
+    bool TryLock(uint64_t Now);
+    void Unlock();
+    bool IsLive(const StaggerSlot& Other, uint64_t Now) const;
+    // Checks if a live instance other than this one is culling.
+    bool IsOtherCulling(uint64_t Now) const;
+    // Sums the cull time of live instances other than this one in each phase.
+    // Instances that have not culled yet count as a nanosecond,
+    // so that they are still spread out.
+    std::vector<double> GetPhaseLoads(uint64_t Now) const;
+    // Gets the least loaded phase, preferring Preferred on ties.
+    int GetLeastLoadedPhase(const std::vector<double>& Loads, int Preferred) const;
+
+public:
+    CullingStagger() {}
+    ~CullingStagger() { Close(); }
+    CullingStagger(const CullingStagger&) = delete;
+    CullingStagger& operator=(const CullingStagger&) = delete;
+
+    // Joins the stagger segment called Name, creating it if needed, and
+    // claims a slot and the least loaded phase. Returns false if the
+    // segment cannot be mapped or has no free slot.
+    bool Open(const char* Name, int Period);
+    // Frees the slot and unmaps the segment.
+    void Close();
+    bool IsOpen() const { return Segment != nullptr; }
+
+    // Call at the start of every tick, after CullingCore::StartTick.
+    // Returns the tick of this instance's culling period on which to cull,
+    // for CullingCore::SetCullingPhase, so that its culls land in the
+    // claimed phase of the host's period.
+    int Update(int TotalTicks);
+    // Call around each cull, to measure its cost and contention.
+    void BeginCull();
+    void EndCull();
+
+    int GetPhase() const { return Phase; }
+    // Gets the number of live instances sharing the segment, including this one.
+    int GetNumInstances() const;
+    uint64_t GetCulls() const { return Culls; }
+    // Gets the culls that overlapped with another instance's cull.
+    uint64_t GetContendedCulls() const { return ContendedCulls; }
+    // Formats the claimed phase and observed contention as a single-line
+    // JSON object for log scraping.
+    std::string ToLogLine() const;
+};
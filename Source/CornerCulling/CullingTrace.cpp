@@ -0,0 +1,193 @@
+#include "CullingTrace.h"
+#include <cstring>
+
+bool TraceWriter::Open(const char* Path, const CullingCore& Core)
+{
+    Close();
+    File = std::fopen(Path, "wb");
+    if (File == nullptr)
+    {
+        return false;
+    }
+    std::memset(&Header, 0, sizeof(Header));
+    std::memcpy(Header.Magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    Header.Version = TRACE_VERSION;
+    Header.NumCharacters = uint32_t(Core.GetNumCharacters());
+    Header.NumCuboids = uint32_t(Core.GetCuboids().size());
+    Header.NumSpheres = uint32_t(Core.GetSpheres().size());
+    // NumTicks is patched in when the trace is closed.
+    std::fwrite(&Header, sizeof(Header), 1, File);
+    for (const CuboidVertices& C : Core.GetCuboidVertices())
+    {
+        TraceCuboid Record;
+        for (int i = 0; i < CUBOID_V; i++)
+        {
+            Record.Vertices[i][0] = C.Vertices[i].X;
+            Record.Vertices[i][1] = C.Vertices[i].Y;
+            Record.Vertices[i][2] = C.Vertices[i].Z;
+        }
+        std::fwrite(&Record, sizeof(Record), 1, File);
+    }
+    for (const Sphere& S : Core.GetSpheres())
+    {
+        TraceSphere Record = { { S.Center.X, S.Center.Y, S.Center.Z }, S.Radius };
+        std::fwrite(&Record, sizeof(Record), 1, File);
+    }
+    TickCharacters.assign(Header.NumCharacters, TraceCharacter());
+    std::memset(TickCharacters.data(), 0, TickCharacters.size() * sizeof(TraceCharacter));
+    return true;
+}
+
+void TraceWriter::Close()
+{
+    if (File == nullptr)
+    {
+        return;
+    }
+    std::fseek(File, 0, SEEK_SET);
+    std::fwrite(&Header, sizeof(Header), 1, File);
+    std::fclose(File);
+    File = nullptr;
+}
+
+void TraceWriter::SetCharacter(
+    int i,
+    const Vec3& CameraLocation,
+    const RigidTransform& Transform,
+    char Team,
+    bool Alive)
+{
+    if (File == nullptr)
+    {
+        return;
+    }
+    TraceCharacter& Record = TickCharacters[i];
+    Record.CameraLocation[0] = CameraLocation.X;
+    Record.CameraLocation[1] = CameraLocation.Y;
+    Record.CameraLocation[2] = CameraLocation.Z;
+    Record.Rotation[0] = Transform.Rotation.X;
+    Record.Rotation[1] = Transform.Rotation.Y;
+    Record.Rotation[2] = Transform.Rotation.Z;
+    Record.Rotation[3] = Transform.Rotation.W;
+    Record.Translation[0] = Transform.Translation.X;
+    Record.Translation[1] = Transform.Translation.Y;
+    Record.Translation[2] = Transform.Translation.Z;
+    Record.Team = uint8_t(Team);
+    Record.Alive = Alive ? 1 : 0;
+}
+
+void TraceWriter::EndTick(const VisibilityHash& Hash)
+{
+    if (File == nullptr)
+    {
+        return;
+    }
+    TraceTick Tick = { Hash.Value };
+    std::fwrite(&Tick, sizeof(Tick), 1, File);
+    std::fwrite(
+        TickCharacters.data(),
+        sizeof(TraceCharacter),
+        TickCharacters.size(),
+        File);
+    Header.NumTicks++;
+}
+
+bool TraceReader::Open(const char* Path)
+{
+    Header = nullptr;
+    if (!File.Open(Path) || File.GetSize() < sizeof(TraceHeader))
+    {
+        return false;
+    }
+    const unsigned char* Data = File.GetData();
+    const TraceHeader* H = reinterpret_cast<const TraceHeader*>(Data);
+    if (std::memcmp(H->Magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+        || H->Version != TRACE_VERSION
+        || H->NumCharacters > MAX_CHARACTERS)
+    {
+        return false;
+    }
+    std::size_t CuboidsOffset = sizeof(TraceHeader);
+    std::size_t SpheresOffset = CuboidsOffset + H->NumCuboids * sizeof(TraceCuboid);
+    std::size_t TicksOffset = SpheresOffset + H->NumSpheres * sizeof(TraceSphere);
+    TickSize = sizeof(TraceTick) + H->NumCharacters * sizeof(TraceCharacter);
+    // Reject truncated traces.
+    if (File.GetSize() < TicksOffset + H->NumTicks * TickSize)
+    {
+        return false;
+    }
+    Header = H;
+    Cuboids = reinterpret_cast<const TraceCuboid*>(Data + CuboidsOffset);
+    Spheres = reinterpret_cast<const TraceSphere*>(Data + SpheresOffset);
+    Ticks = Data + TicksOffset;
+    return true;
+}
+
+void TraceReader::Load(CullingCore& Core) const
+{
+    LoadCharacters(Core);
+    AddOccluders(Core);
+    Core.BuildOccluders();
+}
+
+void TraceReader::AddOccluders(CullingCore& Core) const
+{
+    std::vector<Vec3> Vertices(CUBOID_V);
+    for (int c = 0; c < GetNumCuboids(); c++)
+    {
+        for (int i = 0; i < CUBOID_V; i++)
+        {
+            Vertices[i] = Vec3(
+                Cuboids[c].Vertices[i][0],
+                Cuboids[c].Vertices[i][1],
+                Cuboids[c].Vertices[i][2]);
+        }
+        Core.AddCuboid(CuboidVertices(Vertices));
+    }
+    for (int s = 0; s < GetNumSpheres(); s++)
+    {
+        const TraceSphere& S = Spheres[s];
+        Core.AddSphere(Sphere(Vec3(S.Center[0], S.Center[1], S.Center[2]), S.Radius));
+    }
+}
+
+void TraceReader::LoadCharacters(CullingCore& Core) const
+{
+    for (int i = 0; i < GetNumCharacters(); i++)
+    {
+        char Team = 0;
+        if (GetNumTicks() > 0)
+        {
+            const TraceCharacter* Characters =
+                reinterpret_cast<const TraceCharacter*>(Ticks + sizeof(TraceTick));
+            Team = char(Characters[i].Team);
+        }
+        Core.AddCharacter(Team);
+    }
+}
+
+void TraceReader::ApplyTick(int Tick, CullingCore& Core) const
+{
+    const TraceCharacter* Characters = reinterpret_cast<const TraceCharacter*>(
+        Ticks + Tick * TickSize + sizeof(TraceTick));
+    for (int i = 0; i < GetNumCharacters(); i++)
+    {
+        const TraceCharacter& C = Characters[i];
+        Core.SetTeam(i, char(C.Team));
+        Core.SetAlive(i, C.Alive != 0);
+        Core.SetCharacterState(
+            i,
+            Vec3(C.CameraLocation[0], C.CameraLocation[1], C.CameraLocation[2]),
+            RigidTransform(
+                Quat(C.Rotation[0], C.Rotation[1], C.Rotation[2], C.Rotation[3]),
+                Vec3(C.Translation[0], C.Translation[1], C.Translation[2])));
+    }
+}
+
+uint64_t TraceReader::GetVisibilityHash(int Tick) const
+{
+    // Tick blocks are only 4-byte aligned, so copy rather than cast.
+    uint64_t Hash;
+    std::memcpy(&Hash, Ticks + Tick * TickSize, sizeof(Hash));
+    return Hash;
+}
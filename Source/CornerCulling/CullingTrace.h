@@ -0,0 +1,158 @@
+#pragma once
+
+#include "CullingCore.h"
+#include "MappedFile.h"
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Binary traces of culling inputs, for reproducible benchmarks.
+//
+// A trace stores the occluders of a map and, for every server tick,
+// the inputs that the culling core consumes for each character.
+// Replaying a trace through the same build reproduces culling results
+// bit-for-bit, which is checked with a per-tick hash of revealed pairs.
+//
+// File layout, in native (little-endian) byte order:
+//   TraceHeader
+//   TraceCuboid[NumCuboids]
+//   TraceSphere[NumSpheres]
+//   NumTicks blocks of:
+//     TraceTick
+//     TraceCharacter[NumCharacters]
+// Every block has a fixed size, so any tick can be read in place
+// from a memory mapping of the file.
+//
+// NOTE:
+//   Occluders are recorded once, where they start, so replays of maps
+//   with moving cuboids do not reproduce their movement.
+//   Traces do not store the culling schedule, and replays use the full
+//   schedule. The amortized schedule also balances pairs by measured time,
+//   so it cannot be replayed exactly, and controllers with it do not record.
+
+// Version of the trace format. Bump on any layout change.
+constexpr uint32_t TRACE_VERSION = 1;
+// Magic bytes at the start of every trace.
+constexpr char TRACE_MAGIC[8] = { 'C', 'C', 'T', 'R', 'A', 'C', 'E', 0 };
+
+struct TraceHeader
+{
+    char Magic[8];
+    uint32_t Version;
+    uint32_t NumCharacters;
+    uint32_t NumCuboids;
+    uint32_t NumSpheres;
+    uint32_t NumTicks;
+    uint32_t Reserved;
+};
+
+struct TraceCuboid
+{
+    float Vertices[CUBOID_V][3];
+};
+
+struct TraceSphere
+{
+    float Center[3];
+    float Radius;
+};
+
+struct TraceTick
+{
+    // Hash of all pairs revealed on this tick, see VisibilityHash.
+    uint64_t VisibilityHash;
+};
+
+// Inputs that the culling core consumes for one character on one tick.
+struct TraceCharacter
+{
+    float CameraLocation[3];
+    float Rotation[4];
+    float Translation[3];
+    uint8_t Team;
+    uint8_t Alive;
+    uint8_t Padding[2];
+};
+
+static_assert(sizeof(TraceHeader) == 32, "Trace layout changed.");
+static_assert(sizeof(TraceCuboid) == 96, "Trace layout changed.");
+static_assert(sizeof(TraceSphere) == 16, "Trace layout changed.");
+static_assert(sizeof(TraceTick) == 8, "Trace layout changed.");
+static_assert(sizeof(TraceCharacter) == 44, "Trace layout changed.");
+
+// FNV-1a hash of the (player, enemy) pairs revealed on a tick.
+struct VisibilityHash
+{
+    uint64_t Value = 14695981039346656037ull;
+    void Add(int i, int j)
+    {
+        Value = (Value ^ uint64_t(i)) * 1099511628211ull;
+        Value = (Value ^ uint64_t(j)) * 1099511628211ull;
+    }
+};
+
+// Records a trace while a game is running.
+class TraceWriter
+{
+    std::FILE* File = nullptr;
+    TraceHeader Header;
+    // Characters of the tick being recorded.
+    std::vector<TraceCharacter> TickCharacters;
+
+public:
+    TraceWriter() {}
+    ~TraceWriter() { Close(); }
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // Creates a trace at Path, writing the characters and occluders
+    // that have been added to Core.
+    // Call before Core.BuildOccluders, which reorders the cuboids.
+    bool Open(const char* Path, const CullingCore& Core);
+    // Writes the number of recorded ticks and closes the file.
+    void Close();
+    bool IsOpen() const { return File != nullptr; }
+
+    // Records the inputs of character i for the current tick.
+    void SetCharacter(
+        int i,
+        const Vec3& CameraLocation,
+        const RigidTransform& Transform,
+        char Team,
+        bool Alive);
+    // Writes the current tick along with the hash of its revealed pairs.
+    void EndTick(const VisibilityHash& Hash);
+};
+
+// Reads a trace in place from a read-only memory mapping.
+class TraceReader
+{
+    MappedFile File;
+    const TraceHeader* Header = nullptr;
+    const TraceCuboid* Cuboids = nullptr;
+    const TraceSphere* Spheres = nullptr;
+    const unsigned char* Ticks = nullptr;
+    std::size_t TickSize = 0;
+
+public:
+    // Maps and validates the trace at Path.
+    bool Open(const char* Path);
+
+    int GetNumCharacters() const { return int(Header->NumCharacters); }
+    int GetNumTicks() const { return int(Header->NumTicks); }
+    int GetNumCuboids() const { return int(Header->NumCuboids); }
+    int GetNumSpheres() const { return int(Header->NumSpheres); }
+
+    // Adds the traced characters and occluders to an empty Core,
+    // then builds its occluder structures.
+    void Load(CullingCore& Core) const;
+    // Adds only the traced characters to an empty Core,
+    // for replaying with occluders loaded from elsewhere.
+    void LoadCharacters(CullingCore& Core) const;
+    // Adds the traced occluders to Core without building their structures.
+    void AddOccluders(CullingCore& Core) const;
+    // Feeds the inputs of a tick into Core.
+    void ApplyTick(int Tick, CullingCore& Core) const;
+    // Gets the hash of the pairs revealed when the tick was recorded.
+    uint64_t GetVisibilityHash(int Tick) const;
+};
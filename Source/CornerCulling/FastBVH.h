@@ -3,25 +3,29 @@
 #include "FastBVH/BVH.h"
 #include "FastBVH/BuildStrategy.h"
 #include "FastBVH/BuildStrategy1.h"
+#include "FastBVH/BuildStrategy2.h"
+#include "FastBVH/BuildStrategy3.h"
 #include "FastBVH/Config.h"
 #include "FastBVH/Intersection.h"
 #include "FastBVH/Iterable.h"
+#include "FastBVH/Quality.h"
 #include "FastBVH/Ray.h"
+#include "FastBVH/Refitter.h"
 #include "FastBVH/Traverser.h"
 #include "FastBVH/Vector3.h"
+#include "FastBVH/WideBVH.h"
+#include "FastBVH/WideTraverser.h"
 #include "GeometricPrimitives.h"
 
-// Cuboid BVH API.
-namespace
+// Cuboid and sphere BVH API.
+namespace FastBVH
 {
-    using std::vector;
-    using namespace FastBVH;
-
-    // Used to calculate the axis-aligned bounding boxes of cuboids.
+    // Used to calculate the axis-aligned bounding boxes of cuboids
+    // from their vertices.
     class CuboidBoxConverter final
     {
         public:
-            BBox<float> operator()(const Cuboid& C) const noexcept
+            BBox<float> operator()(const CuboidVertices& C) const noexcept
             {
                 float MinX = std::numeric_limits<float>::infinity();
                 float MinY = std::numeric_limits<float>::infinity();
@@ -44,23 +48,97 @@ namespace
             }
     };
     
+    // Builds a BVH over cuboids, bounding them by their vertices,
+    // and moves both into leaf order. Returns the nodes of the BVH.
+    template <typename Strategy>
+    NodeArray<float> BuildCuboidNodes(
+        Strategy& Builder,
+        std::vector<Cuboid>& Cuboids,
+        std::vector<CuboidVertices>& Vertices)
+    {
+        // Build over indices, which the builder moves into leaf order,
+        // then move the cuboids and vertices after them.
+        std::vector<uint32_t> Order(Cuboids.size());
+        for (uint32_t i = 0; i < uint32_t(Order.size()); i++)
+        {
+            Order[i] = i;
+        }
+        auto Converter = [&Vertices](uint32_t i)
+        {
+            return CuboidBoxConverter()(Vertices[i]);
+        };
+        const auto Tree = Builder(Order, Converter);
+        const auto TreeNodes = Tree.getNodes();
+        NodeArray<float> Nodes(TreeNodes.begin(), TreeNodes.end());
+        std::vector<Cuboid> OldCuboids(Cuboids);
+        std::vector<CuboidVertices> OldVertices(Vertices);
+        for (std::size_t i = 0; i < Order.size(); i++)
+        {
+            Cuboids[i] = OldCuboids[Order[i]];
+            Vertices[i] = OldVertices[Order[i]];
+        }
+        return Nodes;
+    }
+
     // Used to calculate the intersection between rays and cuboids.
     class CuboidIntersector final 
     {
         public:
-            Intersection<float> operator()(
+            Intersection<float, Cuboid> operator()(
                 const Cuboid& C,
                 const OptSegment& Segment) const noexcept
             {
                 float Time = IntersectionTime(&C, Segment.Start, Segment.Delta);
                 if (Time > 0)
                 {
-                    return Intersection<float> { Time, &C };
+                    return Intersection<float, Cuboid> { Time, &C };
                 }
                 else
                 {
-                    return Intersection<float> {};
+                    return Intersection<float, Cuboid> {};
+                }
+            }
+    };
+
+    // Used to calculate the axis-aligned bounding boxes of spheres.
+    class SphereBoxConverter final
+    {
+        public:
+            BBox<float> operator()(const Sphere& S) const noexcept
+            {
+                auto MinVector = Vector3<float>{
+                    S.Center.X - S.Radius, S.Center.Y - S.Radius, S.Center.Z - S.Radius};
+                auto MaxVector = Vector3<float>{
+                    S.Center.X + S.Radius, S.Center.Y + S.Radius, S.Center.Z + S.Radius};
+                return BBox<float>(MinVector, MaxVector);
+            }
+    };
+
+    // Used to calculate the intersection between rays and spheres.
+    // The time of a hit is that of the segment's closest approach
+    // to the center, which is enough to tell if the sphere may block.
+    class SphereIntersector final
+    {
+        public:
+            Intersection<float, Sphere> operator()(
+                const Sphere& S,
+                const OptSegment& Segment) const noexcept
+            {
+                Vec3 StartToCenter = S.Center - Segment.Start;
+                float Time = (Segment.Delta | StartToCenter) / (Segment.Delta | Segment.Delta);
+                Time = std::min(std::max(Time, 0.f), 1.f);
+                Vec3 Closest = Segment.Start + Time * Segment.Delta;
+                if ((S.Center - Closest).SizeSquared() <= S.Radius * S.Radius)
+                {
+                    return Intersection<float, Sphere> { Time, &S };
+                }
+                else
+                {
+                    return Intersection<float, Sphere> {};
                 }
             }
     };
 }
+
+// The culling code uses the BVH API unqualified.
+using namespace FastBVH;
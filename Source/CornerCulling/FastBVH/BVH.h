@@ -50,20 +50,43 @@ class BVH final {
   //! of the BVH, using iteration.
   NodeArray<Float> nodes;
 
-  //! The primitives from which this BVH was built.
-  std::vector<const Primitive*> primitives;
+  //! A view of the primitives from which this BVH was built.
+  //! Build strategies reorder the primitives in place into leaf order,
+  //! so the primitives of a leaf are adjacent in memory.
+  //! The BVH does not own them: the array must outlive the BVH,
+  //! and must not be reordered or reallocated while the BVH is in use.
+  ConstIterable<Primitive> primitives;
+
+  //! The depth of the deepest leaf, where the root has a depth of zero.
+  //! After @ref replaceSubtree, this may exceed the depth of the tree.
+  uint32_t depth = 0;
+
+  //! Raises the depth to that of the deepest leaf in a subtree.
+  //! \param root The index of the subtree's root.
+  //! \param end The end of the subtree.
+  //! \param root_depth The depth of the subtree's root.
+  void measureDepth(uint32_t root, uint32_t end, uint32_t root_depth) {
+    // The flat tree is in preorder, so each node's depth is known before its children.
+    std::vector<uint32_t> depths(end - root, root_depth);
+    for (uint32_t n = root; n < end; n++) {
+      const uint32_t i = n - root;
+      if (!nodes[n].isLeaf()) {
+        depths[i + 1] = depths[i] + 1;
+        depths[i + nodes[n].right_offset] = depths[i] + 1;
+      } else if (depths[i] > depth) {
+        depth = depths[i];
+      }
+    }
+  }
 
  public:
   //! Constructs a new BVH instance.
   //! This constructor is ideally called internally
   //! from a @ref BuildStrategy.
   //! \param n The nodes to assign to the BVH.
-  BVH(NodeArray<Float>&& n, const ConstIterable<Primitive>& p) : nodes(std::move(n))
-  {
-      for (int i = 0; i < p.size(); i++)
-      {
-          primitives.emplace_back(&p[i]);
-      }
+  //! \param p The primitives, in leaf order.
+  BVH(NodeArray<Float>&& n, const ConstIterable<Primitive>& p) : nodes(std::move(n)), primitives(p) {
+    measureDepth(0, (uint32_t)nodes.size(), 0);
   }
 
   //! Counts the number of leafs in the BVH.
@@ -83,9 +106,64 @@ class BVH final {
   //! \return A read-only iterable container of nodes.
   inline auto getNodes() const noexcept { return ConstIterable<Node<Float>>(nodes.data(), nodes.size()); }
 
-  //! Accesses an iterable container to the primitives in the BVH.
-  //! \return An iterable container of the primitive array.
-  inline std::vector<const Primitive *> getPrimitives() const noexcept { return primitives; }
+  //! Accesses the primitives in the BVH, in leaf order.
+  //! Node::start indexes into this array.
+  //! \return A read-only iterable container of the primitive array.
+  inline auto getPrimitives() const noexcept { return primitives; }
+
+  //! Gets the depth of the deepest leaf, where the root has a depth of zero,
+  //! or more after subtrees were replaced.
+  //! Traversers check it to size their working set.
+  inline uint32_t getDepth() const noexcept { return depth; }
+
+  //! Finds the end of the subtree rooted at a node.
+  //! The flat tree is in preorder, so the subtree is a contiguous range of nodes.
+  //! \param index The index of the subtree's root.
+  //! \return The index one past the last node of the subtree.
+  uint32_t getSubtreeEnd(uint32_t index) const noexcept {
+    while (!nodes[index].isLeaf()) {
+      index += nodes[index].right_offset;
+    }
+    return index + 1;
+  }
+
+  //! Sets the bounding box of a node, for refitting it after its primitives move.
+  //! \param index The index of the node.
+  //! \param bbox The new bounding box, which must contain the node's primitives.
+  void setBox(uint32_t index, const BBox<Float>& bbox) noexcept { nodes[index].bbox = bbox; }
+
+  //! Replaces the subtree rooted at a node with another subtree
+  //! over the same range of primitives, such as a rebuild of it.
+  //! \param index The index of the subtree's root.
+  //! \param subtree The nodes of the new subtree in preorder,
+  //! with starts indexing the whole primitive array.
+  void replaceSubtree(uint32_t index, const ConstIterable<Node<Float>>& subtree) {
+    const uint32_t end = getSubtreeEnd(index);
+    const int64_t delta = int64_t(subtree.size()) - int64_t(end - index);
+
+    // Ancestors with the subtree on their left shift their right child.
+    uint32_t n = 0;
+    uint32_t index_depth = 0;
+    while (n != index) {
+      index_depth++;
+      if (index < n + nodes[n].right_offset) {
+        nodes[n].right_offset = uint32_t(nodes[n].right_offset + delta);
+        n = n + 1;
+      } else {
+        n = n + nodes[n].right_offset;
+      }
+    }
+
+    if (delta > 0) {
+      nodes.insert(nodes.begin() + end, std::size_t(delta), Node<Float>());
+    } else if (delta < 0) {
+      nodes.erase(nodes.begin() + index, nodes.begin() + index + std::size_t(-delta));
+    }
+    for (uint32_t i = 0; i < subtree.size(); i++) {
+      nodes[index + i] = subtree[i];
+    }
+    measureDepth(index, index + (uint32_t)subtree.size(), index_depth);
+  }
 
  protected:
   //! Build the BVH tree out of build_prims
@@ -90,6 +90,98 @@ class BuildStrategy<Float, 1> final {
 #endif
 };
 
+//! This is the second variant build strategy.
+//! It is a multithreaded builder that splits nodes
+//! with a binned Surface Area Heuristic (SAH).
+//! Each node is split where the expected cost of a query,
+//! estimated from the surface areas of the children, is lowest,
+//! or is made a leaf if that is cheaper than any split.
+template <typename Float>
+class BuildStrategy<Float, 2> final {
+ public:
+  //! Nodes with at most this many primitives are always leaves.
+  uint32_t leaf_size = 4;
+
+  //! The largest leaf that the heuristic may choose over a split.
+  uint32_t max_leaf_size = 8;
+
+  //! The cost of visiting a node, relative to intersection_cost.
+  Float traversal_cost = 1;
+
+  //! The cost of testing a primitive, relative to traversal_cost.
+  Float intersection_cost = 1;
+
+  //! The number of bins along each axis that split candidates are taken from.
+  uint32_t bin_count = 16;
+
+  //! Nodes deeper than this are split at the median instead,
+  //! keeping the tree shallow enough for the traverser's working set.
+  uint32_t max_depth = 40;
+
+  //! The number of threads to build with, where zero uses every hardware thread.
+  //! The tree does not depend on the number of threads.
+  uint32_t thread_count = 0;
+
+  //! Constructs a builder with the default parameters.
+  constexpr BuildStrategy() noexcept {}
+
+  //! Constructs a builder with a given leaf size and cost ratio.
+  constexpr BuildStrategy(uint32_t leaf_size_, Float traversal_cost_, Float intersection_cost_) noexcept
+      : leaf_size(leaf_size_),
+        max_leaf_size(2 * leaf_size_),
+        traversal_cost(traversal_cost_),
+        intersection_cost(intersection_cost_) {}
+
+  //! Builds a BVH with the Surface Area Heuristic.
+  //! Reorders the primitives in place into leaf order.
+  template <typename Primitive, typename BoxConverter>
+  BVH<Float, Primitive> operator()(Iterable<Primitive> primitives, BoxConverter converter);
+
+#ifndef FASTBVH_NO_STL
+  //! This is a function that takes a STL vector of primitives,
+  //! instead of the @ref Iterable container.
+  template <typename Primitive, typename BoxConverter>
+  BVH<Float, Primitive> operator()(std::vector<Primitive>& primitives, BoxConverter converter) {
+    Iterable<Primitive> iterable(primitives.data(), primitives.size());
+
+    return (*this)(iterable, converter);
+  }
+#endif
+};
+
+//! This is the third variant build strategy.
+//! It is a linear BVH (LBVH) builder, for trees rebuilt every few ticks.
+//! Primitives are sorted by the Morton codes of their centers
+//! with a multithreaded radix sort, and each node is split where
+//! the highest differing bit of its codes flips.
+//! Builds much faster than the SAH builder, but traversals visit more nodes.
+template <typename Float>
+class BuildStrategy<Float, 3> final {
+ public:
+  //! Nodes with at most this many primitives are leaves.
+  uint32_t leaf_size = 4;
+
+  //! The number of threads to build with, where zero uses every hardware thread.
+  //! Small builds use fewer threads, and the tree does not depend on the number of threads.
+  uint32_t thread_count = 0;
+
+  //! Builds a linear BVH.
+  //! Reorders the primitives in place into leaf order.
+  template <typename Primitive, typename BoxConverter>
+  BVH<Float, Primitive> operator()(Iterable<Primitive> primitives, BoxConverter converter);
+
+#ifndef FASTBVH_NO_STL
+  //! This is a function that takes a STL vector of primitives,
+  //! instead of the @ref Iterable container.
+  template <typename Primitive, typename BoxConverter>
+  BVH<Float, Primitive> operator()(std::vector<Primitive>& primitives, BoxConverter converter) {
+    Iterable<Primitive> iterable(primitives.data(), primitives.size());
+
+    return (*this)(iterable, converter);
+  }
+#endif
+};
+
 //! This is the type definition for the default build strategy.
 //! The default is the original algorithm used for BVH construction.
 template <typename Float>
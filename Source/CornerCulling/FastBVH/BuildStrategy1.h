@@ -1,5 +1,7 @@
 #include "FastBVH/BuildStrategy.h"
 
+#include <vector>
+
 namespace FastBVH {
 
 //! \brief Contains details on the implementation
@@ -22,33 +24,35 @@ struct BuildEntry final {
 //! \brief Used while constructing the BVH
 //! to queue nodes to be built.
 class BuildStack final {
-  //! The maximum number of entries in the stack.
-  static constexpr std::size_t max_size = 128;
-
-  //! The entry array of the stack.
-  BuildEntry entries[max_size];
+  //! The number of entries reserved up front,
+  //! which covers trees 128 levels deep without growing.
+  static constexpr std::size_t reserved_size = 128;
 
-  //! The index of the current entry, plus one.
-  //! A value of zero indicates an empty stack.
-  std::size_t stack_ptr = 0;
+  //! The entries of the stack, which grow if a bad split
+  //! makes the tree deeper than the reserved size.
+  std::vector<BuildEntry> entries;
 
  public:
+  //! Constructs an empty stack.
+  BuildStack() { entries.reserve(reserved_size); }
+
   //! Pops the top entry from the stack.
   //! This function does not check if the
   //! stack is empty.
-  auto pop() noexcept { return entries[--stack_ptr]; }
+  auto pop() noexcept {
+    const BuildEntry entry = entries.back();
+    entries.pop_back();
+    return entry;
+  }
 
   //! Pushes an entry to the stack.
   //! \param entry The entry to be pushed.
-  void push(const BuildEntry& entry) noexcept {
-    entries[stack_ptr] = entry;
-    stack_ptr++;
-  }
+  void push(const BuildEntry& entry) { entries.push_back(entry); }
 
   //! Indicates the size of the stack.
   //! \return The number of entries in the stack.
   //! A value of zero indicates the stack is empty.
-  auto size() const noexcept { return stack_ptr; }
+  auto size() const noexcept { return entries.size(); }
 
   //! Accesses an entry from the stack, by index.
   //! \param index The index of the entry to get.
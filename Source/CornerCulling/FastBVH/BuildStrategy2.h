@@ -0,0 +1,420 @@
+#pragma once
+
+#include "FastBVH/BuildStrategy.h"
+
+#include <algorithm>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <thread>
+
+namespace FastBVH {
+
+//! \brief Contains details on the implementation
+//! of the variant-2 BVH build strategy.
+namespace Strategy2 {
+
+//! \brief Contains the context used while building
+//! a specific node in the BVH.
+struct BuildEntry final {
+  //! If not @ref no_parent, then this is the index of the parent,
+  //! whose right offset this node sets if it is the right child.
+  uint32_t parent;
+
+  //! The starting index of the range of primitives in this node.
+  uint32_t start;
+
+  //! The ending index of the range of primitives in this node.
+  uint32_t end;
+
+  //! The depth of this node, where the root has a depth of zero.
+  uint32_t depth;
+
+  //! Indicates the parent index of the root.
+  static constexpr uint32_t no_parent = 0xffffffff;
+};
+
+//! \brief Accumulates the primitives whose centers fall into one bin.
+template <typename Float>
+struct Bin final {
+  //! The bounds of the primitives in the bin.
+  //! Only valid if count is not zero.
+  BBox<Float> bbox;
+
+  //! The number of primitives in the bin.
+  uint32_t count = 0;
+
+  //! Adds a primitive to the bin.
+  void add(const BBox<Float>& box) noexcept {
+    if (count == 0) {
+      bbox = box;
+    } else {
+      bbox.expandToInclude(box);
+    }
+    count++;
+  }
+};
+
+//! \brief A candidate split of a node.
+template <typename Float>
+struct Split final {
+  //! The expected cost of the node if split here.
+  Float cost = std::numeric_limits<Float>::infinity();
+
+  //! The axis that bins were taken along.
+  uint32_t axis = 0;
+
+  //! Primitives in bins up to and including this one go to the left child.
+  uint32_t bin = 0;
+
+  //! Indicates whether a split was found.
+  bool isValid() const noexcept { return cost < std::numeric_limits<Float>::infinity(); }
+};
+
+//! \brief Contains the data shared by every node of a build.
+template <typename Float>
+struct BuildContext final {
+  //! The parameters of the build.
+  const BuildStrategy<Float, 2>& settings;
+
+  //! The bounding box of each primitive.
+  std::vector<BBox<Float>> boxes;
+
+  //! The center of each primitive's bounding box.
+  std::vector<Vector3<Float>> centers;
+
+  //! The primitive indices, partitioned into leaf order as nodes are built.
+  //! Concurrent subtrees only touch their own ranges of it.
+  std::vector<uint32_t> order;
+
+  //! The number of bins along each axis.
+  uint32_t bins;
+
+  //! Constructs a context with the parameters of a build.
+  explicit BuildContext(const BuildStrategy<Float, 2>& settings_)
+      : settings(settings_), bins(std::max(settings_.bin_count, 2u)) {}
+};
+
+//! \brief Contains the bins of one thread of a build,
+//! so that nodes do not allocate them.
+template <typename Float>
+struct BinScratch final {
+  //! The bins of the axis being evaluated.
+  std::vector<Bin<Float>> bins;
+
+  //! The surface area of everything right of each bin.
+  std::vector<Float> right_areas;
+
+  //! The number of primitives right of each bin.
+  std::vector<uint32_t> right_counts;
+
+  //! Constructs bins for a given bin count.
+  explicit BinScratch(uint32_t count) : bins(count), right_areas(count), right_counts(count) {}
+};
+
+//! Builds a node over a range of the context's order,
+//! and partitions the range if the node is split.
+//! \param context The shared data of the build.
+//! \param scratch The bins of the calling thread.
+//! \param start The starting index of the node's range.
+//! \param end The ending index of the node's range.
+//! \param depth The depth of the node.
+//! \param node Receives the node, as a leaf.
+//! \return The index at which the range was split,
+//! or the start index if the node is a leaf.
+template <typename Float>
+uint32_t splitNode(BuildContext<Float>& context,
+                   BinScratch<Float>& scratch,
+                   uint32_t start,
+                   uint32_t end,
+                   uint32_t depth,
+                   Node<Float>& node) {
+  const auto& settings = context.settings;
+  const auto& boxes = context.boxes;
+  const auto& centers = context.centers;
+  auto& order = context.order;
+  const uint32_t bins = context.bins;
+  const uint32_t count = end - start;
+
+  // Calculate the bounding box for this node and its centers.
+  BBox<Float> bb = boxes[order[start]];
+  BBox<Float> bc(centers[order[start]]);
+  for (uint32_t i = start + 1; i < end; ++i) {
+    bb.expandToInclude(boxes[order[i]]);
+    bc.expandToInclude(centers[order[i]]);
+  }
+
+  node.bbox = bb;
+  node.start = start;
+  node.primitive_count = count;
+  node.right_offset = 0;
+
+  if (count <= settings.leaf_size) {
+    return start;
+  }
+
+  // Find the cheapest split over the bins of each axis.
+  // The cost of a split is the traversal cost of this node, plus the cost
+  // of intersecting the primitives of each child, weighted by the chance
+  // that a segment hitting this node hits the child.
+  const Float area = bb.surfaceArea();
+  const Float inverse_area = area > 0 ? Float(1) / area : Float(1);
+  Split<Float> best;
+  for (uint32_t axis = 0; axis < 3; ++axis) {
+    const Float extent = bc.extent[axis];
+    if (!(extent > 0)) {
+      continue;
+    }
+    const Float scale = Float(bins) / extent;
+    for (auto& bin : scratch.bins) {
+      bin.count = 0;
+    }
+    for (uint32_t i = start; i < end; ++i) {
+      const uint32_t p = order[i];
+      uint32_t b = (uint32_t)((centers[p][axis] - bc.min[axis]) * scale);
+      scratch.bins[std::min(b, bins - 1)].add(boxes[p]);
+    }
+
+    // Sweep from the right to find the bounds of each right side.
+    BBox<Float> right_box;
+    uint32_t right_count = 0;
+    for (uint32_t b = bins - 1; b > 0; --b) {
+      if (scratch.bins[b].count > 0) {
+        if (right_count == 0) {
+          right_box = scratch.bins[b].bbox;
+        } else {
+          right_box.expandToInclude(scratch.bins[b].bbox);
+        }
+        right_count += scratch.bins[b].count;
+      }
+      scratch.right_areas[b - 1] = right_count > 0 ? right_box.surfaceArea() : Float(0);
+      scratch.right_counts[b - 1] = right_count;
+    }
+
+    // Sweep from the left, evaluating the split after each bin.
+    BBox<Float> left_box;
+    uint32_t left_count = 0;
+    for (uint32_t b = 0; b + 1 < bins; ++b) {
+      if (scratch.bins[b].count > 0) {
+        if (left_count == 0) {
+          left_box = scratch.bins[b].bbox;
+        } else {
+          left_box.expandToInclude(scratch.bins[b].bbox);
+        }
+        left_count += scratch.bins[b].count;
+      }
+      if (left_count == 0 || scratch.right_counts[b] == 0) {
+        continue;
+      }
+      const Float cost = settings.traversal_cost +
+                         settings.intersection_cost * inverse_area *
+                             (left_box.surfaceArea() * left_count + scratch.right_areas[b] * scratch.right_counts[b]);
+      if (cost < best.cost) {
+        best.cost = cost;
+        best.axis = axis;
+        best.bin = b;
+      }
+    }
+  }
+
+  // Keep the node as a leaf if that is cheaper than splitting it.
+  const Float leaf_cost = settings.intersection_cost * count;
+  if (count <= settings.max_leaf_size && (!best.isValid() || leaf_cost <= best.cost)) {
+    return start;
+  }
+
+  uint32_t mid = start;
+  if (best.isValid() && depth < settings.max_depth) {
+    const uint32_t axis = best.axis;
+    const Float scale = Float(bins) / bc.extent[axis];
+    const Float min = bc.min[axis];
+    const uint32_t split_bin = best.bin;
+    mid = (uint32_t)(std::partition(order.begin() + start,
+                                    order.begin() + end,
+                                    [&](uint32_t p) {
+                                      uint32_t b = (uint32_t)((centers[p][axis] - min) * scale);
+                                      return std::min(b, bins - 1) <= split_bin;
+                                    }) -
+                     order.begin());
+  }
+
+  // Either no split separates the centers, or the tree is too deep:
+  // split at the median of the longest axis.
+  if (mid == start || mid == end) {
+    const uint32_t axis = bc.maxDimension();
+    mid = start + count / 2;
+    std::nth_element(order.begin() + start,
+                     order.begin() + mid,
+                     order.begin() + end,
+                     [&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+  }
+
+  return mid;
+}
+
+//! Builds the subtree over a range of the context's order on this thread,
+//! appending its nodes to an array in preorder.
+template <typename Float>
+void buildSerial(BuildContext<Float>& context, uint32_t start, uint32_t end, uint32_t depth, NodeArray<Float>& nodes) {
+  BinScratch<Float> scratch(context.bins);
+
+  std::vector<BuildEntry> todo;
+  todo.push_back(BuildEntry{BuildEntry::no_parent, start, end, depth});
+
+  while (!todo.empty()) {
+    const BuildEntry bnode = todo.back();
+    todo.pop_back();
+
+    const uint32_t index = (uint32_t)nodes.size();
+
+    // The right child sets up the offset for the flat tree.
+    // The left child always directly follows its parent.
+    if (bnode.parent != BuildEntry::no_parent && bnode.parent + 1 != index) {
+      nodes[bnode.parent].right_offset = index - bnode.parent;
+    }
+
+    Node<Float> node;
+    const uint32_t mid = splitNode(context, scratch, bnode.start, bnode.end, bnode.depth, node);
+    nodes.push_back(node);
+    if (mid == bnode.start) {
+      continue;
+    }
+
+    // Mark the node as an inner node until its right child is placed.
+    nodes[index].right_offset = 1;
+
+    todo.push_back(BuildEntry{index, mid, bnode.end, bnode.depth + 1});
+    todo.push_back(BuildEntry{index, bnode.start, mid, bnode.depth + 1});
+  }
+}
+
+//! Builds the subtree over a range of the context's order,
+//! building the left and right subtrees of its top levels concurrently.
+//! Offsets in the flat tree are relative, so the subtrees are built
+//! into separate arrays and concatenated in preorder, which gives
+//! the same tree as @ref buildSerial.
+//! \param spawn_levels The number of levels that may still split work
+//! onto another thread.
+template <typename Float>
+void buildParallel(BuildContext<Float>& context,
+                   uint32_t start,
+                   uint32_t end,
+                   uint32_t depth,
+                   uint32_t spawn_levels,
+                   NodeArray<Float>& nodes) {
+  // Below this, starting a thread costs more than the subtree.
+  static constexpr uint32_t min_parallel_primitives = 4096;
+
+  if (spawn_levels == 0 || end - start < min_parallel_primitives) {
+    buildSerial(context, start, end, depth, nodes);
+    return;
+  }
+
+  BinScratch<Float> scratch(context.bins);
+  Node<Float> node;
+  const uint32_t mid = splitNode(context, scratch, start, end, depth, node);
+  if (mid == start) {
+    nodes.push_back(node);
+    return;
+  }
+
+  NodeArray<Float> left;
+  NodeArray<Float> right;
+  auto left_build = std::async(std::launch::async, [&]() {
+    buildParallel(context, start, mid, depth + 1, spawn_levels - 1, left);
+  });
+  buildParallel(context, mid, end, depth + 1, spawn_levels - 1, right);
+  left_build.get();
+
+  node.right_offset = 1 + (uint32_t)left.size();
+  nodes.push_back(node);
+  nodes.insert(nodes.end(), left.begin(), left.end());
+  nodes.insert(nodes.end(), right.begin(), right.end());
+}
+
+//! Calls a function on contiguous chunks of a range, one chunk per thread.
+//! \param threads The number of threads, including the calling thread.
+//! \param count The size of the range.
+//! \param function Called with the start and end of each chunk.
+template <typename Function>
+void parallelFor(uint32_t threads, uint32_t count, Function function) {
+  const uint32_t chunk = (count + threads - 1) / threads;
+  std::vector<std::future<void>> chunks;
+  for (uint32_t first = chunk; first < count; first += chunk) {
+    chunks.push_back(std::async(std::launch::async, function, first, std::min(first + chunk, count)));
+  }
+  function(0u, std::min(chunk, count));
+  for (auto& pending : chunks) {
+    pending.get();
+  }
+}
+
+}  // namespace Strategy2
+
+template <typename Float>
+template <typename Primitive, typename BoxConverter>
+BVH<Float, Primitive> BuildStrategy<Float, 2>::operator()(Iterable<Primitive> primitives, BoxConverter converter) {
+  using namespace Strategy2;
+
+  const uint32_t primitive_count = (uint32_t)primitives.size();
+
+  NodeArray<Float> nodes;
+
+  if (primitive_count == 0) {
+    // An empty leaf, with a box that no segment intersects.
+    const Float inf = std::numeric_limits<Float>::infinity();
+    Node<Float> node;
+    node.bbox = BBox<Float>(Vector3<Float>{inf, inf, inf}, Vector3<Float>{-inf, -inf, -inf});
+    node.start = 0;
+    node.primitive_count = 0;
+    node.right_offset = 0;
+    nodes.push_back(node);
+    return BVH<Float, Primitive>(std::move(nodes), primitives);
+  }
+
+  uint32_t threads = thread_count;
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  // Convert each primitive once, and partition indices instead of primitives.
+  BuildContext<Float> context(*this);
+  context.boxes.resize(primitive_count);
+  context.centers.resize(primitive_count);
+  parallelFor(threads, primitive_count, [&](uint32_t first, uint32_t last) {
+    for (uint32_t p = first; p < last; ++p) {
+      context.boxes[p] = converter(primitives[p]);
+      context.centers[p] = context.boxes[p].getCenter();
+    }
+  });
+  context.order.resize(primitive_count);
+  std::iota(context.order.begin(), context.order.end(), 0);
+
+  // Each spawning level doubles the number of concurrent subtrees.
+  // Spawn one level more than needed to fill the threads,
+  // since SAH splits are rarely even.
+  uint32_t spawn_levels = 0;
+  while ((1u << spawn_levels) < threads) {
+    spawn_levels++;
+  }
+  if (threads > 1) {
+    spawn_levels++;
+  }
+
+  nodes.reserve(2 * primitive_count / std::max(leaf_size, 1u) + 1);
+  buildParallel(context, 0, primitive_count, 0, spawn_levels, nodes);
+
+  // Reorder the primitives into leaf order.
+  std::vector<Primitive> sorted;
+  sorted.reserve(primitive_count);
+  for (uint32_t i = 0; i < primitive_count; ++i) {
+    sorted.push_back(primitives[context.order[i]]);
+  }
+  for (uint32_t i = 0; i < primitive_count; ++i) {
+    primitives[i] = sorted[i];
+  }
+
+  return BVH<Float, Primitive>(std::move(nodes), primitives);
+}
+
+}  // namespace FastBVH
@@ -0,0 +1,239 @@
+#pragma once
+
+#include "FastBVH/BuildStrategy2.h"
+
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+namespace FastBVH {
+
+//! \brief Contains details on the implementation
+//! of the variant-3 BVH build strategy.
+namespace Strategy3 {
+
+//! \brief Contains the context used while building
+//! a specific node in the BVH.
+struct BuildEntry final {
+  //! If not @ref no_parent, then this is the index of the parent,
+  //! whose right offset this node sets as its right child.
+  uint32_t parent;
+
+  //! The starting index of the range of sorted primitives in this node.
+  uint32_t start;
+
+  //! The ending index of the range of sorted primitives in this node.
+  uint32_t end;
+
+  //! Indicates that this node is the root, or a left child.
+  static constexpr uint32_t no_parent = 0xffffffff;
+};
+
+//! The number of bits of a Morton code along each axis.
+static constexpr uint32_t axis_bits = 10;
+
+//! The number of bits sorted by each radix sort pass.
+static constexpr uint32_t radix_bits = 10;
+
+//! The number of buckets of each radix sort pass.
+static constexpr uint32_t radix_size = 1u << radix_bits;
+
+//! Marks a key whose primitive was moved into leaf order.
+static constexpr uint64_t placed = uint64_t(1) << 63;
+
+//! Below this many primitives per thread, starting a thread costs more than it saves.
+static constexpr uint32_t min_primitives_per_thread = 16384;
+
+//! Spreads the low ten bits of a value out to every third bit.
+inline uint32_t expandBits(uint32_t v) noexcept {
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+//! Computes the 30-bit Morton code of a point.
+//! \param point The point, scaled to the range [0, 1] on each axis.
+template <typename Float>
+uint32_t mortonCode(const Vector3<Float>& point) noexcept {
+  const Float scale = Float(1u << axis_bits);
+  const Float top = Float((1u << axis_bits) - 1);
+  const uint32_t x = (uint32_t)std::min(std::max(point.x * scale, Float(0)), top);
+  const uint32_t y = (uint32_t)std::min(std::max(point.y * scale, Float(0)), top);
+  const uint32_t z = (uint32_t)std::min(std::max(point.z * scale, Float(0)), top);
+  return (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+}
+
+//! Sorts keys holding a Morton code in their upper half and a primitive index in their lower half,
+//! by code, with a stable least significant digit radix sort.
+//! Each pass counts digits and scatters keys on every thread, each thread taking one chunk.
+//! \param keys The keys to sort.
+//! \param scratch A buffer of the same size as the keys.
+//! \param threads The number of threads, including the calling thread.
+inline void radixSort(std::vector<uint64_t>& keys, std::vector<uint64_t>& scratch, uint32_t threads) {
+  const uint32_t count = (uint32_t)keys.size();
+  const uint32_t chunk = (count + threads - 1) / threads;
+  std::vector<uint32_t> offsets(std::size_t(threads) * radix_size);
+  for (uint32_t shift = 32; shift < 32 + 3 * axis_bits; shift += radix_bits) {
+    std::fill(offsets.begin(), offsets.end(), 0u);
+    Strategy2::parallelFor(threads, count, [&](uint32_t first, uint32_t last) {
+      uint32_t* histogram = &offsets[std::size_t(first / chunk) * radix_size];
+      for (uint32_t i = first; i < last; ++i) {
+        histogram[(keys[i] >> shift) & (radix_size - 1)]++;
+      }
+    });
+    // Each thread scatters a digit after every smaller digit,
+    // and after the same digit from earlier chunks.
+    uint32_t total = 0;
+    for (uint32_t digit = 0; digit < radix_size; ++digit) {
+      for (uint32_t t = 0; t < threads; ++t) {
+        const uint32_t n = offsets[std::size_t(t) * radix_size + digit];
+        offsets[std::size_t(t) * radix_size + digit] = total;
+        total += n;
+      }
+    }
+    Strategy2::parallelFor(threads, count, [&](uint32_t first, uint32_t last) {
+      uint32_t* offset = &offsets[std::size_t(first / chunk) * radix_size];
+      for (uint32_t i = first; i < last; ++i) {
+        scratch[offset[(keys[i] >> shift) & (radix_size - 1)]++] = keys[i];
+      }
+    });
+    keys.swap(scratch);
+  }
+}
+
+}  // namespace Strategy3
+
+template <typename Float>
+template <typename Primitive, typename BoxConverter>
+BVH<Float, Primitive> BuildStrategy<Float, 3>::operator()(Iterable<Primitive> primitives, BoxConverter converter) {
+  using namespace Strategy3;
+
+  const uint32_t primitive_count = (uint32_t)primitives.size();
+
+  NodeArray<Float> nodes;
+
+  if (primitive_count == 0) {
+    // An empty leaf, with a box that no segment intersects.
+    const Float inf = std::numeric_limits<Float>::infinity();
+    Node<Float> node;
+    node.bbox = BBox<Float>(Vector3<Float>{inf, inf, inf}, Vector3<Float>{-inf, -inf, -inf});
+    node.start = 0;
+    node.primitive_count = 0;
+    node.right_offset = 0;
+    nodes.push_back(node);
+    return BVH<Float, Primitive>(std::move(nodes), primitives);
+  }
+
+  uint32_t threads = thread_count;
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  threads = std::max(std::min(threads, primitive_count / min_primitives_per_thread), 1u);
+
+  // Convert each primitive once, and bound the centers.
+  std::vector<BBox<Float>> boxes(primitive_count);
+  std::vector<Vector3<Float>> centers(primitive_count);
+  for (uint32_t p = 0; p < primitive_count; ++p) {
+    boxes[p] = converter(primitives[p]);
+    centers[p] = boxes[p].getCenter();
+  }
+  BBox<Float> center_box(centers[0]);
+  for (uint32_t p = 1; p < primitive_count; ++p) {
+    center_box.expandToInclude(centers[p]);
+  }
+
+  // Sort the primitives along a Morton curve through the center box.
+  const Vector3<Float> extent = center_box.extent;
+  const Vector3<Float> inverse{extent.x > 0 ? 1 / extent.x : 0, extent.y > 0 ? 1 / extent.y : 0,
+                               extent.z > 0 ? 1 / extent.z : 0};
+  std::vector<uint64_t> keys(primitive_count);
+  std::vector<uint64_t> scratch(primitive_count);
+  Strategy2::parallelFor(threads, primitive_count, [&](uint32_t first, uint32_t last) {
+    for (uint32_t p = first; p < last; ++p) {
+      const Vector3<Float> offset = centers[p] - center_box.min;
+      const Vector3<Float> scaled{offset.x * inverse.x, offset.y * inverse.y, offset.z * inverse.z};
+      keys[p] = (uint64_t(mortonCode(scaled)) << 32) | p;
+    }
+  });
+  radixSort(keys, scratch, threads);
+
+  // Split each node where the highest differing bit of its codes flips,
+  // emitting nodes in preorder, as the traversers expect.
+  nodes.reserve(2 * primitive_count / std::max(leaf_size, 1u) + 1);
+  std::vector<BuildEntry> todo;
+  todo.push_back(BuildEntry{BuildEntry::no_parent, 0, primitive_count});
+  while (!todo.empty()) {
+    const BuildEntry entry = todo.back();
+    todo.pop_back();
+
+    const uint32_t index = (uint32_t)nodes.size();
+    if (entry.parent != BuildEntry::no_parent) {
+      nodes[entry.parent].right_offset = index - entry.parent;
+    }
+    Node<Float> node;
+    node.start = entry.start;
+    node.primitive_count = entry.end - entry.start;
+    node.right_offset = 0;
+    nodes.push_back(node);
+    if (node.primitive_count <= leaf_size) {
+      continue;
+    }
+
+    const uint32_t first = uint32_t(keys[entry.start] >> 32);
+    const uint32_t last = uint32_t(keys[entry.end - 1] >> 32);
+    uint32_t mid;
+    if (first == last) {
+      // The centers share a cell, so split at the median.
+      mid = entry.start + (entry.end - entry.start) / 2;
+    } else {
+      uint32_t bit = 3 * axis_bits - 1;
+      while (((first ^ last) >> bit) == 0) {
+        bit--;
+      }
+      const auto split = std::partition_point(keys.begin() + entry.start, keys.begin() + entry.end,
+                                              [&](uint64_t key) { return ((uint32_t(key >> 32) ^ first) >> bit) == 0; });
+      mid = (uint32_t)(split - keys.begin());
+    }
+    todo.push_back(BuildEntry{index, mid, entry.end});
+    todo.push_back(BuildEntry{BuildEntry::no_parent, entry.start, mid});
+  }
+
+  // Children follow their parents, so fit the boxes from the back.
+  for (uint32_t n = (uint32_t)nodes.size(); n-- > 0;) {
+    Node<Float>& node = nodes[n];
+    if (node.isLeaf()) {
+      node.bbox = boxes[uint32_t(keys[node.start])];
+      for (uint32_t i = node.start + 1; i < node.start + node.primitive_count; ++i) {
+        node.bbox.expandToInclude(boxes[uint32_t(keys[i])]);
+      }
+    } else {
+      node.bbox = nodes[n + 1].bbox;
+      node.bbox.expandToInclude(nodes[n + node.right_offset].bbox);
+    }
+  }
+
+  // Reorder the primitives into leaf order in place, following each cycle
+  // of the permutation, so that each primitive is copied about once.
+  for (uint32_t i = 0; i < primitive_count; ++i) {
+    if (keys[i] & placed) {
+      continue;
+    }
+    Primitive first = primitives[i];
+    uint32_t to = i;
+    uint32_t from = uint32_t(keys[i]);
+    while (from != i) {
+      primitives[to] = primitives[from];
+      keys[to] |= placed;
+      to = from;
+      from = uint32_t(keys[to]);
+    }
+    primitives[to] = first;
+    keys[to] |= placed;
+  }
+
+  return BVH<Float, Primitive>(std::move(nodes), primitives);
+}
+
+}  // namespace FastBVH
@@ -9,7 +9,8 @@ namespace FastBVH {
 
 //! \brief Stores information regarding a ray intersection with a primitive.
 //! \tparam Float The floating point type used for vector components.
-template <typename Float>
+//! \tparam Primitive The type of primitive that was intersected.
+template <typename Float, typename Primitive>
 struct Intersection final {
   /// A simple type definition for 3D vector.
   using Vec3 = Vector3<Float>;
@@ -18,7 +19,7 @@ struct Intersection final {
   Float t = std::numeric_limits<Float>::infinity();
 
   // Pointer to the intersected object.
-  const Cuboid* IntersectedP = NULL;
+  const Primitive* IntersectedP = NULL;
 
   //! Gets the position at the ray hit the object.
   //! \param ray_pos The ray position.
@@ -34,9 +35,9 @@ struct Intersection final {
 //! \brief Gets the closest of two intersections.
 //! \returns A copy of either @p a or @p b, depending on which one is closer.
 template <typename Float, typename Primitive>
-Intersection<Float> closest(
-    const Intersection<Float>& a,
-    const Intersection<Float>& b) noexcept
+Intersection<Float, Primitive> closest(
+    const Intersection<Float, Primitive>& a,
+    const Intersection<Float, Primitive>& b) noexcept
 {
   return (a.t < b.t) ? a : b;
 }
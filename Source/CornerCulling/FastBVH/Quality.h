@@ -0,0 +1,83 @@
+#pragma once
+
+#include "FastBVH/BVH.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace FastBVH {
+
+//! \brief Describes the shape of a built BVH,
+//! for comparing build strategies.
+struct Quality final {
+  //! The expected cost of a query under the Surface Area Heuristic:
+  //! the cost of every node and primitive, weighted by the chance
+  //! that a segment hitting the root also hits its node.
+  double sah_cost = 0;
+
+  //! The depth of the deepest leaf, where the root has a depth of zero.
+  uint32_t depth = 0;
+
+  //! The number of nodes, inner and leaf.
+  std::size_t node_count = 0;
+
+  //! The number of leaf nodes.
+  std::size_t leaf_count = 0;
+
+  //! The mean number of primitives per leaf.
+  double mean_leaf_size = 0;
+
+  //! The largest number of primitives in a leaf.
+  uint32_t max_leaf_size = 0;
+
+  //! The number of leaves holding each number of primitives.
+  std::vector<std::size_t> leaf_sizes;
+};
+
+//! Measures the quality of a BVH.
+//! \param bvh The BVH to measure.
+//! \param traversal_cost The cost of visiting a node, relative to intersection_cost.
+//! \param intersection_cost The cost of testing a primitive, relative to traversal_cost.
+//! \return The quality of the BVH.
+template <typename Float, typename Primitive>
+Quality measureQuality(const BVH<Float, Primitive>& bvh, double traversal_cost = 1, double intersection_cost = 1) {
+  Quality quality;
+  const auto nodes = bvh.getNodes();
+  quality.node_count = nodes.size();
+  quality.leaf_count = bvh.countLeafs();
+  if (nodes.size() == 0) {
+    return quality;
+  }
+
+  const double root_area = nodes[0].bbox.surfaceArea();
+  const double inverse_area = root_area > 0 ? 1 / root_area : 1;
+
+  // The flat tree is in preorder, so the depth of each node
+  // is known by the time it is reached.
+  std::vector<uint32_t> depths(nodes.size(), 0);
+  std::size_t primitive_total = 0;
+  for (uint32_t n = 0; n < nodes.size(); n++) {
+    const auto& node = nodes[n];
+    const double weight = node.bbox.surfaceArea() * inverse_area;
+    quality.depth = std::max(quality.depth, depths[n]);
+    if (node.isLeaf()) {
+      quality.sah_cost += weight * intersection_cost * node.primitive_count;
+      quality.max_leaf_size = std::max(quality.max_leaf_size, node.primitive_count);
+      if (quality.leaf_sizes.size() <= node.primitive_count) {
+        quality.leaf_sizes.resize(node.primitive_count + 1, 0);
+      }
+      quality.leaf_sizes[node.primitive_count]++;
+      primitive_total += node.primitive_count;
+    } else {
+      quality.sah_cost += weight * traversal_cost;
+      depths[n + 1] = depths[n] + 1;
+      depths[n + node.right_offset] = depths[n] + 1;
+    }
+  }
+  quality.mean_leaf_size = quality.leaf_count > 0 ? double(primitive_total) / quality.leaf_count : 0;
+
+  return quality;
+}
+
+}  // namespace FastBVH
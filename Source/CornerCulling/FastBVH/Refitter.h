@@ -0,0 +1,143 @@
+#pragma once
+
+#include "FastBVH/BVH.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace FastBVH {
+
+//! \brief Refits the boxes of a BVH after its primitives move,
+//! without changing the structure of the tree.
+//! Refitting keeps the tree correct, but boxes that grow
+//! overlap more and more, so the refitter tracks how much each node
+//! has grown since it was built, and reports nodes whose subtrees
+//! should be rebuilt.
+//! \tparam Float The floating point type of the BVH.
+//! \tparam Primitive The type of primitive in the BVH.
+template <typename Float, typename Primitive>
+class Refitter final {
+  //! The BVH being refit.
+  BVH<Float, Primitive>& bvh;
+
+  //! The parent of each node, or @ref none for the root.
+  std::vector<uint32_t> parents;
+
+  //! The leaf holding each primitive.
+  std::vector<uint32_t> leaves;
+
+  //! The surface area of each node when it was built.
+  std::vector<Float> built_areas;
+
+  //! Computes the parents of the nodes, and the leaves of the primitives,
+  //! in the subtree from index up to end.
+  void link(uint32_t index, uint32_t end) {
+    const auto nodes = bvh.getNodes();
+    for (uint32_t n = index; n < end; n++) {
+      const auto& node = nodes[n];
+      if (node.isLeaf()) {
+        for (uint32_t p = node.start; p < node.start + node.primitive_count; p++) {
+          leaves[p] = n;
+        }
+      } else {
+        parents[n + 1] = n;
+        parents[n + node.right_offset] = n;
+      }
+    }
+  }
+
+ public:
+  //! Indicates no node.
+  static constexpr uint32_t none = 0xffffffff;
+
+  //! Constructs a refitter, treating the current boxes as freshly built.
+  //! \param bvh_ The BVH to refit, which must outlive the refitter.
+  explicit Refitter(BVH<Float, Primitive>& bvh_) : bvh(bvh_) {
+    const auto nodes = bvh.getNodes();
+    built_areas.reserve(nodes.size());
+    for (const auto& node : nodes) {
+      built_areas.push_back(node.bbox.surfaceArea());
+    }
+    parents.assign(nodes.size(), none);
+    leaves.assign(bvh.getPrimitives().size(), none);
+    link(0, (uint32_t)nodes.size());
+  }
+
+  //! Refits the leaf holding a primitive that moved, and its ancestors,
+  //! stopping early at the first box that does not change.
+  //! Takes O(depth) time.
+  //! \param primitive The index of the primitive, in leaf order.
+  //! \param converter Converts a primitive to its bounding box.
+  //! \param max_inflation The factor by which a node's surface area
+  //! may grow over its built area before it is reported.
+  //! \param visit Called with the index and new box of each refit node.
+  //! \return The highest refit node that grew past max_inflation,
+  //! or @ref none if no node did.
+  template <typename BoxConverter, typename Visitor>
+  uint32_t refit(uint32_t primitive, BoxConverter converter, Float max_inflation, Visitor visit) {
+    const auto nodes = bvh.getNodes();
+    const auto primitives = bvh.getPrimitives();
+    uint32_t degraded = none;
+    uint32_t index = leaves[primitive];
+    while (index != none) {
+      const auto& node = nodes[index];
+      BBox<Float> box;
+      if (node.isLeaf()) {
+        box = converter(primitives[node.start]);
+        for (uint32_t p = node.start + 1; p < node.start + node.primitive_count; p++) {
+          box.expandToInclude(converter(primitives[p]));
+        }
+      } else {
+        box = nodes[index + 1].bbox;
+        box.expandToInclude(nodes[index + node.right_offset].bbox);
+      }
+      if (box.min.x == node.bbox.min.x && box.min.y == node.bbox.min.y && box.min.z == node.bbox.min.z &&
+          box.max.x == node.bbox.max.x && box.max.y == node.bbox.max.y && box.max.z == node.bbox.max.z) {
+        break;
+      }
+      bvh.setBox(index, box);
+      visit(index, box);
+      if (box.surfaceArea() > max_inflation * built_areas[index]) {
+        degraded = index;
+      }
+      index = parents[index];
+    }
+    return degraded;
+  }
+
+  //! Replaces the subtree rooted at a node with a rebuild of it,
+  //! treating the boxes of the new subtree as freshly built.
+  //! Takes time linear in the number of nodes, but only to shift indices.
+  //! \param index The index of the subtree's root.
+  //! \param subtree The nodes of the new subtree, as for @ref BVH::replaceSubtree.
+  void replaceSubtree(uint32_t index, const ConstIterable<Node<Float>>& subtree) {
+    const uint32_t end = bvh.getSubtreeEnd(index);
+    const uint32_t new_end = index + (uint32_t)subtree.size();
+    const int64_t delta = int64_t(new_end) - int64_t(end);
+
+    built_areas.erase(built_areas.begin() + index, built_areas.begin() + end);
+    built_areas.insert(built_areas.begin() + index, subtree.size(), Float(0));
+    for (uint32_t n = index; n < new_end; n++) {
+      built_areas[n] = subtree[n - index].bbox.surfaceArea();
+    }
+
+    bvh.replaceSubtree(index, subtree);
+
+    // The root keeps its parent, and nodes after the subtree move by delta.
+    parents.erase(parents.begin() + index + 1, parents.begin() + end);
+    parents.insert(parents.begin() + index + 1, new_end - index - 1, none);
+    for (auto& parent : parents) {
+      if (parent != none && parent >= end) {
+        parent = uint32_t(parent + delta);
+      }
+    }
+    for (auto& leaf : leaves) {
+      if (leaf >= end) {
+        leaf = uint32_t(leaf + delta);
+      }
+    }
+    link(index, new_end);
+  }
+};
+
+}  // namespace FastBVH
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace FastBVH {
+
+//! \brief The working set of a traversal, in a fixed-size array
+//! on the call stack, for trees known to be shallow enough to fit.
+//! Pushing does not check for overflow, so check the tree's depth first.
+//! \tparam Entry The type of entry in the working set.
+//! \tparam capacity The largest number of entries.
+template <typename Entry, std::size_t capacity>
+class FixedStack final {
+  //! The entry array of the stack.
+  Entry entries[capacity];
+
+  //! The number of entries in the stack.
+  std::size_t count = 0;
+
+ public:
+  //! Indicates if the stack is empty.
+  inline bool empty() const noexcept { return count == 0; }
+
+  //! Pushes an entry to the stack.
+  inline void push(const Entry& entry) noexcept { entries[count++] = entry; }
+
+  //! Pops the top entry from the stack.
+  //! This function does not check if the stack is empty.
+  inline Entry pop() noexcept { return entries[--count]; }
+};
+
+//! \brief The working set of a traversal, on the heap,
+//! for trees too deep for a @ref FixedStack.
+//! \tparam Entry The type of entry in the working set.
+template <typename Entry>
+class GrowableStack final {
+  //! The entries of the stack, with the top at the back.
+  std::vector<Entry> entries;
+
+ public:
+  //! Indicates if the stack is empty.
+  inline bool empty() const noexcept { return entries.empty(); }
+
+  //! Pushes an entry to the stack, growing it if needed.
+  inline void push(const Entry& entry) { entries.push_back(entry); }
+
+  //! Pops the top entry from the stack.
+  //! This function does not check if the stack is empty.
+  inline Entry pop() noexcept {
+    const Entry entry = entries.back();
+    entries.pop_back();
+    return entry;
+  }
+};
+
+}  // namespace FastBVH
@@ -1,34 +1,66 @@
 #pragma once
 
 #include "FastBVH/BVH.h"
+#include "FastBVH/TraversalStack.h"
 #include "GeometricPrimitives.h"
 #include <vector>
 
 namespace FastBVH {
 
+    //! \brief Counts the work done by traversals, for performance measurement.
+    struct TraversalStats final
+    {
+        //! The number of traversals.
+        uint64_t traversals = 0;
+
+        //! The number of nodes popped off the working set.
+        uint64_t nodes_visited = 0;
+
+        //! The number of leaf primitives tested against the segment.
+        uint64_t primitives_tested = 0;
+    };
+
     //! \brief Used for traversing a BVH and checking for ray-primitive intersections.
     //! \tparam Float The floating point type used by vector components.
+    //! \tparam Primitive The type of primitive in the BVH,
+    //! which needs an IsBlocking overload taking a pointer to it.
     //! \tparam Intersector The type of the primitive intersector.
+    //! \tparam StackSize The size of the working set on the call stack,
+    //! which fits trees up to StackSize - 1 levels deep.
+    //! Deeper trees are traversed with a working set on the heap.
     template <
         typename Float,
-        typename Intersector>
+        typename Primitive,
+        typename Intersector,
+        std::size_t StackSize = 64>
     class Traverser final
     {
-        const BVH<Float, Cuboid>& bvh;
+        const BVH<Float, Primitive>& bvh;
         Intersector intersector;
 
+        //! Traces the segment through the BVH with the given working set.
+        template <typename Stack>
+        const Primitive* traverseWith(
+            Stack& todo,
+            const OptSegment& segment,
+            const Vec3 peeks[NUM_PEEKS],
+            const CharacterBounds& bounds,
+            TraversalStats* stats);
+
     public:
         //! Constructs a new BVH traverser.
         //! \param bvh_ The BVH to be traversed.
-        constexpr Traverser(const BVH<Float, Cuboid>& bvh_, const Intersector& intersector_) noexcept
+        constexpr Traverser(const BVH<Float, Primitive>& bvh_, const Intersector& intersector_) noexcept
             : bvh(bvh_), intersector(intersector_) {}
-        // Traces single ray through the BVH, returning true if that ray
-        // intersects a cuboid that blocks LOS between peeks and the verticies
-        // of an enemy bounding box.
-        const Cuboid* traverse(
+        // Traces single ray through the BVH, returning a primitive
+        // that the ray intersects and that blocks LOS between peeks
+        // and the verticies of an enemy bounding box, or NULL if none does.
+        // If stats is not null, adds the work done by the traversal to it.
+        const Primitive* traverse(
             const OptSegment& segment,
-            const std::vector<FVector>& peeks,
-            const CharacterBounds& Bounds);
+            const Vec3 peeks[NUM_PEEKS],
+            const CharacterBounds& Bounds,
+            TraversalStats* stats = nullptr);
     };
 
     //! \brief Contains implementation details for the @ref Traverser class.
@@ -56,13 +88,43 @@ namespace FastBVH {
 
     template <
         typename Float,
-        typename Intersector
+        typename Primitive,
+        typename Intersector,
+        std::size_t StackSize
+    >
+    const Primitive*
+    Traverser<Float, Primitive, Intersector, StackSize>::traverse(
+        const OptSegment& segment,
+        const Vec3 peeks[NUM_PEEKS],
+        const CharacterBounds& bounds,
+        TraversalStats* stats)
+    {
+        using Traversal = TraverserImpl::Traversal<Float>;
+        // Each level leaves at most one sibling on the working set,
+        // so a tree fits if its deepest leaf, plus its siblings, does.
+        if (bvh.getDepth() < StackSize)
+        {
+            FixedStack<Traversal, StackSize> todo;
+            return traverseWith(todo, segment, peeks, bounds, stats);
+        }
+        GrowableStack<Traversal> todo;
+        return traverseWith(todo, segment, peeks, bounds, stats);
+    }
+
+    template <
+        typename Float,
+        typename Primitive,
+        typename Intersector,
+        std::size_t StackSize
     >
-    const Cuboid*
-    Traverser<Float, Intersector>::traverse(
+    template <typename Stack>
+    const Primitive*
+    Traverser<Float, Primitive, Intersector, StackSize>::traverseWith(
+        Stack& todo,
         const OptSegment& segment,
-        const std::vector<FVector>& peeks,
-        const CharacterBounds& bounds)
+        const Vec3 peeks[NUM_PEEKS],
+        const CharacterBounds& bounds,
+        TraversalStats* stats)
     {
     using Traversal = TraverserImpl::Traversal<Float>;
 
@@ -70,26 +132,25 @@ namespace FastBVH {
     Float bbhits[4];
     int32_t closer, other;
 
-    // Working set
-    // WARNING : The working set size is relatively small here, should be made dynamic or template-configurable
-    Traversal todo[64];
-    int32_t stackptr = 0;
-
     // "Push" on the root node to the working set
-    todo[stackptr].i = 0;
-    todo[stackptr].mint = -9999999.f;
+    todo.push(Traversal(0, -9999999.f));
 
     const auto nodes = bvh.getNodes();
 
-    auto build_prims = bvh.getPrimitives();
+    // A non-owning view, so this is free.
+    const auto build_prims = bvh.getPrimitives();
+
+    // Counted locally, so that untracked traversals only pay for increments.
+    uint64_t nodes_visited = 0;
+    uint64_t primitives_tested = 0;
+    const Primitive* blocking = NULL;
 
-    while (stackptr >= 0)
+    while (!todo.empty() && blocking == NULL)
     {
         // Pop off the next node to work on.
-        int ni = todo[stackptr].i;
-        Float near = todo[stackptr].mint;
-        stackptr--;
+        int ni = todo.pop().i;
         const auto& node(nodes[ni]);
+        nodes_visited++;
 
         // Is leaf -> Intersect
         if (node.isLeaf())
@@ -97,7 +158,8 @@ namespace FastBVH {
             for (uint32_t o = 0; o < node.primitive_count; ++o)
             {
                 const auto& obj = build_prims[node.start + o];
-                Intersection<float> current = intersector(*obj, segment);
+                primitives_tested++;
+                Intersection<float, Primitive> current = intersector(obj, segment);
                 if (current)
                 {
                     if (
@@ -106,7 +168,8 @@ namespace FastBVH {
                             bounds,
                             current.IntersectedP))
                     {
-                        return current.IntersectedP;
+                        blocking = current.IntersectedP;
+                        break;
                     }
                 }
             }
@@ -136,23 +199,29 @@ namespace FastBVH {
                 // we'll check the further-away node later...
 
                 // Push the farther first
-                todo[++stackptr] = Traversal(other, bbhits[2]);
+                todo.push(Traversal(other, bbhits[2]));
 
                 // And now the closer (with overlap test)
-                todo[++stackptr] = Traversal(closer, bbhits[0]);
+                todo.push(Traversal(closer, bbhits[0]));
             }
 
             else if (hitc0)
             {
-                todo[++stackptr] = Traversal(ni + 1, bbhits[0]);
+                todo.push(Traversal(ni + 1, bbhits[0]));
             }
 
             else if (hitc1)
             {
-                todo[++stackptr] = Traversal(ni + node.right_offset, bbhits[2]);
+                todo.push(Traversal(ni + node.right_offset, bbhits[2]));
             }
         }
     }
-    return NULL;
+    if (stats != nullptr)
+    {
+        stats->traversals++;
+        stats->nodes_visited += nodes_visited;
+        stats->primitives_tested += primitives_tested;
+    }
+    return blocking;
     }
 }  // namespace FastBVH
@@ -0,0 +1,351 @@
+#pragma once
+
+#include "FastBVH/BVH.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace FastBVH {
+
+//! \brief A node of a @ref WideBVH.
+//! Stores the bounds of up to eight children in SoA layout,
+//! so that one AVX slab test covers every child.
+struct alignas(32) WideNode final {
+  //! The largest number of children of a node.
+  static constexpr uint32_t width = 8;
+
+  //! The minimum points of the child bounding boxes.
+  float min_xs[width];
+  float min_ys[width];
+  float min_zs[width];
+
+  //! The maximum points of the child bounding boxes.
+  float max_xs[width];
+  float max_ys[width];
+  float max_zs[width];
+
+  //! If a child is a leaf, the index of its first primitive.
+  //! Otherwise, the index of the child node.
+  uint32_t children[width];
+
+  //! The number of primitives in each leaf child,
+  //! or zero if the child is a node.
+  uint32_t counts[width];
+
+  //! The number of children in use, which fill the first lanes.
+  uint32_t child_count;
+};
+
+//! \brief A BVH with up to eight children per node,
+//! collapsed from a binary @ref BVH.
+//! Leaves are not stored as nodes: a node's leaf children
+//! reference their primitives directly.
+//! \tparam Primitive The type of primitive in the BVH.
+template <typename Primitive>
+class WideBVH final {
+  //! The nodes, where the root is the first node.
+  std::vector<WideNode> nodes;
+
+  //! Nodes collapsed earlier and viewed in place, used instead of
+  //! the owned nodes if those are empty.
+  ConstIterable<WideNode> baked_nodes{nullptr, 0};
+
+  //! A view of the primitives, in the leaf order of the binary BVH.
+  ConstIterable<Primitive> primitives;
+
+  //! The lane holding each node of the binary BVH, as the index
+  //! of its wide node times the width plus its lane,
+  //! or @ref none for binary nodes that were collapsed away.
+  std::vector<uint32_t> lanes;
+
+  //! The binary node that each wide node replaces.
+  std::vector<uint32_t> sources;
+
+  //! The number of nodes no longer reachable from the root,
+  //! left behind by @ref replaceSubtree.
+  std::size_t unreachable = 0;
+
+  //! The depth of the deepest node, where the root has a depth of zero.
+  //! After @ref replaceSubtree, this may exceed the depth of the tree.
+  uint32_t depth = 0;
+
+  //! Raises the depth to that of the deepest node below a node.
+  //! \param root The index of the node.
+  //! \param root_depth The depth of the node.
+  void measureDepth(uint32_t root, uint32_t root_depth);
+
+  //! Collapses the binary subtree rooted at a node into a wide node
+  //! and its descendants, appending the descendants to the nodes.
+  //! \param binary The nodes of the binary BVH.
+  //! \param binary_root The root of the binary subtree.
+  //! \param wide_root The index of the wide node to fill.
+  void collapse(const ConstIterable<Node<float>>& binary, uint32_t binary_root, uint32_t wide_root);
+
+ public:
+  //! Collapses a binary BVH into a wide BVH.
+  //! Each node takes the children of the binary node it replaces,
+  //! and repeatedly replaces the inner child with the largest surface area
+  //! by that child's own children, until it has eight children or only leaves.
+  //! \param bvh The binary BVH, which must outlive this BVH,
+  //! as they share its primitives.
+  explicit WideBVH(const BVH<float, Primitive>& bvh);
+
+  //! Views the nodes of a wide BVH collapsed earlier, such as nodes
+  //! baked into a file, without copying them.
+  //! The BVH cannot be refit, or have subtrees replaced.
+  //! \param nodes_ The nodes, which must outlive this BVH.
+  //! \param primitives_ The primitives, in the leaf order of the nodes,
+  //! which must outlive this BVH.
+  WideBVH(const ConstIterable<WideNode>& nodes_, const ConstIterable<Primitive>& primitives_) noexcept
+      : baked_nodes(nodes_), primitives(primitives_) {
+    if (baked_nodes.size() > 0) {
+      measureDepth(0, 0);
+    }
+  }
+
+  //! Indicates a binary node without a lane.
+  static constexpr uint32_t none = 0xffffffff;
+
+  //! Copies the refit box of a binary node into its lane, if it has one.
+  //! \param binary_index The index of the node in the binary BVH.
+  //! \param bbox The node's new bounding box.
+  void refit(uint32_t binary_index, const BBox<float>& bbox) noexcept {
+    const uint32_t lane = lanes[binary_index];
+    if (lane == none) {
+      return;
+    }
+    WideNode& node = nodes[lane / WideNode::width];
+    const uint32_t k = lane % WideNode::width;
+    node.min_xs[k] = bbox.min.x;
+    node.min_ys[k] = bbox.min.y;
+    node.min_zs[k] = bbox.min.z;
+    node.max_xs[k] = bbox.max.x;
+    node.max_ys[k] = bbox.max.y;
+    node.max_zs[k] = bbox.max.z;
+  }
+
+  //! Updates the wide nodes over a subtree of the binary BVH
+  //! that was replaced, such as by @ref BVH::replaceSubtree.
+  //! Re-collapses the smallest wide subtree covering the replaced nodes,
+  //! leaving its old nodes unreachable until they outnumber reachable nodes,
+  //! at which point the whole BVH is collapsed again.
+  //! \param bvh The binary BVH, after the replacement.
+  //! \param index The root of the replaced subtree.
+  //! \param old_end The end of the subtree before the replacement.
+  void replaceSubtree(const BVH<float, Primitive>& bvh, uint32_t index, uint32_t old_end);
+
+  //! Accesses the BVH nodes.
+  //! Nodes that are unreachable from the root may be mixed in.
+  //! \return A read-only iterable container of nodes.
+  inline auto getNodes() const noexcept {
+    return nodes.empty() ? baked_nodes : ConstIterable<WideNode>(nodes.data(), nodes.size());
+  }
+
+  //! Accesses the primitives in the BVH, in leaf order.
+  //! \return A read-only iterable container of the primitive array.
+  inline auto getPrimitives() const noexcept { return primitives; }
+
+  //! Gets the depth of the deepest node, where the root has a depth of zero,
+  //! or more after subtrees were replaced.
+  //! Traversers check it to size their working set.
+  inline uint32_t getDepth() const noexcept { return depth; }
+};
+
+template <typename Primitive>
+WideBVH<Primitive>::WideBVH(const BVH<float, Primitive>& bvh) : primitives(bvh.getPrimitives()) {
+  const auto binary = bvh.getNodes();
+  lanes.assign(binary.size(), none);
+  nodes.emplace_back();
+  sources.push_back(0);
+  collapse(binary, 0, 0);
+  measureDepth(0, 0);
+}
+
+template <typename Primitive>
+void WideBVH<Primitive>::measureDepth(uint32_t root, uint32_t root_depth) {
+  //! Pairs a wide node with its depth.
+  struct DepthEntry final {
+    uint32_t node;
+    uint32_t depth;
+  };
+
+  const auto all = getNodes();
+  std::vector<DepthEntry> todo;
+  todo.push_back(DepthEntry{root, root_depth});
+  while (!todo.empty()) {
+    const DepthEntry entry = todo.back();
+    todo.pop_back();
+    depth = std::max(depth, entry.depth);
+    const WideNode& node = all[entry.node];
+    for (uint32_t k = 0; k < node.child_count; k++) {
+      if (node.counts[k] == 0) {
+        todo.push_back(DepthEntry{node.children[k], entry.depth + 1});
+      }
+    }
+  }
+}
+
+template <typename Primitive>
+void WideBVH<Primitive>::collapse(const ConstIterable<Node<float>>& binary, uint32_t binary_root, uint32_t wide_root) {
+  //! Pairs a binary node with the wide node that replaces it.
+  struct CollapseEntry final {
+    uint32_t binary;
+    uint32_t wide;
+  };
+
+  std::vector<CollapseEntry> todo;
+  todo.push_back(CollapseEntry{binary_root, wide_root});
+
+  while (!todo.empty()) {
+    const CollapseEntry entry = todo.back();
+    todo.pop_back();
+
+    // Gather the binary nodes that become children of this wide node.
+    uint32_t kids[WideNode::width];
+    float kid_areas[WideNode::width];
+    uint32_t kid_count = 0;
+    const auto& root = binary[entry.binary];
+    if (root.isLeaf()) {
+      // Only the root of the BVH can be a leaf here, since replaceSubtree
+      // puts other leaves into their parent's lane.
+      if (root.primitive_count > 0) {
+        kids[kid_count++] = entry.binary;
+      }
+    } else {
+      kids[kid_count++] = entry.binary + 1;
+      kids[kid_count++] = entry.binary + root.right_offset;
+    }
+    for (uint32_t k = 0; k < kid_count; k++) {
+      kid_areas[k] = binary[kids[k]].bbox.surfaceArea();
+    }
+    while (kid_count < WideNode::width) {
+      uint32_t largest = kid_count;
+      float largest_area = -1;
+      for (uint32_t k = 0; k < kid_count; k++) {
+        if (!binary[kids[k]].isLeaf() && kid_areas[k] > largest_area) {
+          largest = k;
+          largest_area = kid_areas[k];
+        }
+      }
+      if (largest == kid_count) {
+        break;
+      }
+      const uint32_t opened = kids[largest];
+      kids[largest] = opened + 1;
+      kid_areas[largest] = binary[opened + 1].bbox.surfaceArea();
+      kids[kid_count] = opened + binary[opened].right_offset;
+      kid_areas[kid_count] = binary[kids[kid_count]].bbox.surfaceArea();
+      kid_count++;
+    }
+
+    // Fill the lanes, leaving unused lanes with empty boxes.
+    WideNode node;
+    const float inf = std::numeric_limits<float>::infinity();
+    for (uint32_t k = 0; k < WideNode::width; k++) {
+      node.min_xs[k] = node.min_ys[k] = node.min_zs[k] = inf;
+      node.max_xs[k] = node.max_ys[k] = node.max_zs[k] = -inf;
+      node.children[k] = 0;
+      node.counts[k] = 0;
+    }
+    node.child_count = kid_count;
+    for (uint32_t k = 0; k < kid_count; k++) {
+      const auto& kid = binary[kids[k]];
+      lanes[kids[k]] = entry.wide * WideNode::width + k;
+      node.min_xs[k] = kid.bbox.min.x;
+      node.min_ys[k] = kid.bbox.min.y;
+      node.min_zs[k] = kid.bbox.min.z;
+      node.max_xs[k] = kid.bbox.max.x;
+      node.max_ys[k] = kid.bbox.max.y;
+      node.max_zs[k] = kid.bbox.max.z;
+      if (kid.isLeaf()) {
+        node.children[k] = kid.start;
+        node.counts[k] = kid.primitive_count;
+      } else {
+        node.children[k] = (uint32_t)nodes.size();
+        todo.push_back(CollapseEntry{kids[k], node.children[k]});
+        nodes.emplace_back();
+        sources.push_back(kids[k]);
+      }
+    }
+    nodes[entry.wide] = node;
+  }
+}
+
+template <typename Primitive>
+void WideBVH<Primitive>::replaceSubtree(const BVH<float, Primitive>& bvh, uint32_t index, uint32_t old_end) {
+  const auto binary = bvh.getNodes();
+  const uint32_t new_end = bvh.getSubtreeEnd(index);
+  const int64_t delta = int64_t(new_end) - int64_t(old_end);
+
+  // Binary nodes after the subtree moved by delta.
+  // The root of the subtree keeps its lane.
+  lanes.erase(lanes.begin() + index + 1, lanes.begin() + old_end);
+  lanes.insert(lanes.begin() + index + 1, new_end - index - 1, none);
+  for (auto& source : sources) {
+    if (source >= old_end) {
+      source = uint32_t(source + delta);
+    }
+  }
+
+  // Find the deepest wide node whose binary subtree holds the replaced subtree.
+  uint32_t wide = 0;
+  uint32_t wide_depth = 0;
+  for (bool descended = true; descended;) {
+    descended = false;
+    const WideNode& node = nodes[wide];
+    for (uint32_t k = 0; k < node.child_count; k++) {
+      if (node.counts[k] > 0) {
+        continue;
+      }
+      const uint32_t source = sources[node.children[k]];
+      if (source <= index && index < bvh.getSubtreeEnd(source)) {
+        wide = node.children[k];
+        wide_depth++;
+        descended = true;
+        break;
+      }
+    }
+  }
+
+  // Count the wide nodes being left behind, then collapse over them.
+  const uint32_t source = sources[wide];
+  const uint32_t end = bvh.getSubtreeEnd(source);
+  std::vector<uint32_t> todo;
+  todo.push_back(wide);
+  while (!todo.empty()) {
+    const WideNode& node = nodes[todo.back()];
+    todo.pop_back();
+    for (uint32_t k = 0; k < node.child_count; k++) {
+      if (node.counts[k] == 0) {
+        todo.push_back(node.children[k]);
+        unreachable++;
+      }
+    }
+  }
+  for (uint32_t n = source + 1; n < end; n++) {
+    lanes[n] = none;
+  }
+  const auto& root = binary[source];
+  if (wide != 0 && root.isLeaf() && root.primitive_count > 0) {
+    // The subtree was rebuilt into one leaf. Put it in the parent's lane,
+    // which refits of the leaf update, and leave the wide node behind.
+    const uint32_t lane = lanes[source];
+    WideNode& parent = nodes[lane / WideNode::width];
+    parent.children[lane % WideNode::width] = root.start;
+    parent.counts[lane % WideNode::width] = root.primitive_count;
+    refit(source, root.bbox);
+    unreachable++;
+  } else {
+    collapse(binary, source, wide);
+  }
+
+  if (2 * unreachable > nodes.size()) {
+    *this = WideBVH(bvh);
+  } else if (!root.isLeaf()) {
+    measureDepth(wide, wide_depth);
+  }
+}
+
+}  // namespace FastBVH
@@ -0,0 +1,342 @@
+#pragma once
+
+#include "FastBVH/Traverser.h"
+#include "FastBVH/WideBVH.h"
+#include "GeometricPrimitives.h"
+#include <immintrin.h>
+
+namespace FastBVH {
+
+    //! \brief Used for traversing a @ref WideBVH and checking for ray-primitive intersections.
+    //! Tests all children of a node against the segment with one AVX slab test,
+    //! and visits the children that were hit from nearest to farthest.
+    //! \tparam Primitive The type of primitive in the BVH,
+    //! which needs an IsBlocking overload taking a pointer to it.
+    //! \tparam Intersector The type of the primitive intersector.
+    //! \tparam StackSize The size of the working set on the call stack.
+    //! Each node pushes at most seven more entries than it pops,
+    //! so this fits trees whose deepest node is (StackSize - 8) / 7 levels deep.
+    //! Deeper trees are traversed with a working set on the heap.
+    template <typename Primitive, typename Intersector, std::size_t StackSize = 128>
+    class WideTraverser final
+    {
+        const WideBVH<Primitive>& bvh;
+        Intersector intersector;
+
+        //! Traverses the children hit by the segment, nearest first,
+        //! skipping leaves that are missed by the shaft, if there is one.
+        template <typename Shaft>
+        const Primitive* traverseWith(
+            const OptSegment& segment,
+            const Vec3 peeks[NUM_PEEKS],
+            const CharacterBounds& bounds,
+            const Shaft& shaft,
+            TraversalStats* stats);
+
+        //! Does the work of @ref traverseWith with the given working set.
+        template <typename Stack, typename Shaft>
+        const Primitive* traverseWithStack(
+            Stack& todo,
+            const OptSegment& segment,
+            const Vec3 peeks[NUM_PEEKS],
+            const CharacterBounds& bounds,
+            const Shaft& shaft,
+            TraversalStats* stats);
+
+    public:
+        //! Constructs a new wide BVH traverser.
+        //! \param bvh_ The BVH to be traversed.
+        constexpr WideTraverser(const WideBVH<Primitive>& bvh_, const Intersector& intersector_) noexcept
+            : bvh(bvh_), intersector(intersector_) {}
+        // Traces single ray through the BVH, returning a primitive that
+        // blocks LOS between peeks and the verticies of an enemy bounding box,
+        // or NULL if no primitive does.
+        // If stats is not null, adds the work done by the traversal to it.
+        const Primitive* traverse(
+            const OptSegment& segment,
+            const Vec3 peeks[NUM_PEEKS],
+            const CharacterBounds& Bounds,
+            TraversalStats* stats = nullptr);
+        // Traces the whole bundle through the BVH as a shaft, returning
+        // the same as traverse, but testing fewer primitives.
+        // Since primitives are convex, a blocking primitive intersects the segment
+        // from each peek to the center of the enemy vertices it is tested
+        // against, so leaves whose box misses any of those segments are skipped.
+        const Primitive* traverseShaft(
+            const OptSegment& segment,
+            const Vec3 peeks[NUM_PEEKS],
+            const CharacterBounds& Bounds,
+            TraversalStats* stats = nullptr);
+    };
+
+    //! \brief Contains implementation details for the @ref WideTraverser class.
+    namespace WideTraverserImpl {
+
+        //! \brief Entry of the working set: either a node, or the primitives of a leaf.
+        struct Traversal final
+        {
+            //! The index of the node, or of the first primitive of the leaf.
+            uint32_t i;
+
+            //! The number of primitives in the leaf, or zero for a node.
+            uint32_t count;
+        };
+
+        //! \brief Accepts every leaf, for traversing a single segment.
+        struct NoShaft final
+        {
+            static constexpr bool enabled = false;
+            inline bool test(const WideNode&, uint32_t) const { return true; }
+        };
+
+        //! \brief The segments from each peek to the center of the enemy
+        //! vertices that IsBlocking tests it against, in SSE lanes,
+        //! to test one box against all of them at once.
+        struct PeekShaft final
+        {
+            static constexpr bool enabled = true;
+            __m128 StartXs;
+            __m128 StartYs;
+            __m128 StartZs;
+            __m128 ReciprocalXs;
+            __m128 ReciprocalYs;
+            __m128 ReciprocalZs;
+
+            PeekShaft(const Vec3 peeks[NUM_PEEKS], const CharacterBounds& bounds)
+            {
+                static_assert(NUM_PEEKS == 4, "A shaft holds one segment per SSE lane.");
+                // Top peeks see the top vertices, and bottom peeks the bottom ones.
+                const __m128 Quarter = _mm_set1_ps(0.25f);
+                const __m128 TopXs = _mm_mul_ps(Quarter, _mm_set1_ps(bounds.Xs[0] + bounds.Xs[1] + bounds.Xs[2] + bounds.Xs[3]));
+                const __m128 TopYs = _mm_mul_ps(Quarter, _mm_set1_ps(bounds.Ys[0] + bounds.Ys[1] + bounds.Ys[2] + bounds.Ys[3]));
+                const __m128 TopZs = _mm_mul_ps(Quarter, _mm_set1_ps(bounds.Zs[0] + bounds.Zs[1] + bounds.Zs[2] + bounds.Zs[3]));
+                const __m128 BottomXs = _mm_mul_ps(Quarter, _mm_set1_ps(bounds.Xs[4] + bounds.Xs[5] + bounds.Xs[6] + bounds.Xs[7]));
+                const __m128 BottomYs = _mm_mul_ps(Quarter, _mm_set1_ps(bounds.Ys[4] + bounds.Ys[5] + bounds.Ys[6] + bounds.Ys[7]));
+                const __m128 BottomZs = _mm_mul_ps(Quarter, _mm_set1_ps(bounds.Zs[4] + bounds.Zs[5] + bounds.Zs[6] + bounds.Zs[7]));
+                StartXs = _mm_setr_ps(peeks[0].X, peeks[1].X, peeks[2].X, peeks[3].X);
+                StartYs = _mm_setr_ps(peeks[0].Y, peeks[1].Y, peeks[2].Y, peeks[3].Y);
+                StartZs = _mm_setr_ps(peeks[0].Z, peeks[1].Z, peeks[2].Z, peeks[3].Z);
+                // Lanes 0 and 1 end at the top center, lanes 2 and 3 at the bottom.
+                ReciprocalXs = reciprocal(_mm_sub_ps(_mm_shuffle_ps(TopXs, BottomXs, 0), StartXs));
+                ReciprocalYs = reciprocal(_mm_sub_ps(_mm_shuffle_ps(TopYs, BottomYs, 0), StartYs));
+                ReciprocalZs = reciprocal(_mm_sub_ps(_mm_shuffle_ps(TopZs, BottomZs, 0), StartZs));
+            }
+
+            //! Takes the reciprocal of each lane as Vec3::Reciprocal does.
+            static inline __m128 reciprocal(__m128 Deltas)
+            {
+                const __m128 Zeros = _mm_cmpeq_ps(Deltas, _mm_setzero_ps());
+                return _mm_blendv_ps(
+                    _mm_div_ps(_mm_set1_ps(1.f), Deltas),
+                    _mm_set1_ps(VEC3_BIG_NUMBER),
+                    Zeros);
+            }
+
+            //! Checks if every segment of the shaft hits the box of a child.
+            inline bool test(const WideNode& node, uint32_t k) const
+            {
+                __m128 T1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min_xs[k]), StartXs), ReciprocalXs);
+                __m128 T2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max_xs[k]), StartXs), ReciprocalXs);
+                __m128 TMins = _mm_min_ps(T1, T2);
+                __m128 TMaxs = _mm_max_ps(T1, T2);
+                T1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min_ys[k]), StartYs), ReciprocalYs);
+                T2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max_ys[k]), StartYs), ReciprocalYs);
+                TMins = _mm_max_ps(TMins, _mm_min_ps(T1, T2));
+                TMaxs = _mm_min_ps(TMaxs, _mm_max_ps(T1, T2));
+                T1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min_zs[k]), StartZs), ReciprocalZs);
+                T2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max_zs[k]), StartZs), ReciprocalZs);
+                TMins = _mm_max_ps(TMins, _mm_min_ps(T1, T2));
+                TMaxs = _mm_min_ps(TMaxs, _mm_max_ps(T1, T2));
+                __m128 Hits = _mm_and_ps(
+                    _mm_cmple_ps(TMins, TMaxs),
+                    _mm_and_ps(
+                        _mm_cmpge_ps(TMaxs, _mm_setzero_ps()),
+                        _mm_cmple_ps(TMins, _mm_set1_ps(1.f))));
+                return _mm_movemask_ps(Hits) == 0xF;
+            }
+        };
+
+    }  // namespace WideTraverserImpl
+
+    template <typename Primitive, typename Intersector, std::size_t StackSize>
+    const Primitive*
+    WideTraverser<Primitive, Intersector, StackSize>::traverse(
+        const OptSegment& segment,
+        const Vec3 peeks[NUM_PEEKS],
+        const CharacterBounds& bounds,
+        TraversalStats* stats)
+    {
+        return traverseWith(segment, peeks, bounds, WideTraverserImpl::NoShaft(), stats);
+    }
+
+    template <typename Primitive, typename Intersector, std::size_t StackSize>
+    const Primitive*
+    WideTraverser<Primitive, Intersector, StackSize>::traverseShaft(
+        const OptSegment& segment,
+        const Vec3 peeks[NUM_PEEKS],
+        const CharacterBounds& bounds,
+        TraversalStats* stats)
+    {
+        return traverseWith(segment, peeks, bounds, WideTraverserImpl::PeekShaft(peeks, bounds), stats);
+    }
+
+    template <typename Primitive, typename Intersector, std::size_t StackSize>
+    template <typename Shaft>
+    const Primitive*
+    WideTraverser<Primitive, Intersector, StackSize>::traverseWith(
+        const OptSegment& segment,
+        const Vec3 peeks[NUM_PEEKS],
+        const CharacterBounds& bounds,
+        const Shaft& shaft,
+        TraversalStats* stats)
+    {
+        using Traversal = WideTraverserImpl::Traversal;
+        if (7 * std::size_t(bvh.getDepth()) + WideNode::width <= StackSize)
+        {
+            FixedStack<Traversal, StackSize> todo;
+            return traverseWithStack(todo, segment, peeks, bounds, shaft, stats);
+        }
+        GrowableStack<Traversal> todo;
+        return traverseWithStack(todo, segment, peeks, bounds, shaft, stats);
+    }
+
+    template <typename Primitive, typename Intersector, std::size_t StackSize>
+    template <typename Stack, typename Shaft>
+    const Primitive*
+    WideTraverser<Primitive, Intersector, StackSize>::traverseWithStack(
+        Stack& todo,
+        const OptSegment& segment,
+        const Vec3 peeks[NUM_PEEKS],
+        const CharacterBounds& bounds,
+        const Shaft& shaft,
+        TraversalStats* stats)
+    {
+    using Traversal = WideTraverserImpl::Traversal;
+
+    const auto nodes = bvh.getNodes();
+    const auto build_prims = bvh.getPrimitives();
+
+    todo.push(Traversal{0, 0});
+
+    const __m256 StartXs = _mm256_set1_ps(segment.Start.X);
+    const __m256 StartYs = _mm256_set1_ps(segment.Start.Y);
+    const __m256 StartZs = _mm256_set1_ps(segment.Start.Z);
+    const __m256 ReciprocalXs = _mm256_set1_ps(segment.Reciprocal.X);
+    const __m256 ReciprocalYs = _mm256_set1_ps(segment.Reciprocal.Y);
+    const __m256 ReciprocalZs = _mm256_set1_ps(segment.Reciprocal.Z);
+    const __m256 Zeros = _mm256_setzero_ps();
+    const __m256 Ones = _mm256_set1_ps(1.f);
+
+    // Counted locally, so that untracked traversals only pay for increments.
+    uint64_t nodes_visited = 0;
+    uint64_t primitives_tested = 0;
+    const Primitive* blocking = NULL;
+
+    while (!todo.empty() && blocking == NULL)
+    {
+        // Pop off the next entry to work on.
+        const Traversal current = todo.pop();
+
+        // Leaf -> Intersect
+        if (current.count > 0)
+        {
+            for (uint32_t o = 0; o < current.count; ++o)
+            {
+                const auto& obj = build_prims[current.i + o];
+                primitives_tested++;
+                Intersection<float, Primitive> hit = intersector(obj, segment);
+                if (hit)
+                {
+                    if (
+                        IsBlocking(
+                            peeks,
+                            bounds,
+                            hit.IntersectedP))
+                    {
+                        blocking = hit.IntersectedP;
+                        break;
+                    }
+                }
+            }
+            continue;
+        }
+
+        // Node -> Slab test all children at once.
+        const WideNode& node = nodes[current.i];
+        nodes_visited++;
+        __m256 T1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_xs), StartXs), ReciprocalXs);
+        __m256 T2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_xs), StartXs), ReciprocalXs);
+        __m256 TMins = _mm256_min_ps(T1, T2);
+        __m256 TMaxs = _mm256_max_ps(T1, T2);
+        T1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_ys), StartYs), ReciprocalYs);
+        T2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_ys), StartYs), ReciprocalYs);
+        TMins = _mm256_max_ps(TMins, _mm256_min_ps(T1, T2));
+        TMaxs = _mm256_min_ps(TMaxs, _mm256_max_ps(T1, T2));
+        T1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_zs), StartZs), ReciprocalZs);
+        T2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_zs), StartZs), ReciprocalZs);
+        TMins = _mm256_max_ps(TMins, _mm256_min_ps(T1, T2));
+        TMaxs = _mm256_min_ps(TMaxs, _mm256_max_ps(T1, T2));
+        // Hit if the slabs overlap somewhere within the segment.
+        __m256 Hits = _mm256_and_ps(
+            _mm256_cmp_ps(TMins, TMaxs, _CMP_LE_OQ),
+            _mm256_and_ps(
+                _mm256_cmp_ps(TMaxs, Zeros, _CMP_GE_OQ),
+                _mm256_cmp_ps(TMins, Ones, _CMP_LE_OQ)));
+        uint32_t HitMask =
+            uint32_t(_mm256_movemask_ps(Hits)) & ((1u << node.child_count) - 1);
+        if (HitMask == 0)
+        {
+            continue;
+        }
+        if (Shaft::enabled)
+        {
+            // Only leaves are tested against the shaft, since their cuboids
+            // are what it saves, and most inner boxes contain the shaft anyway.
+            for (uint32_t Lane = 0; Lane < node.child_count; Lane++)
+            {
+                if ((HitMask & (1u << Lane)) != 0 && node.counts[Lane] > 0 && !shaft.test(node, Lane))
+                {
+                    HitMask &= ~(1u << Lane);
+                }
+            }
+            if (HitMask == 0)
+            {
+                continue;
+            }
+        }
+
+        // Push the children that were hit from farthest to nearest,
+        // so that the nearest is popped first.
+        alignas(32) float Nears[WideNode::width];
+        _mm256_store_ps(Nears, TMins);
+        uint32_t Lanes[WideNode::width];
+        int HitCount = 0;
+        for (uint32_t Lane = 0; Lane < node.child_count; Lane++)
+        {
+            if ((HitMask & (1u << Lane)) == 0)
+            {
+                continue;
+            }
+            // Insertion sort by descending entry time.
+            int k = HitCount++;
+            while (k > 0 && Nears[Lanes[k - 1]] < Nears[Lane])
+            {
+                Lanes[k] = Lanes[k - 1];
+                k--;
+            }
+            Lanes[k] = Lane;
+        }
+        for (int k = 0; k < HitCount; k++)
+        {
+            todo.push(Traversal{node.children[Lanes[k]], node.counts[Lanes[k]]});
+        }
+    }
+    if (stats != nullptr)
+    {
+        stats->traversals++;
+        stats->nodes_visited += nodes_visited;
+        stats->primitives_tested += primitives_tested;
+    }
+    return blocking;
+    }
+}  // namespace FastBVH
@@ -1,8 +1,11 @@
 #pragma once
 
-#include "Containers/Array.h"
-#include "Math/Vector.h"
+#include "CullingSettings.h"
+#include "Vec3.h"
 #include <algorithm>
+#include <cstdint>
+#include <immintrin.h>
+#include <limits>
 #include <vector>
 
 // Number of vertices and faces of a cuboid.
@@ -22,45 +25,27 @@ constexpr char FaceCuboidMap[6][4] =
     4, 7, 6, 5
 };
 
-// Quadrilateral face of a cuboid.
-struct Face
-{
-	FVector Normal;
-    // Index of the face in its the Cuboid;
-	//	   .+---------+  
-	//	 .' |  0    .'|  
-	//	+---+-----+'  |  
-	//	|   |    3|   |  
-	//	| 4 |     | 2 |  
-	//	|   |1    |   |  
-	//	|  ,+-----+---+  
-	//	|.'    5  | .'   
-	//	+---------+'    
-	//	1 is in front.
-	char Index;
-	Face() {}
-	Face(int i, FVector Vertices[])
-    {
-		Normal = FVector::CrossProduct(
-			Vertices[FaceCuboidMap[i][1]] - Vertices[FaceCuboidMap[i][0]],
-			Vertices[FaceCuboidMap[i][2]] - Vertices[FaceCuboidMap[i][0]]
-		).GetSafeNormal(1e-9);
-	}
-	Face(const Face& F)
-    {
-        Index = F.Index;
-		Normal = FVector(F.Normal);
-	}
-};
-
-// A six-sided polyhedron defined by 8 vertices.
+// Vertices of a six-sided polyhedron.
 // A valid configuration of vertices is user-enforced.
 // For example, all vertices of a face should be coplanar.
-struct Cuboid
+// Faces are indexed as such:
+//	   .+---------+  
+//	 .' |  0    .'|  
+//	+---+-----+'  |  
+//	|   |    3|   |  
+//	| 4 |     | 2 |  
+//	|   |1    |   |  
+//	|  ,+-----+---+  
+//	|.'    5  | .'   
+//	+---------+'    
+//	1 is in front.
+// Vertices are cold data, only read to build bounding boxes, record traces,
+// and draw the cuboid, so they are kept apart from the face planes of
+// Cuboid, which every intersection test reads.
+struct CuboidVertices
 {
-	Face Faces[CUBOID_F];
-	FVector Vertices[CUBOID_V];
-	Cuboid () {}
+	Vec3 Vertices[CUBOID_V];
+	CuboidVertices() {}
 	// Constructs a cuboid from a list of vertices.
 	// Vertices are ordered and indexed as such:
 	//	    .1------0
@@ -70,45 +55,67 @@ struct Cuboid
 	//	 |  .5--+---4
 	//	 |.'    | .'
 	//	 6------7'
-	Cuboid(TArray<FVector> V)
+	CuboidVertices(const std::vector<Vec3>& V)
     {
-		if (V.Num() != CUBOID_V)
+		if (V.size() != CUBOID_V)
         {
 			return;
 		}
 		for (int i = 0; i < CUBOID_V; i++)
         {
-			Vertices[i] = FVector(V[i]);
-		}
-		for (int i = 0; i < CUBOID_F; i++)
-        {
-			Faces[i] = Face(i, Vertices);
+			Vertices[i] = Vec3(V[i]);
 		}
 	}
-	Cuboid(const Cuboid& C)
+	// Return the vertex on face i with perimeter index j.
+	const Vec3& GetVertex(int i, int j) const
+    {
+		return Vertices[FaceCuboidMap[i][j]];
+	}
+};
+
+// Face planes of a six-sided polyhedron, in the face order of CuboidVertices.
+// Read by every intersection test, so they fill exactly two cache lines,
+// and the vertices stay in a separate cold array.
+struct alignas(64) Cuboid
+{
+    // Plane of face i is the set of points P where Normal | P == Offset,
+    // with normals pointing out of the cuboid.
+    // Stored in SIMD-friendly arrays. Lanes past CUBOID_F are zero.
+    float NormalXs[8] = { 0 };
+    float NormalYs[8] = { 0 };
+    float NormalZs[8] = { 0 };
+    float Offsets[8] = { 0 };
+	Cuboid () {}
+	// Constructs the face planes of a cuboid from its vertices.
+	explicit Cuboid(const CuboidVertices& V)
     {
-		for (int i = 0; i < CUBOID_V; i++)
-        {
-			Vertices[i] = FVector(C.Vertices[i]);
-		}
 		for (int i = 0; i < CUBOID_F; i++)
         {
-			Faces[i] = Face(C.Faces[i]);
+            Vec3 Normal = Vec3::CrossProduct(
+                V.GetVertex(i, 1) - V.GetVertex(i, 0),
+                V.GetVertex(i, 2) - V.GetVertex(i, 0)
+            ).GetSafeNormal(1e-9);
+            NormalXs[i] = Normal.X;
+            NormalYs[i] = Normal.Y;
+            NormalZs[i] = Normal.Z;
+            Offsets[i] = Normal | V.GetVertex(i, 0);
 		}
 	}
-	// Return the vertex on face i with perimeter index j.
-	const FVector& GetVertex(int i, int j) const
+    // Gets the outward normal of face i.
+    Vec3 GetNormal(int i) const
     {
-		return Vertices[FaceCuboidMap[i][j]];
-	}
+        return Vec3(NormalXs[i], NormalYs[i], NormalZs[i]);
+    }
 };
 
+static_assert(sizeof(Cuboid) == 128, "Cuboid planes should fill two cache lines.");
+
 struct Sphere
 {
-    FVector Center;
+    Vec3 Center;
     float Radius;
     Sphere() {}
-    Sphere(FVector Loc, float R)
+    Sphere(Vec3 Loc, float R)
     {
         Center = Loc;
         Radius = R;
@@ -120,6 +127,8 @@ struct Sphere
     }
 };
 
+static_assert(MAX_CHARACTERS <= 256, "Character indices are stored in a byte.");
+
 // Bundle representing lines of sight between a player's possible peeks
 // and an enemy's bounds. Bounds are stored in a field of
 // the CullingController to prevent data duplication.
@@ -127,68 +136,134 @@ struct Bundle
 {
 	unsigned char PlayerI;
 	unsigned char EnemyI;
-    std::vector<FVector> PossiblePeeks;
-	Bundle(int i, int j, const std::vector<FVector>& Peeks)
+    // Index of the culling state of the player, enemy pair.
+    uint32_t PairI;
+    // Corners of the rectangle of the player's possible peeks,
+    // stored inline so that queueing a bundle never allocates.
+    Vec3 PossiblePeeks[NUM_PEEKS];
+    Bundle() {}
+	Bundle(int i, int j, int Pair)
     {
 		PlayerI = i;
 		EnemyI = j;
-        PossiblePeeks = Peeks;
+        PairI = Pair;
 	}
 };
 
 // A volume that bounds a character.
-// Has a bounding sphere to quickly check visibility.
 // Uses the vertices of a bounding box to accurately check visibility.
-struct CharacterBounds
+// Vertices 0-3 are the top of the box and vertices 4-7 are the bottom,
+// so that the bottom half can be skipped when a player peeks it from above,
+// and vice versa for peeks from below.
+// This computational shortcut assumes that each bottom vertex is
+// directly below the corresponding top vertex.
+// Coordinates are stored in SIMD-friendly X, Y, and Z arrays.
+struct alignas(32) CharacterBounds
 {
-    // Location of character's camera.
-    FVector CameraLocation;
-    // Center of character and bounding spheres.
-    FVector Center;
-    float BoundingSphereRadius = 105;
-    // Divide vertices into top and bottom to skip the bottom half when
-    // a player peeks it from above, and vice versa for peeks from below.
-    // This computational shortcut assumes that each bottom vertex is
-    // directly below a corresponding top vertex.
-    std::vector<FVector> TopVertices;
-    std::vector<FVector> BottomVertices;
-    // We also precalculate and store representations optimized for SIMD.
-    __m256 TopVerticesXs;
-    __m256 TopVerticesYs;
-    __m256 TopVerticesZs;
-    __m256 BottomVerticesXs;
-    __m256 BottomVerticesYs;
-    __m256 BottomVerticesZs;
-    CharacterBounds(FVector CameraLocation, FTransform T)
+    // Radius of the bounding sphere about the character's center.
+    static constexpr float BoundingSphereRadius = 105;
+    float Xs[8];
+    float Ys[8];
+    float Zs[8];
+    CharacterBounds() {}
+    explicit CharacterBounds(const RigidTransform& T)
+    {
+        Set(T);
+    }
+
+    // Transforms the vertices of the character's local box,
+    // all eight at once, with the same arithmetic as
+    // RigidTransform::TransformPositionNoScale.
+    void Set(const RigidTransform& T)
     {
-        this->CameraLocation = CameraLocation;
-        Center = T.GetTranslation();
-        TopVertices.emplace_back(T.TransformPositionNoScale(FVector(30, 15, 100)));
-        TopVertices.emplace_back(T.TransformPositionNoScale(FVector(30, -15, 100)));
-        TopVertices.emplace_back(T.TransformPositionNoScale(FVector(-30, 15, 100)));
-        TopVertices.emplace_back(T.TransformPositionNoScale(FVector(-30, -15, 100)));
-        BottomVertices.emplace_back(T.TransformPositionNoScale(FVector(30, 15, -100)));
-        BottomVertices.emplace_back(T.TransformPositionNoScale(FVector(30, -15, -100)));
-        BottomVertices.emplace_back(T.TransformPositionNoScale(FVector(-30, 15, -100)));
-        BottomVertices.emplace_back(T.TransformPositionNoScale(FVector(-30, -15, -100)));
-        TopVerticesXs = _mm256_set_ps(
-            TopVertices[0].X, TopVertices[1].X, TopVertices[2].X, TopVertices[3].X, 
-            TopVertices[0].X, TopVertices[1].X, TopVertices[2].X, TopVertices[3].X);
-        TopVerticesYs = _mm256_set_ps(
-            TopVertices[0].Y, TopVertices[1].Y, TopVertices[2].Y, TopVertices[3].Y, 
-            TopVertices[0].Y, TopVertices[1].Y, TopVertices[2].Y, TopVertices[3].Y);
-        TopVerticesZs = _mm256_set_ps(
-            TopVertices[0].Z, TopVertices[1].Z, TopVertices[2].Z, TopVertices[3].Z, 
-            TopVertices[0].Z, TopVertices[1].Z, TopVertices[2].Z, TopVertices[3].Z);
-        BottomVerticesXs = _mm256_set_ps(
-            BottomVertices[0].X, BottomVertices[1].X, BottomVertices[2].X, BottomVertices[3].X, 
-            BottomVertices[0].X, BottomVertices[1].X, BottomVertices[2].X, BottomVertices[3].X);
-        BottomVerticesYs = _mm256_set_ps(
-            BottomVertices[0].Y, BottomVertices[1].Y, BottomVertices[2].Y, BottomVertices[3].Y, 
-            BottomVertices[0].Y, BottomVertices[1].Y, BottomVertices[2].Y, BottomVertices[3].Y);
-        BottomVerticesZs = _mm256_set_ps(
-            BottomVertices[0].Z, BottomVertices[1].Z, BottomVertices[2].Z, BottomVertices[3].Z, 
-            BottomVertices[0].Z, BottomVertices[1].Z, BottomVertices[2].Z, BottomVertices[3].Z);
+        const __m256 Xs0 = _mm256_setr_ps(30, 30, -30, -30, 30, 30, -30, -30);
+        const __m256 Ys0 = _mm256_setr_ps(15, -15, 15, -15, 15, -15, 15, -15);
+        const __m256 Zs0 = _mm256_setr_ps(100, 100, 100, 100, -100, -100, -100, -100);
+        const __m256 Two = _mm256_set1_ps(2);
+        const __m256 QX = _mm256_set1_ps(T.Rotation.X);
+        const __m256 QY = _mm256_set1_ps(T.Rotation.Y);
+        const __m256 QZ = _mm256_set1_ps(T.Rotation.Z);
+        const __m256 QW = _mm256_set1_ps(T.Rotation.W);
+        // 2 * (Q ^ V)
+        __m256 TXs = _mm256_mul_ps(
+            Two, _mm256_sub_ps(_mm256_mul_ps(QY, Zs0), _mm256_mul_ps(QZ, Ys0)));
+        __m256 TYs = _mm256_mul_ps(
+            Two, _mm256_sub_ps(_mm256_mul_ps(QZ, Xs0), _mm256_mul_ps(QX, Zs0)));
+        __m256 TZs = _mm256_mul_ps(
+            Two, _mm256_sub_ps(_mm256_mul_ps(QX, Ys0), _mm256_mul_ps(QY, Xs0)));
+        // V + W * T + (Q ^ T) + Translation
+        __m256 RXs = _mm256_add_ps(
+            _mm256_add_ps(Xs0, _mm256_mul_ps(QW, TXs)),
+            _mm256_sub_ps(_mm256_mul_ps(QY, TZs), _mm256_mul_ps(QZ, TYs)));
+        __m256 RYs = _mm256_add_ps(
+            _mm256_add_ps(Ys0, _mm256_mul_ps(QW, TYs)),
+            _mm256_sub_ps(_mm256_mul_ps(QZ, TXs), _mm256_mul_ps(QX, TZs)));
+        __m256 RZs = _mm256_add_ps(
+            _mm256_add_ps(Zs0, _mm256_mul_ps(QW, TZs)),
+            _mm256_sub_ps(_mm256_mul_ps(QX, TYs), _mm256_mul_ps(QY, TXs)));
+        _mm256_storeu_ps(Xs, _mm256_add_ps(RXs, _mm256_set1_ps(T.Translation.X)));
+        _mm256_storeu_ps(Ys, _mm256_add_ps(RYs, _mm256_set1_ps(T.Translation.Y)));
+        _mm256_storeu_ps(Zs, _mm256_add_ps(RZs, _mm256_set1_ps(T.Translation.Z)));
+    }
+
+    Vec3 GetVertex(int v) const
+    {
+        return Vec3(Xs[v], Ys[v], Zs[v]);
+    }
+    // Gets the coordinates of the top (Half 0) or bottom (Half 1) vertices,
+    // repeated in both 128-bit lanes to test against two peeks at once.
+    __m256 GetHalfXs(int Half) const
+    {
+        return _mm256_broadcast_ps(reinterpret_cast<const __m128*>(Xs + 4 * Half));
+    }
+    __m256 GetHalfYs(int Half) const
+    {
+        return _mm256_broadcast_ps(reinterpret_cast<const __m128*>(Ys + 4 * Half));
+    }
+    __m256 GetHalfZs(int Half) const
+    {
+        return _mm256_broadcast_ps(reinterpret_cast<const __m128*>(Zs + 4 * Half));
+    }
+};
+
+// Bounds of every character at one point in time,
+// with cameras and centers in structure-of-arrays form.
+// Filled in one pass over all characters, without allocating.
+struct BoundsSnapshot
+{
+    alignas(32) float CameraXs[MAX_CHARACTERS];
+    alignas(32) float CameraYs[MAX_CHARACTERS];
+    alignas(32) float CameraZs[MAX_CHARACTERS];
+    alignas(32) float CenterXs[MAX_CHARACTERS];
+    alignas(32) float CenterYs[MAX_CHARACTERS];
+    alignas(32) float CenterZs[MAX_CHARACTERS];
+    CharacterBounds Boxes[MAX_CHARACTERS];
+
+    // Bounds the first Count characters.
+    void Fill(
+        int Count,
+        const Vec3* CameraLocations,
+        const RigidTransform* Transforms)
+    {
+        for (int i = 0; i < Count; i++)
+        {
+            CameraXs[i] = CameraLocations[i].X;
+            CameraYs[i] = CameraLocations[i].Y;
+            CameraZs[i] = CameraLocations[i].Z;
+            CenterXs[i] = Transforms[i].Translation.X;
+            CenterYs[i] = Transforms[i].Translation.Y;
+            CenterZs[i] = Transforms[i].Translation.Z;
+            Boxes[i].Set(Transforms[i]);
+        }
+    }
+
+    Vec3 GetCameraLocation(int i) const
+    {
+        return Vec3(CameraXs[i], CameraYs[i], CameraZs[i]);
+    }
+    Vec3 GetCenter(int i) const
+    {
+        return Vec3(CenterXs[i], CenterYs[i], CenterZs[i]);
     }
 };
 
@@ -201,46 +276,64 @@ struct CharacterBounds
 // http://geomalgorithms.com/a13-_intersect-4.html
 inline float IntersectionTime(
     const Cuboid* C,
-    const FVector& Start,
-    const FVector& Direction,
+    const Vec3& Start,
+    const Vec3& Direction,
     const float MaxTime = 1)
 {
-    float TimeEnter = 0;
-    float TimeExit = MaxTime;
-    for (int i = 0; i < CUBOID_F; i++)
+    // Test all faces at once, one face per lane.
+    const __m256 Zero = _mm256_setzero_ps();
+    const __m256 NormalXs = _mm256_loadu_ps(C->NormalXs);
+    const __m256 NormalYs = _mm256_loadu_ps(C->NormalYs);
+    const __m256 NormalZs = _mm256_loadu_ps(C->NormalZs);
+    // Numerators of plane/line intersection tests.
+    __m256 Nums = _mm256_sub_ps(
+        _mm256_loadu_ps(C->Offsets),
+        _mm256_fmadd_ps(
+            NormalXs,
+            _mm256_set1_ps(Start.X),
+            _mm256_fmadd_ps(
+                NormalYs,
+                _mm256_set1_ps(Start.Y),
+                _mm256_mul_ps(NormalZs, _mm256_set1_ps(Start.Z)))));
+    __m256 Denoms = _mm256_fmadd_ps(
+        NormalXs,
+        _mm256_set1_ps(Direction.X),
+        _mm256_fmadd_ps(
+            NormalYs,
+            _mm256_set1_ps(Direction.Y),
+            _mm256_mul_ps(NormalZs, _mm256_set1_ps(Direction.Z))));
+    // Start is outside of a plane that the segment is parallel to,
+    // so it cannot intersect the Cuboid.
+    // Padding lanes have zero numerators, so they never trigger this.
+    if (0 !=
+        _mm256_movemask_ps(
+            _mm256_and_ps(
+                _mm256_cmp_ps(Denoms, Zero, _CMP_EQ_OQ),
+                _mm256_cmp_ps(Nums, Zero, _CMP_LT_OQ))))
     {
-        // Numerator of a plane/line intersection test.
-        const FVector& Normal = C->Faces[i].Normal;
-        float Num = (Normal | (C->GetVertex(i, 0) - Start));
-        float Denom = Normal | Direction;
-        if (Denom == 0)
-        {
-            // Start is outside of the plane,
-            // so it cannot intersect the Cuboid.
-            if (Num < 0)
-            {
-                return std::numeric_limits<double>::quiet_NaN();
-            }
-        }
-        else
-        {
-            float t = Num / Denom;
-            // The segment is entering the face.
-            if (Denom < 0)
-            {
-                TimeEnter = std::max(TimeEnter, t);
-            }
-            else
-            {
-                TimeExit = std::min(TimeExit, t);
-            }
-            // The segment exits before entering,
-            // so it cannot intersect the cuboid.
-            if (TimeEnter > TimeExit)
-            {
-                return std::numeric_limits<double>::quiet_NaN();
-            }
-        }
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    __m256 Times = _mm256_div_ps(Nums, Denoms);
+    // The segment enters faces with negative denominators
+    // and exits faces with positive ones.
+    __m256 EnterTimes = _mm256_blendv_ps(
+        Zero, Times, _mm256_cmp_ps(Denoms, Zero, _CMP_LT_OQ));
+    __m256 ExitTimes = _mm256_blendv_ps(
+        _mm256_set1_ps(MaxTime), Times, _mm256_cmp_ps(Denoms, Zero, _CMP_GT_OQ));
+    // Reduce across lanes.
+    EnterTimes = _mm256_max_ps(EnterTimes, _mm256_permute2f128_ps(EnterTimes, EnterTimes, 1));
+    EnterTimes = _mm256_max_ps(EnterTimes, _mm256_permute_ps(EnterTimes, 0x4E));
+    EnterTimes = _mm256_max_ps(EnterTimes, _mm256_permute_ps(EnterTimes, 0xB1));
+    ExitTimes = _mm256_min_ps(ExitTimes, _mm256_permute2f128_ps(ExitTimes, ExitTimes, 1));
+    ExitTimes = _mm256_min_ps(ExitTimes, _mm256_permute_ps(ExitTimes, 0x4E));
+    ExitTimes = _mm256_min_ps(ExitTimes, _mm256_permute_ps(ExitTimes, 0xB1));
+    float TimeEnter = _mm256_cvtss_f32(EnterTimes);
+    float TimeExit = _mm256_cvtss_f32(ExitTimes);
+    // The segment exits before entering,
+    // so it cannot intersect the cuboid.
+    if (TimeEnter > TimeExit)
+    {
+        return std::numeric_limits<double>::quiet_NaN();
     }
     return TimeEnter;
 }
@@ -264,21 +357,21 @@ inline bool IntersectsAll(
     __m256 ExitTimes = _mm256_set1_ps(1);
     for (int i = 0; i < CUBOID_F; i++)
     {
-        const FVector& Normal = C->Faces[i].Normal;
-        __m256 NormalXs = _mm256_set1_ps(Normal.X);
-        __m256 NormalYs = _mm256_set1_ps(Normal.Y);
-        __m256 NormalZs = _mm256_set1_ps(Normal.Z);
-        const FVector& Vertex = C->GetVertex(i, 0);
+        __m256 NormalXs = _mm256_set1_ps(C->NormalXs[i]);
+        __m256 NormalYs = _mm256_set1_ps(C->NormalYs[i]);
+        __m256 NormalZs = _mm256_set1_ps(C->NormalZs[i]);
+        // Offset - Normal | Start
         __m256 Nums =
-            _mm256_fmadd_ps(
-                _mm256_sub_ps(_mm256_set1_ps(Vertex.X), StartXs),
+            _mm256_fnmadd_ps(
+                StartXs,
                 NormalXs,
-                _mm256_fmadd_ps(
-                    _mm256_sub_ps(_mm256_set1_ps(Vertex.Y), StartYs),
+                _mm256_fnmadd_ps(
+                    StartYs,
                     NormalYs,
-                    _mm256_mul_ps(
-                        _mm256_sub_ps(_mm256_set1_ps(Vertex.Z), StartZs),
-                        NormalZs)));
+                    _mm256_fnmadd_ps(
+                        StartZs,
+                        NormalZs,
+                        _mm256_set1_ps(C->Offsets[i]))));
         __m256 Denoms =
             _mm256_fmadd_ps(
                 _mm256_sub_ps(EndXs, StartXs),
@@ -322,7 +415,7 @@ inline bool IntersectsAll(
 // Assumes that the BottomVerticies of the enemy bounding box are directly below
 // the TopVerticies.
 inline bool IsBlocking(
-    const std::vector<FVector>& Peeks,
+    const Vec3 Peeks[NUM_PEEKS],
     const CharacterBounds& Bounds,
     const Cuboid* C)
 {
@@ -339,7 +432,7 @@ inline bool IsBlocking(
         !IntersectsAll(
             C,
             StartXs, StartYs, StartZs,
-            Bounds.TopVerticesXs, Bounds.TopVerticesYs, Bounds.TopVerticesZs))
+            Bounds.GetHalfXs(0), Bounds.GetHalfYs(0), Bounds.GetHalfZs(0)))
     {
         return false;
     }
@@ -357,7 +450,7 @@ inline bool IsBlocking(
         return IntersectsAll(
             C,
             StartXs, StartYs, StartZs,
-            Bounds.BottomVerticesXs, Bounds.BottomVerticesYs, Bounds.BottomVerticesZs);
+            Bounds.GetHalfXs(1), Bounds.GetHalfYs(1), Bounds.GetHalfZs(1));
     }
 }
 
@@ -366,35 +459,28 @@ inline bool IsBlocking(
 // Uses sphere and line segment intersection with formula from:
 // http://paulbourke.net/geometry/circlesphere/index.html#linesphere
 inline bool IsBlocking(
-    const std::vector<FVector>& Peeks,
+    const Vec3 Peeks[NUM_PEEKS],
     const CharacterBounds& Bounds,
     const Sphere& OccludingSphere)
 {
     // Unpack constant variables outside of loop for performance.
-    const FVector SphereCenter = OccludingSphere.Center;
+    const Vec3 SphereCenter = OccludingSphere.Center;
     const float RadiusSquared = OccludingSphere.Radius * OccludingSphere.Radius;
-    for (int i = 0; i < Peeks.size(); i++)
+    for (int i = 0; i < NUM_PEEKS; i++)
     {
-        FVector PlayerToSphere = SphereCenter - Peeks[i];
-        const std::vector<FVector>* Vertices;
-        if (i < 2)
-        {
-            Vertices = &Bounds.TopVertices;
-        }
-        else
-        {
-            Vertices = &Bounds.BottomVertices;
-        }
-        for (FVector V : *Vertices)
+        Vec3 PlayerToSphere = SphereCenter - Peeks[i];
+        // Top vertices for the top peeks, bottom vertices for the bottom peeks.
+        int First = (i < 2) ? 0 : 4;
+        for (int v = First; v < First + 4; v++)
         {
-            FVector PlayerToEnemy = V - Peeks[i];
+            Vec3 PlayerToEnemy = Bounds.GetVertex(v) - Peeks[i];
             float u = (PlayerToEnemy | PlayerToSphere) / (PlayerToEnemy | PlayerToEnemy);
             // The point on the line between player and enemy that is closest to
             // the center of the occluding sphere lies between player and enemy.
             // Thus the sphere might intersect the line segment.
             if ((0 < u) && (u < 1))
             {
-                FVector ClosestPoint = Peeks[i] + u * PlayerToEnemy;
+                Vec3 ClosestPoint = Peeks[i] + u * PlayerToEnemy;
                 // The point lies within the radius of the sphere,
                 // so the sphere intersects the line segment.
                 if ((SphereCenter - ClosestPoint).SizeSquared() > RadiusSquared)
@@ -412,17 +498,26 @@ inline bool IsBlocking(
     return true;
 }
 
+// Pointer overload, so that BVH traversal can treat spheres like cuboids.
+inline bool IsBlocking(
+    const Vec3 Peeks[NUM_PEEKS],
+    const CharacterBounds& Bounds,
+    const Sphere* OccludingSphere)
+{
+    return IsBlocking(Peeks, Bounds, *OccludingSphere);
+}
+
 // Optimized line segment that stores:
 //   Start: The start position of the line segment.
 //   Delta: The displacement vector from Start to End.
 //   Reciprocal: The element-wise reciprocal of the displacement vector.
 struct OptSegment
 {
-    FVector Start;
-    FVector Reciprocal;
-    FVector Delta;
+    Vec3 Start;
+    Vec3 Reciprocal;
+    Vec3 Delta;
     OptSegment() {}
-    OptSegment(FVector Start, FVector End)
+    OptSegment(Vec3 Start, Vec3 End)
     {
         this->Start = Start;
         Delta = End - Start;
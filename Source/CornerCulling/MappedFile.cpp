@@ -0,0 +1,281 @@
+#include "MappedFile.h"
+#include <cstdint>
+#include <string>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const char* Path)
+{
+    Close();
+    HANDLE File = CreateFileA(
+        Path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (File == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER FileSize;
+    if (!GetFileSizeEx(File, &FileSize) || FileSize.QuadPart == 0)
+    {
+        CloseHandle(File);
+        return false;
+    }
+    HANDLE Mapping = CreateFileMappingA(File, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (Mapping == NULL)
+    {
+        CloseHandle(File);
+        return false;
+    }
+    void* View = MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+    if (View == NULL)
+    {
+        CloseHandle(Mapping);
+        CloseHandle(File);
+        return false;
+    }
+    FileHandle = File;
+    MappingHandle = Mapping;
+    Data = static_cast<unsigned char*>(View);
+    Size = std::size_t(FileSize.QuadPart);
+    return true;
+}
+
+bool MappedFile::OpenShared(const char* Name)
+{
+    Close();
+    std::string LocalName = std::string("Local\\") + Name;
+    HANDLE Mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, LocalName.c_str());
+    if (Mapping == NULL)
+    {
+        return false;
+    }
+    void* View = MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION Info;
+    if (View == NULL || VirtualQuery(View, &Info, sizeof(Info)) == 0)
+    {
+        if (View != NULL)
+        {
+            UnmapViewOfFile(View);
+        }
+        CloseHandle(Mapping);
+        return false;
+    }
+    MappingHandle = Mapping;
+    Data = static_cast<unsigned char*>(View);
+    // Whole pages, which may run past the end of the object's contents.
+    Size = std::size_t(Info.RegionSize);
+    return true;
+}
+
+bool MappedFile::CreateShared(
+    const char* Name,
+    std::size_t Size,
+    const std::function<void(unsigned char*)>& Fill)
+{
+    Close();
+    std::string LocalName = std::string("Local\\") + Name;
+    HANDLE Mapping = CreateFileMappingA(
+        INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        DWORD(uint64_t(Size) >> 32), DWORD(uint64_t(Size) & 0xFFFFFFFF), LocalName.c_str());
+    if (Mapping == NULL)
+    {
+        return false;
+    }
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        CloseHandle(Mapping);
+        return false;
+    }
+    void* Writable = MapViewOfFile(Mapping, FILE_MAP_WRITE, 0, 0, Size);
+    if (Writable == NULL)
+    {
+        CloseHandle(Mapping);
+        return false;
+    }
+    Fill(static_cast<unsigned char*>(Writable));
+    UnmapViewOfFile(Writable);
+    void* View = MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, Size);
+    if (View == NULL)
+    {
+        CloseHandle(Mapping);
+        return false;
+    }
+    MappingHandle = Mapping;
+    Data = static_cast<unsigned char*>(View);
+    this->Size = Size;
+    return true;
+}
+
+bool MappedFile::OpenOrCreateShared(const char* Name, std::size_t Size)
+{
+    Close();
+    std::string LocalName = std::string("Local\\") + Name;
+    HANDLE Mapping = CreateFileMappingA(
+        INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        DWORD(uint64_t(Size) >> 32), DWORD(uint64_t(Size) & 0xFFFFFFFF), LocalName.c_str());
+    if (Mapping == NULL)
+    {
+        return false;
+    }
+    void* View = MapViewOfFile(Mapping, FILE_MAP_WRITE, 0, 0, Size);
+    if (View == NULL)
+    {
+        CloseHandle(Mapping);
+        return false;
+    }
+    MappingHandle = Mapping;
+    Data = static_cast<unsigned char*>(View);
+    this->Size = Size;
+    ReadWrite = true;
+    return true;
+}
+
+void MappedFile::RemoveShared(const char* Name)
+{
+}
+
+void MappedFile::Close()
+{
+    if (Data != nullptr)
+    {
+        UnmapViewOfFile(Data);
+        CloseHandle(MappingHandle);
+        if (FileHandle != nullptr)
+        {
+            CloseHandle(FileHandle);
+        }
+    }
+    Data = nullptr;
+    Size = 0;
+    ReadWrite = false;
+    FileHandle = nullptr;
+    MappingHandle = nullptr;
+}
+
+#else
+
+namespace
+{
+    std::string GetSharedPath(const char* Name)
+    {
+        return std::string("/") + Name;
+    }
+}
+
+bool MappedFile::Open(const char* Path)
+{
+    Close();
+    return MapDescriptor(open(Path, O_RDONLY));
+}
+
+bool MappedFile::OpenShared(const char* Name)
+{
+    Close();
+    return MapDescriptor(shm_open(GetSharedPath(Name).c_str(), O_RDONLY, 0));
+}
+
+bool MappedFile::CreateShared(
+    const char* Name,
+    std::size_t Size,
+    const std::function<void(unsigned char*)>& Fill)
+{
+    Close();
+    const std::string Path = GetSharedPath(Name);
+    int Descriptor = shm_open(Path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (Descriptor < 0)
+    {
+        return false;
+    }
+    void* Writable = ftruncate(Descriptor, off_t(Size)) == 0
+        ? mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Descriptor, 0)
+        : MAP_FAILED;
+    if (Writable == MAP_FAILED)
+    {
+        close(Descriptor);
+        shm_unlink(Path.c_str());
+        return false;
+    }
+    Fill(static_cast<unsigned char*>(Writable));
+    munmap(Writable, Size);
+    if (!MapDescriptor(Descriptor))
+    {
+        shm_unlink(Path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::OpenOrCreateShared(const char* Name, std::size_t Size)
+{
+    Close();
+    int Descriptor = shm_open(GetSharedPath(Name).c_str(), O_RDWR | O_CREAT, 0600);
+    if (Descriptor < 0)
+    {
+        return false;
+    }
+    // Growing an object zeroes its new bytes, and it is never shrunk.
+    struct stat Status;
+    if (fstat(Descriptor, &Status) != 0
+        || (std::size_t(Status.st_size) < Size && ftruncate(Descriptor, off_t(Size)) != 0))
+    {
+        close(Descriptor);
+        return false;
+    }
+    return MapDescriptor(Descriptor, true);
+}
+
+void MappedFile::RemoveShared(const char* Name)
+{
+    shm_unlink(GetSharedPath(Name).c_str());
+}
+
+bool MappedFile::MapDescriptor(int Descriptor, bool Writable)
+{
+    if (Descriptor < 0)
+    {
+        return false;
+    }
+    struct stat Status;
+    if (fstat(Descriptor, &Status) != 0 || Status.st_size == 0)
+    {
+        close(Descriptor);
+        return false;
+    }
+    void* View = mmap(
+        nullptr, Status.st_size, Writable ? PROT_READ | PROT_WRITE : PROT_READ,
+        MAP_SHARED, Descriptor, 0);
+    // The mapping stays valid after its descriptor is closed.
+    close(Descriptor);
+    if (View == MAP_FAILED)
+    {
+        return false;
+    }
+    Data = static_cast<unsigned char*>(View);
+    Size = std::size_t(Status.st_size);
+    ReadWrite = Writable;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (Data != nullptr)
+    {
+        munmap(Data, Size);
+    }
+    Data = nullptr;
+    Size = 0;
+    ReadWrite = false;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// Memory mapping of a whole file, or of a named shared memory object.
+// Pages are shared with every other process that maps the same file or object.
+// Mappings are read-only, except those made by OpenOrCreateShared.
+class MappedFile
+{
+    unsigned char* Data = nullptr;
+    std::size_t Size = 0;
+    bool ReadWrite = false;
+#if defined(_WIN32)
+    void* FileHandle = nullptr;
+    void* MappingHandle = nullptr;
+#else
+    // Maps the whole of an open file, closing its descriptor.
+    bool MapDescriptor(int Descriptor, bool Writable = false);
+#endif
+
+public:
+    MappedFile() {}
+    ~MappedFile() { Close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps the file at Path, returning false if it cannot be mapped.
+    bool Open(const char* Path);
+    // Maps the shared memory object called Name, which another process
+    // created with CreateShared, returning false if there is none.
+    bool OpenShared(const char* Name);
+    // Creates a shared memory object of Size bytes called Name, lets Fill
+    // write it, then maps it read-only like OpenShared. Returns false if
+    // an object of that name already exists.
+    // On Windows, the object lasts while a process maps it. Elsewhere, it
+    // lasts until the host restarts or RemoveShared is called.
+    bool CreateShared(
+        const char* Name,
+        std::size_t Size,
+        const std::function<void(unsigned char*)>& Fill);
+    // Maps the shared memory object called Name for reading and writing,
+    // creating it if there is none. Objects start zeroed, and are grown to
+    // at least Size bytes, so processes that race to create one see the same
+    // contents. The object lasts like one made by CreateShared.
+    bool OpenOrCreateShared(const char* Name, std::size_t Size);
+    // Removes the name of a shared memory object, so the next CreateShared
+    // can reuse it. Existing mappings stay valid. Does nothing on Windows.
+    static void RemoveShared(const char* Name);
+    // Unmaps the file. Pointers into the mapping become invalid.
+    void Close();
+
+    bool IsOpen() const { return Data != nullptr; }
+    const unsigned char* GetData() const { return Data; }
+    // Gets the mapping if it is writable, or null.
+    unsigned char* GetWritableData() const { return ReadWrite ? Data : nullptr; }
+    std::size_t GetSize() const { return Size; }
+};
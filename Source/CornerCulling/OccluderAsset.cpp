@@ -0,0 +1,360 @@
+#include "OccluderAsset.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    // The magic bytes as the word that publishers store atomically.
+    using MagicWord = std::atomic<unsigned long long>;
+    static_assert(
+        ATOMIC_LLONG_LOCK_FREE == 2 && sizeof(MagicWord) == sizeof(ASSET_MAGIC),
+        "Processes can only share atomics that need no lock.");
+
+    unsigned long long GetMagicWord()
+    {
+        unsigned long long Word;
+        std::memcpy(&Word, ASSET_MAGIC, sizeof(Word));
+        return Word;
+    }
+
+    uint64_t AlignOffset(uint64_t Offset)
+    {
+        return (Offset + ASSET_ALIGNMENT - 1) / ASSET_ALIGNMENT * ASSET_ALIGNMENT;
+    }
+
+    // Pads the file with zeros up to Offset, then writes Count records.
+    void WriteArray(
+        std::FILE* File,
+        uint64_t& Written,
+        uint64_t Offset,
+        const void* Records,
+        std::size_t Size,
+        std::size_t Count)
+    {
+        static const unsigned char Zeros[ASSET_ALIGNMENT] = { 0 };
+        std::fwrite(Zeros, 1, std::size_t(Offset - Written), File);
+        std::fwrite(Records, Size, Count, File);
+        Written = Offset + uint64_t(Size) * Count;
+    }
+
+    // Checks that every child of the nodes is a later node or a range
+    // of primitives, so that traversals stay in bounds and terminate.
+    bool ValidateNodes(
+        const FastBVH::WideNode* Nodes,
+        uint32_t NumNodes,
+        uint32_t NumPrimitives)
+    {
+        for (uint32_t n = 0; n < NumNodes; n++)
+        {
+            const FastBVH::WideNode& Node = Nodes[n];
+            if (Node.child_count > FastBVH::WideNode::width)
+            {
+                return false;
+            }
+            for (uint32_t k = 0; k < Node.child_count; k++)
+            {
+                const uint32_t Child = Node.children[k];
+                if (Node.counts[k] == 0)
+                {
+                    if (Child <= n || Child >= NumNodes)
+                    {
+                        return false;
+                    }
+                }
+                else if (uint64_t(Child) + Node.counts[k] > NumPrimitives)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // The occluders of a built core, laid out as an asset.
+    struct AssetContents
+    {
+        OccluderAssetHeader Header;
+        FastBVH::ConstIterable<Cuboid> Cuboids{nullptr, 0};
+        FastBVH::ConstIterable<Sphere> Spheres{nullptr, 0};
+        FastBVH::ConstIterable<FastBVH::WideNode> Nodes{nullptr, 0};
+        FastBVH::ConstIterable<FastBVH::WideNode> SphereNodes{nullptr, 0};
+        FastBVH::ConstIterable<CuboidVertices> Vertices{nullptr, 0};
+        // Size of the whole asset.
+        uint64_t Size = 0;
+    };
+
+    // Lays out the occluders of Core, returning false if they are not built.
+    bool GetAssetContents(const CullingCore& Core, AssetContents& Contents)
+    {
+        const FastBVH::WideBVH<Cuboid>* Wide = Core.GetCuboidWideBVH();
+        const FastBVH::WideBVH<Sphere>* SphereWide = Core.GetSphereWideBVH();
+        Contents.Cuboids = Core.GetCuboids();
+        Contents.Spheres = Core.GetSpheres();
+        Contents.Vertices = Core.GetCuboidVertices();
+        if ((Contents.Cuboids.size() > 0 && Wide == nullptr)
+            || (Contents.Spheres.size() > 0 && SphereWide == nullptr))
+        {
+            return false;
+        }
+        if (Wide != nullptr)
+        {
+            Contents.Nodes = Wide->getNodes();
+        }
+        if (SphereWide != nullptr)
+        {
+            Contents.SphereNodes = SphereWide->getNodes();
+        }
+
+        OccluderAssetHeader& Header = Contents.Header;
+        std::memset(&Header, 0, sizeof(Header));
+        std::memcpy(Header.Magic, ASSET_MAGIC, sizeof(ASSET_MAGIC));
+        Header.Version = ASSET_VERSION;
+        Header.CuboidSize = uint32_t(sizeof(Cuboid));
+        Header.SphereSize = uint32_t(sizeof(Sphere));
+        Header.WideNodeSize = uint32_t(sizeof(FastBVH::WideNode));
+        Header.VerticesSize = uint32_t(sizeof(CuboidVertices));
+        Header.OccluderHash = Core.GetOccluderHash();
+        Header.NumCuboids = uint32_t(Contents.Cuboids.size());
+        Header.NumSpheres = uint32_t(Contents.Spheres.size());
+        Header.NumWideNodes = uint32_t(Contents.Nodes.size());
+        Header.NumSphereNodes = uint32_t(Contents.SphereNodes.size());
+        Header.CuboidsOffset = AlignOffset(sizeof(Header));
+        Header.SpheresOffset = AlignOffset(
+            Header.CuboidsOffset + sizeof(Cuboid) * Contents.Cuboids.size());
+        Header.WideNodesOffset = AlignOffset(
+            Header.SpheresOffset + sizeof(Sphere) * Contents.Spheres.size());
+        Header.SphereNodesOffset = AlignOffset(
+            Header.WideNodesOffset + sizeof(FastBVH::WideNode) * Contents.Nodes.size());
+        Header.VerticesOffset = AlignOffset(
+            Header.SphereNodesOffset + sizeof(FastBVH::WideNode) * Contents.SphereNodes.size());
+        Contents.Size =
+            Header.VerticesOffset + sizeof(CuboidVertices) * Contents.Vertices.size();
+        return true;
+    }
+}
+
+bool BakeOccluderAsset(const char* Path, const CullingCore& Core)
+{
+    AssetContents Contents;
+    if (!GetAssetContents(Core, Contents))
+    {
+        return false;
+    }
+    const OccluderAssetHeader& Header = Contents.Header;
+    std::FILE* File = std::fopen(Path, "wb");
+    if (File == nullptr)
+    {
+        return false;
+    }
+    uint64_t Written = 0;
+    WriteArray(File, Written, 0, &Header, sizeof(Header), 1);
+    WriteArray(
+        File, Written, Header.CuboidsOffset,
+        Contents.Cuboids.begin(), sizeof(Cuboid), Contents.Cuboids.size());
+    WriteArray(
+        File, Written, Header.SpheresOffset,
+        Contents.Spheres.begin(), sizeof(Sphere), Contents.Spheres.size());
+    WriteArray(
+        File, Written, Header.WideNodesOffset,
+        Contents.Nodes.begin(), sizeof(FastBVH::WideNode), Contents.Nodes.size());
+    WriteArray(
+        File, Written, Header.SphereNodesOffset,
+        Contents.SphereNodes.begin(), sizeof(FastBVH::WideNode), Contents.SphereNodes.size());
+    WriteArray(
+        File, Written, Header.VerticesOffset,
+        Contents.Vertices.begin(), sizeof(CuboidVertices), Contents.Vertices.size());
+    bool Failed = std::ferror(File) != 0;
+    return std::fclose(File) == 0 && !Failed;
+}
+
+bool OccluderAsset::PublishShared(const char* Name, const CullingCore& Core)
+{
+    Header = nullptr;
+    AssetContents Contents;
+    if (!GetAssetContents(Core, Contents))
+    {
+        return false;
+    }
+    auto Fill = [&Contents](unsigned char* Image)
+    {
+        const OccluderAssetHeader& H = Contents.Header;
+        if (Contents.Cuboids.size() > 0)
+        {
+            std::memcpy(
+                Image + H.CuboidsOffset,
+                Contents.Cuboids.begin(),
+                sizeof(Cuboid) * Contents.Cuboids.size());
+        }
+        if (Contents.Spheres.size() > 0)
+        {
+            std::memcpy(
+                Image + H.SpheresOffset,
+                Contents.Spheres.begin(),
+                sizeof(Sphere) * Contents.Spheres.size());
+        }
+        if (Contents.Nodes.size() > 0)
+        {
+            std::memcpy(
+                Image + H.WideNodesOffset,
+                Contents.Nodes.begin(),
+                sizeof(FastBVH::WideNode) * Contents.Nodes.size());
+        }
+        if (Contents.SphereNodes.size() > 0)
+        {
+            std::memcpy(
+                Image + H.SphereNodesOffset,
+                Contents.SphereNodes.begin(),
+                sizeof(FastBVH::WideNode) * Contents.SphereNodes.size());
+        }
+        if (Contents.Vertices.size() > 0)
+        {
+            std::memcpy(
+                Image + H.VerticesOffset,
+                Contents.Vertices.begin(),
+                sizeof(CuboidVertices) * Contents.Vertices.size());
+        }
+        // Processes may map the object while it is filled, and only
+        // accept it once the header's magic is there. Write the rest of
+        // the header first, then the magic with a single atomic store.
+        OccluderAssetHeader Unpublished = H;
+        std::memset(Unpublished.Magic, 0, sizeof(Unpublished.Magic));
+        std::memcpy(Image, &Unpublished, sizeof(Unpublished));
+        std::atomic_thread_fence(std::memory_order_release);
+        reinterpret_cast<MagicWord*>(Image)->store(GetMagicWord(), std::memory_order_relaxed);
+    };
+    if (File.CreateShared(Name, std::size_t(Contents.Size), Fill))
+    {
+        return Validate();
+    }
+    // Leave the occluders if another process published them first.
+    if (OpenShared(Name, Contents.Header.OccluderHash))
+    {
+        Header = nullptr;
+        File.Close();
+        return false;
+    }
+    // Replace whatever else is there. Processes that mapped it, including
+    // a publisher still writing it, keep their mapping until they close it.
+    MappedFile::RemoveShared(Name);
+    return File.CreateShared(Name, std::size_t(Contents.Size), Fill) && Validate();
+}
+
+bool OccluderAsset::Open(const char* Path)
+{
+    Header = nullptr;
+    return File.Open(Path) && Validate();
+}
+
+bool OccluderAsset::OpenShared(const char* Name, uint64_t OccluderHash)
+{
+    Header = nullptr;
+    if (!File.OpenShared(Name) || !Validate())
+    {
+        return false;
+    }
+    if (Header->OccluderHash != OccluderHash)
+    {
+        Header = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool OccluderAsset::Validate()
+{
+    if (File.GetSize() < sizeof(OccluderAssetHeader))
+    {
+        return false;
+    }
+    const OccluderAssetHeader* H =
+        reinterpret_cast<const OccluderAssetHeader*>(File.GetData());
+    // Read nothing that the magic publishes before the magic itself.
+    const unsigned long long Magic =
+        reinterpret_cast<const MagicWord*>(File.GetData())->load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (Magic != GetMagicWord()
+        || H->Version != ASSET_VERSION
+        || H->CuboidSize != sizeof(Cuboid)
+        || H->SphereSize != sizeof(Sphere)
+        || H->WideNodeSize != sizeof(FastBVH::WideNode)
+        || H->VerticesSize != sizeof(CuboidVertices)
+        || (H->NumCuboids > 0 && H->NumWideNodes == 0)
+        || (H->NumSpheres > 0 && H->NumSphereNodes == 0))
+    {
+        return false;
+    }
+    // Reject misaligned arrays and truncated assets.
+    const uint64_t Ends[5] = {
+        H->CuboidsOffset + uint64_t(H->NumCuboids) * sizeof(Cuboid),
+        H->SpheresOffset + uint64_t(H->NumSpheres) * sizeof(Sphere),
+        H->WideNodesOffset + uint64_t(H->NumWideNodes) * sizeof(FastBVH::WideNode),
+        H->SphereNodesOffset + uint64_t(H->NumSphereNodes) * sizeof(FastBVH::WideNode),
+        H->VerticesOffset + uint64_t(H->NumCuboids) * sizeof(CuboidVertices)
+    };
+    const uint64_t Offsets[5] = {
+        H->CuboidsOffset,
+        H->SpheresOffset,
+        H->WideNodesOffset,
+        H->SphereNodesOffset,
+        H->VerticesOffset
+    };
+    for (int i = 0; i < 5; i++)
+    {
+        if (Offsets[i] % ASSET_ALIGNMENT != 0
+            || Offsets[i] < sizeof(OccluderAssetHeader)
+            || Ends[i] > File.GetSize())
+        {
+            return false;
+        }
+    }
+    const unsigned char* Data = File.GetData();
+    if (!ValidateNodes(
+            reinterpret_cast<const FastBVH::WideNode*>(Data + H->WideNodesOffset),
+            H->NumWideNodes,
+            H->NumCuboids)
+        || !ValidateNodes(
+            reinterpret_cast<const FastBVH::WideNode*>(Data + H->SphereNodesOffset),
+            H->NumSphereNodes,
+            H->NumSpheres))
+    {
+        return false;
+    }
+    Header = H;
+    return true;
+}
+
+FastBVH::ConstIterable<Cuboid> OccluderAsset::GetCuboids() const
+{
+    return FastBVH::ConstIterable<Cuboid>(
+        reinterpret_cast<const Cuboid*>(File.GetData() + Header->CuboidsOffset),
+        Header->NumCuboids);
+}
+
+FastBVH::ConstIterable<Sphere> OccluderAsset::GetSpheres() const
+{
+    return FastBVH::ConstIterable<Sphere>(
+        reinterpret_cast<const Sphere*>(File.GetData() + Header->SpheresOffset),
+        Header->NumSpheres);
+}
+
+FastBVH::ConstIterable<FastBVH::WideNode> OccluderAsset::GetWideNodes() const
+{
+    return FastBVH::ConstIterable<FastBVH::WideNode>(
+        reinterpret_cast<const FastBVH::WideNode*>(File.GetData() + Header->WideNodesOffset),
+        Header->NumWideNodes);
+}
+
+FastBVH::ConstIterable<FastBVH::WideNode> OccluderAsset::GetSphereNodes() const
+{
+    return FastBVH::ConstIterable<FastBVH::WideNode>(
+        reinterpret_cast<const FastBVH::WideNode*>(File.GetData() + Header->SphereNodesOffset),
+        Header->NumSphereNodes);
+}
+
+FastBVH::ConstIterable<CuboidVertices> OccluderAsset::GetCuboidVertices() const
+{
+    return FastBVH::ConstIterable<CuboidVertices>(
+        reinterpret_cast<const CuboidVertices*>(File.GetData() + Header->VerticesOffset),
+        Header->NumCuboids);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "CullingCore.h"
+#include "MappedFile.h"
+#include <cstdint>
+
+// Baked occluders, for starting servers without building a BVH.
+//
+// An asset stores the cuboids and spheres of a map in BVH leaf order,
+// and the nodes of the wide cuboid and sphere BVHs that culling traverses.
+// The vertices of the cuboids follow in a section of their own, which culling
+// never reads, so their pages stay cold unless a trace is recorded.
+// Records are stored in the in-memory layout of this build, and nodes
+// refer to each other and to cuboids by index, so a read-only memory
+// mapping of the file is used in place: loading allocates nothing per
+// occluder, and every server process on a machine shares the pages.
+// The same layout can be published to named shared memory, so that servers
+// on a host share one copy of a map without baking a file: the first server
+// builds the occluders and publishes them, and the rest map them.
+//
+// File layout, in native (little-endian) byte order:
+//   OccluderAssetHeader
+//   Cuboid[NumCuboids]
+//   Sphere[NumSpheres]
+//   FastBVH::WideNode[NumWideNodes]
+//   FastBVH::WideNode[NumSphereNodes]
+//   CuboidVertices[NumCuboids]
+// Each array starts at a multiple of ASSET_ALIGNMENT from the start
+// of the file, which keeps the mapped records aligned.
+//
+// NOTE:
+//   Moving cuboids are baked where they start, and do not move.
+
+// Version of the asset format. Bump on any layout change.
+constexpr uint32_t ASSET_VERSION = 4;
+// Magic bytes at the start of every asset.
+constexpr char ASSET_MAGIC[8] = { 'C', 'C', 'O', 'C', 'C', 'L', 'D', 0 };
+// Alignment of each array in an asset.
+constexpr uint64_t ASSET_ALIGNMENT = 64;
+
+struct OccluderAssetHeader
+{
+    // Written last, as one atomic word, when published to shared memory.
+    char Magic[8];
+    uint32_t Version;
+    // Sizes of the stored records, which must match this build's layout.
+    uint32_t CuboidSize;
+    uint32_t SphereSize;
+    uint32_t WideNodeSize;
+    uint32_t VerticesSize;
+    uint32_t NumCuboids;
+    uint32_t NumSpheres;
+    uint32_t NumWideNodes;
+    uint32_t NumSphereNodes;
+    uint32_t Padding;
+    // Offsets of each array from the start of the file.
+    uint64_t CuboidsOffset;
+    uint64_t SpheresOffset;
+    uint64_t WideNodesOffset;
+    uint64_t SphereNodesOffset;
+    uint64_t VerticesOffset;
+    // CullingCore::GetOccluderHash of the stored occluders.
+    uint64_t OccluderHash;
+};
+
+static_assert(sizeof(OccluderAssetHeader) == 96, "Asset layout changed.");
+static_assert(alignof(Cuboid) <= ASSET_ALIGNMENT, "Cuboids would be misaligned.");
+static_assert(alignof(FastBVH::WideNode) <= ASSET_ALIGNMENT, "Nodes would be misaligned.");
+
+// Writes the occluders of Core to an asset at Path.
+// Call after Core.BuildOccluders.
+bool BakeOccluderAsset(const char* Path, const CullingCore& Core);
+
+// Reads an asset in place from a read-only memory mapping.
+class OccluderAsset
+{
+    MappedFile File;
+    const OccluderAssetHeader* Header = nullptr;
+
+    // Validates the mapped asset, including every index stored in its nodes.
+    bool Validate();
+
+public:
+    // Maps and validates the asset at Path.
+    bool Open(const char* Path);
+    // Maps and validates the asset published under Name by another process,
+    // if it holds occluders with the given CullingCore::GetOccluderHash.
+    // Fails while the publisher is still writing it.
+    bool OpenShared(const char* Name, uint64_t OccluderHash);
+    // Publishes the occluders of Core to shared memory under Name,
+    // then maps them read-only like OpenShared, so that Core can load them
+    // in place and free its own copy. Call after Core.BuildOccluders.
+    // Fails if Name already holds the same occluders, so open them instead.
+    // Replaces anything else under Name, such as the occluders of another
+    // map, or an asset left unfinished by a publisher that crashed.
+    bool PublishShared(const char* Name, const CullingCore& Core);
+    bool IsOpen() const { return Header != nullptr; }
+
+    // Views the records in the mapping, which live as long as the asset.
+    FastBVH::ConstIterable<Cuboid> GetCuboids() const;
+    FastBVH::ConstIterable<Sphere> GetSpheres() const;
+    FastBVH::ConstIterable<FastBVH::WideNode> GetWideNodes() const;
+    FastBVH::ConstIterable<FastBVH::WideNode> GetSphereNodes() const;
+    FastBVH::ConstIterable<CuboidVertices> GetCuboidVertices() const;
+};
@@ -15,14 +15,15 @@ void AOccludingCuboid::DrawEdges(bool Persist = false)
     UWorld* World = GetWorld();
     for (int i = 0; i < CUBOID_F; i++)
     {
-        //FString S = FString::SanitizeFloat(OccludingCuboid.Faces[i].Normal.X);
+        //FString S = FString::SanitizeFloat(OccludingCuboid.GetNormal(i).X);
         //GEngine->AddOnScreenDebugMessage(-1, 0.1f, FColor::Yellow, S);
         for (int j = 0; j < CUBOID_FACE_V; j++)
         {
             ACullingController::ConnectVectors(
                 World,
-                OccludingCuboid.GetVertex(i, j),
-                OccludingCuboid.GetVertex(i, (j + 1) % CUBOID_FACE_V),
+                ACullingController::ToFVector(OccludingCuboid.GetVertex(i, j)),
+                ACullingController::ToFVector(
+                    OccludingCuboid.GetVertex(i, (j + 1) % CUBOID_FACE_V)),
                 Persist,
                 0.2 + (DrawPeriod / 120.0f),
                 3,
@@ -63,7 +64,12 @@ void AOccludingCuboid::Update()
     Vertices.Emplace(T.TransformPosition(V5));
     Vertices.Emplace(T.TransformPosition(V6));
     Vertices.Emplace(T.TransformPosition(V7));
-    OccludingCuboid = Cuboid(Vertices);
+    std::vector<Vec3> CoreVertices;
+    for (const FVector& V : Vertices)
+    {
+        CoreVertices.emplace_back(ACullingController::ToVec3(V));
+    }
+    OccludingCuboid = CuboidVertices(CoreVertices);
 }
 
 bool AOccludingCuboid::ShouldTickIfViewportsOnly() const { return true; }
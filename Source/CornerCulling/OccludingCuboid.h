@@ -41,11 +41,15 @@ public:
 	TArray<FVector> Vertices;
 	UPROPERTY(EditAnywhere)
     bool DrawEdgesInGame = true;
+	// Whether the cuboid moves during play, such as an elevator or door.
+	// The culling controller refits its BVH to moving cuboids.
+	UPROPERTY(EditAnywhere)
+	bool Moving = false;
 	// The occluding cuboid.
     // NOTE:
     //   Redundant and separate from CullingController
     //   because of UE4's garbage collection.
-	Cuboid OccludingCuboid;
+	CuboidVertices OccludingCuboid;
 
 	// Updates the OccludingCuboid according to the vertices.
 	void Update();
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cmath>
+
+// Used in place of a zero reciprocal, matching Unreal's BIG_NUMBER.
+constexpr float VEC3_BIG_NUMBER = 3.4e+38f;
+
+// Small engine-independent 3D vector used by the culling core.
+// Mirrors the subset of FVector's interface that the culling math uses,
+// so that the same code compiles inside and outside of Unreal Engine.
+struct Vec3
+{
+    float X;
+    float Y;
+    float Z;
+    // Constructs an uninitialized vector, like FVector.
+    Vec3() {}
+    constexpr Vec3(float X, float Y, float Z) : X(X), Y(Y), Z(Z) {}
+
+    Vec3 operator+(const Vec3& V) const { return Vec3(X + V.X, Y + V.Y, Z + V.Z); }
+    Vec3 operator-(const Vec3& V) const { return Vec3(X - V.X, Y - V.Y, Z - V.Z); }
+    Vec3 operator-() const { return Vec3(-X, -Y, -Z); }
+    Vec3 operator*(float Scale) const { return Vec3(X * Scale, Y * Scale, Z * Scale); }
+    Vec3 operator/(float Scale) const { return Vec3(X / Scale, Y / Scale, Z / Scale); }
+    Vec3& operator+=(const Vec3& V)
+    {
+        X += V.X;
+        Y += V.Y;
+        Z += V.Z;
+        return *this;
+    }
+    Vec3& operator-=(const Vec3& V)
+    {
+        X -= V.X;
+        Y -= V.Y;
+        Z -= V.Z;
+        return *this;
+    }
+    bool operator==(const Vec3& V) const { return X == V.X && Y == V.Y && Z == V.Z; }
+    bool operator!=(const Vec3& V) const { return !(*this == V); }
+
+    // Dot product.
+    float operator|(const Vec3& V) const { return X * V.X + Y * V.Y + Z * V.Z; }
+    // Cross product.
+    Vec3 operator^(const Vec3& V) const
+    {
+        return Vec3(
+            Y * V.Z - Z * V.Y,
+            Z * V.X - X * V.Z,
+            X * V.Y - Y * V.X);
+    }
+    static Vec3 CrossProduct(const Vec3& A, const Vec3& B) { return A ^ B; }
+    static float DotProduct(const Vec3& A, const Vec3& B) { return A | B; }
+
+    float SizeSquared() const { return X * X + Y * Y + Z * Z; }
+    float Size() const { return std::sqrt(SizeSquared()); }
+
+    // Gets a normalized copy of the vector,
+    // or the zero vector if it is too small to safely normalize.
+    Vec3 GetSafeNormal(float Tolerance = 1e-8f) const
+    {
+        const float SquareSum = SizeSquared();
+        if (SquareSum == 1.f)
+        {
+            return *this;
+        }
+        else if (SquareSum < Tolerance)
+        {
+            return Vec3(0, 0, 0);
+        }
+        const float Scale = 1.f / std::sqrt(SquareSum);
+        return Vec3(X * Scale, Y * Scale, Z * Scale);
+    }
+
+    // Gets the element-wise reciprocal, substituting VEC3_BIG_NUMBER
+    // for reciprocals of zero.
+    Vec3 Reciprocal() const
+    {
+        return Vec3(
+            X != 0.f ? 1.f / X : VEC3_BIG_NUMBER,
+            Y != 0.f ? 1.f / Y : VEC3_BIG_NUMBER,
+            Z != 0.f ? 1.f / Z : VEC3_BIG_NUMBER);
+    }
+};
+
+inline Vec3 operator*(float Scale, const Vec3& V)
+{
+    return V * Scale;
+}
+
+// Rotation quaternion, laid out like FQuat.
+struct Quat
+{
+    float X = 0;
+    float Y = 0;
+    float Z = 0;
+    float W = 1;
+    Quat() {}
+    constexpr Quat(float X, float Y, float Z, float W) : X(X), Y(Y), Z(Z), W(W) {}
+
+    // Constructs a rotation of Yaw radians about the Z axis.
+    static Quat FromYaw(float Yaw)
+    {
+        return Quat(0, 0, std::sin(Yaw * 0.5f), std::cos(Yaw * 0.5f));
+    }
+
+    // Rotates a vector by the quaternion.
+    // Uses the same formula as FQuat::RotateVector.
+    Vec3 RotateVector(const Vec3& V) const
+    {
+        const Vec3 Q(X, Y, Z);
+        const Vec3 T = 2.f * (Q ^ V);
+        return V + (W * T) + (Q ^ T);
+    }
+};
+
+// Rotation and translation of a rigid body.
+// Equivalent to an FTransform with unit scale.
+struct RigidTransform
+{
+    Quat Rotation;
+    Vec3 Translation = Vec3(0, 0, 0);
+    RigidTransform() {}
+    RigidTransform(const Quat& Rotation, const Vec3& Translation)
+        : Rotation(Rotation), Translation(Translation) {}
+
+    const Vec3& GetTranslation() const { return Translation; }
+    Vec3 TransformPositionNoScale(const Vec3& V) const
+    {
+        return Rotation.RotateVector(V) + Translation;
+    }
+};
@@ -0,0 +1,117 @@
+#include "WorkStealingPool.h"
+#include <algorithm>
+
+WorkStealingPool::WorkStealingPool(int Workers)
+{
+    if (Workers <= 0)
+    {
+        Workers = std::max(int(std::thread::hardware_concurrency()), 1);
+    }
+    NumWorkers = Workers;
+    Runs.reset(new TaskRun[NumWorkers]);
+    for (int w = 1; w < NumWorkers; w++)
+    {
+        Threads.emplace_back(&WorkStealingPool::WorkerLoop, this, w);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        Stopping = true;
+    }
+    Wake.notify_all();
+    for (std::thread& Thread : Threads)
+    {
+        Thread.join();
+    }
+}
+
+void WorkStealingPool::Run(int NumTasks, const std::function<void(int, int)>& Function)
+{
+    if (NumWorkers == 1)
+    {
+        for (int t = 0; t < NumTasks; t++)
+        {
+            Function(t, 0);
+        }
+        return;
+    }
+    // Deal contiguous runs, so that neighbouring tasks share a worker
+    // unless stolen.
+    for (int w = 0; w < NumWorkers; w++)
+    {
+        std::lock_guard<std::mutex> Guard(Runs[w].Lock);
+        Runs[w].Begin = int(int64_t(NumTasks) * w / NumWorkers);
+        Runs[w].End = int(int64_t(NumTasks) * (w + 1) / NumWorkers);
+    }
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        Task = &Function;
+        Busy = NumWorkers - 1;
+        Batch++;
+    }
+    Wake.notify_all();
+    Work(0);
+    std::unique_lock<std::mutex> Guard(Lock);
+    Done.wait(Guard, [this] { return Busy == 0; });
+    Task = nullptr;
+}
+
+void WorkStealingPool::WorkerLoop(int Worker)
+{
+    uint64_t SeenBatch = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> Guard(Lock);
+            Wake.wait(Guard, [this, SeenBatch] { return Stopping || Batch != SeenBatch; });
+            if (Stopping)
+            {
+                return;
+            }
+            SeenBatch = Batch;
+        }
+        Work(Worker);
+        {
+            std::lock_guard<std::mutex> Guard(Lock);
+            Busy--;
+            if (Busy == 0)
+            {
+                Done.notify_one();
+            }
+        }
+    }
+}
+
+void WorkStealingPool::Work(int Worker)
+{
+    for (int t = TakeTask(Worker); t >= 0; t = TakeTask(Worker))
+    {
+        (*Task)(t, Worker);
+    }
+}
+
+int WorkStealingPool::TakeTask(int Worker)
+{
+    {
+        TaskRun& Own = Runs[Worker];
+        std::lock_guard<std::mutex> Guard(Own.Lock);
+        if (Own.Begin < Own.End)
+        {
+            return Own.Begin++;
+        }
+    }
+    // Steal from the other runs in turn, starting with the next worker's.
+    for (int k = 1; k < NumWorkers; k++)
+    {
+        TaskRun& Victim = Runs[(Worker + k) % NumWorkers];
+        std::lock_guard<std::mutex> Guard(Victim.Lock);
+        if (Victim.Begin < Victim.End)
+        {
+            return --Victim.End;
+        }
+    }
+    return -1;
+}
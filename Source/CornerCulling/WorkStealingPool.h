@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads that run batches of independent tasks.
+// Each batch deals its tasks out to the workers in contiguous runs.
+// A worker takes tasks from the front of its own run, then steals from
+// the back of other runs, so uneven tasks still keep every worker busy.
+// The thread calling Run works as worker 0, so one worker starts no threads.
+class WorkStealingPool
+{
+    // Run of tasks dealt to one worker, padded to its own cache line.
+    struct alignas(64) TaskRun
+    {
+        std::mutex Lock;
+        int Begin = 0;
+        int End = 0;
+    };
+
+    std::vector<std::thread> Threads;
+    std::unique_ptr<TaskRun[]> Runs;
+    int NumWorkers = 1;
+
+    // Guards the fields below, which hand batches to worker threads.
+    std::mutex Lock;
+    std::condition_variable Wake;
+    std::condition_variable Done;
+    // Task function of the current batch.
+    const std::function<void(int, int)>* Task = nullptr;
+    // Incremented for each batch, so that workers wake once per batch.
+    uint64_t Batch = 0;
+    // Worker threads still working on the current batch.
+    int Busy = 0;
+    bool Stopping = false;
+
+    void WorkerLoop(int Worker);
+    // Runs tasks until no run has any left.
+    void Work(int Worker);
+    // Takes a task from the front of a worker's own run,
+    // or from the back of another run. Returns -1 if none are left.
+    int TakeTask(int Worker);
+
+public:
+    // Starts Workers - 1 threads, where zero or less uses
+    // every hardware thread.
+    explicit WorkStealingPool(int Workers);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int GetNumWorkers() const { return NumWorkers; }
+    // Calls Function(t, Worker) for each task t from 0 up to NumTasks,
+    // where Worker is the index of the calling worker,
+    // and returns once every task has returned.
+    // Tasks may run in any order and on any worker.
+    void Run(int NumTasks, const std::function<void(int, int)>& Function);
+};